@@ -1,93 +1,78 @@
 ﻿#include "Collision.h"
 
-#include <iostream>
+#include "Physics/PhysicsWorld.h"
 
-#include "Mesh/Mesh.h"
-
-#include <glad/glad.h>
 #include <glm/matrix.hpp>
 #include <glm/gtc/type_ptr.hpp>
 
 Collision::Collision()
 {
-    
+    simdLevel = DetectSimdLevel();
 }
 
-bool Collision::AABBCollision(Mesh* mesh1, Mesh* other)
+void Collision::ResetCounters()
 {
-    bool overlapX = mesh1->minVert.x <= other->maxVert.x && mesh1->maxVert.x >= other->minVert.x;
-    bool overlapY = mesh1->minVert.y <= other->maxVert.y && mesh1->maxVert.y >= other->minVert.y;
-    bool overlapZ = mesh1->minVert.z <= other->maxVert.z && mesh1->maxVert.z >= other->minVert.z;
-    
-    bool collision = overlapX && overlapY && overlapZ;
-
-    std::cout << overlapX << " " << overlapY << " " << overlapZ << std::endl;
-    
-    if (collision)
-    {
-        glm::vec3 collisionNormal = glm::normalize(mesh1->globalPosition - other->globalPosition);
-
-        // Reflect velocity
-        mesh1->velocity = glm::reflect(mesh1->velocity, collisionNormal);
-    }
-    
-    return collision;
+    sphereTests = 0;
+    sphereContacts = 0;
 }
 
-bool Collision::SphereCollision(Mesh* mesh1, Mesh* other)
+bool Collision::SphereCollision(PhysicsWorld& world, int body1, int body2)
 {
-    float distance = glm::length(mesh1->globalPosition - other->globalPosition);
-    float sumRadius = mesh1->Radius + other->Radius;
-    
+    sphereTests++;
+
+    glm::vec3 position1 = world.GetPosition(body1);
+    glm::vec3 position2 = world.GetPosition(body2);
+
+    float distance = glm::length(position1 - position2);
+    float sumRadius = world.radius[body1] + world.radius[body2];
+
     bool collision = distance < sumRadius;
-    
+
     if (collision)
     {
-        std::cout << "Sphere Collision detected" << std::endl;
-        glm::vec3 collisionNormal = glm::normalize(mesh1->globalPosition - other->globalPosition);
-        
-        
+        sphereContacts++;
+        glm::vec3 collisionNormal = glm::normalize(position1 - position2);
+
+        glm::vec3 velocity1 = world.GetVelocity(body1);
+        glm::vec3 velocity2 = world.GetVelocity(body2);
+        float velocityAlongNormal = glm::dot(velocity1 - velocity2, collisionNormal);
+
+        // Something ran into a sleeping sphere hard enough to move it. A gentler touch leaves it asleep
+        // and solid, like in ContactSolver::Prepare, and the awake one gets all of the push
+        if (velocityAlongNormal < -world.sleepVelocity)
+        {
+            world.WakeBody(body1);
+            world.WakeBody(body2);
+        }
+        bool moves1 = world.IsAwake(body1);
+        bool moves2 = world.IsAwake(body2);
+
         float penetrationDepth = sumRadius - distance;
-    
-        // No more clipping hopefully
-        mesh1->globalPosition += collisionNormal * (penetrationDepth / 2.0f);
-        other->globalPosition -= collisionNormal * (penetrationDepth / 2.0f);
-
-        // Relative velocity along normal
-        glm::vec3 relativeVelocity = mesh1->velocity - other->velocity;
-        float velocityAlongNormal = glm::dot(relativeVelocity, collisionNormal);
-
-        // Ignore sphere not moving towards each other
-        if (velocityAlongNormal > 0) return false;
-        
+        float share1 = moves1 ? (moves2 ? 0.5f : 1.0f) : 0.0f;
+        float share2 = moves2 ? (moves1 ? 0.5f : 1.0f) : 0.0f;
+
+        world.SetPosition(body1, position1 + collisionNormal * (penetrationDepth * share1));
+        world.SetPosition(body2, position2 - collisionNormal * (penetrationDepth * share2));
+
+        float invMass1 = moves1 ? world.invMass[body1] : 0.0f;
+        float invMass2 = moves2 ? world.invMass[body2] : 0.0f;
+
+        if (velocityAlongNormal > 0 || invMass1 + invMass2 <= 0.0f)
+        {
+            events.Push({ body1, body2, collisionNormal, penetrationDepth, 0.0f });
+            return velocityAlongNormal <= 0;
+        }
+
         // Bounciness
         float e = 1.f;
-        
-        float mass1 = mesh1->mass;
-        float mass2 = other->mass;
-        float impulseMagnitude = -(1 + e) * velocityAlongNormal / (1 / mass1 + 1 / mass2);
-        
-        glm::vec3 impulse = impulseMagnitude * collisionNormal;
-        
-        mesh1->velocity += impulse / mass1;
-        other->velocity -= impulse / mass2;
-    }
-    return collision;
-}
-
-bool Collision::SphereToAABBCollision(Mesh* mesh1, Mesh* other)
-{
-    glm::vec3 closestPoint = other->ClosestPointOnAABB(mesh1->globalPosition);
-    float distance = glm::length(closestPoint-mesh1->globalPosition);
+        float impulseMagnitude = -(1 + e) * velocityAlongNormal / (invMass1 + invMass2);
 
-    bool collision = distance < mesh1->Radius;
+        glm::vec3 impulse = impulseMagnitude * collisionNormal;
 
-    if (collision)
-    {
-        std::cout << "Sphere AABB Collision detected" << std::endl;
-        glm::vec3 collisionNormal = glm::normalize(mesh1->globalPosition - closestPoint);
+        world.SetVelocity(body1, velocity1 + impulse * invMass1);
+        world.SetVelocity(body2, velocity2 - impulse * invMass2);
 
-        mesh1->velocity = glm::reflect(mesh1->velocity, collisionNormal);
+        events.Push({ body1, body2, collisionNormal, penetrationDepth, impulseMagnitude });
     }
     return collision;
 }
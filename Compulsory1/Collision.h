@@ -1,6 +1,19 @@
 ﻿#pragma once
+#include <utility>
+#include <vector>
+#include "Physics/AABB.h"
+#include "Physics/AABBTree.h"
+#include "Physics/CollisionEvents.h"
+#include "Physics/ContactColoring.h"
+#include "Physics/OBB.h"
 
-class Mesh;
+class PhysicsWorld;
+class Surface;
+class ThreadPool;
+
+enum BroadphaseType {BruteForce, UniformGrid, IncrementalSweep, DynamicTree, VerletList, MortonBVH};
+
+enum SimdLevel {SimdScalar, SimdSSE, SimdAVX2};
 
 class Collision
 {
@@ -8,10 +21,89 @@ public:
 
     Collision();
 
-    bool AABBCollision(Mesh* mesh1, Mesh* mesh2);
+    /// \brief Pushes two overlapping spheres apart and bounces them off each other.
+    /// No friction, so the spin is left alone, see PhysicsWorld
+    bool SphereCollision(PhysicsWorld& world, int body1, int body2);
+
+    /// \brief Separating axis test between two oriented boxes, see CollisionOBB.cpp.
+    /// Tests the 15 axes 4 at a time with SSE.
+    /// \param normal unit normal pointing from b towards a, only set on overlap
+    /// \param depth how far a has to move along normal to stop overlapping
+    static bool OBBOverlap(const OBB& a, const OBB& b, glm::vec3& normal, float& depth);
+
+    /// \brief Where a sphere touches a rotated box, without doing anything about it
+    /// \param normal unit normal pointing out of the box towards the sphere
+    /// \param depth overlap along normal, more than radius if the centre is inside the box
+    static bool SphereOBBContact(const glm::vec3& center, float radius, const OBB& box, glm::vec3& normal, float& depth);
+
+    /// \brief Pushes a sphere out of a rotated box and reflects its velocity off the face it touches
+    bool SphereToOBBCollision(PhysicsWorld& world, int body, const OBB& box);
+
+    /// \brief Where a sphere touches a heightfield, see CollisionSurface.cpp.
+    /// Only the triangles of the grid cells under the sphere are tested, found straight from its position,
+    /// so the cost doesn't grow with the size of the surface. Radius should be below Surface::spacing
+    /// for the cells under it to be the ones it can touch.
+    /// \param normal unit normal pointing out of the surface towards the sphere
+    /// \param depth overlap along normal, more than radius if the centre is under the surface
+    static bool SphereSurfaceContact(const glm::vec3& center, float radius, const Surface& surface, glm::vec3& normal, float& depth);
+
+    /// \brief Resolves a list of sphere pairs 4 or 8 at a time, see CollisionSIMD.cpp.
+    /// Matches calling SphereCollision on each pair in order to within float rounding, the kernels work
+    /// out the normal and impulse in a different order.
+    /// \return number of pairs in contact
+    int SphereCollisionBatch(PhysicsWorld& world, const std::vector<std::pair<int, int>>& pairs);
+
+    /// \brief Resolves a list of sphere pairs on every thread of pool, see CollisionParallel.cpp.
+    /// The pairs are coloured so bodies are never shared between threads, and each colour is solved
+    /// after the previous one. Result doesn't depend on the thread count, but pairs are not resolved
+    /// in list order, so it differs slightly from SphereCollisionBatch.
+    /// \return number of pairs in contact
+    int SphereCollisionParallel(PhysicsWorld& world, const std::vector<std::pair<int, int>>& pairs, ThreadPool& pool);
+
+    /// \brief Continuous collision for bodies that travel further than their radius in one step,
+    /// see CollisionContinuous.cpp. Call right after PhysicsWorld::Integrate: each fast body is moved
+    /// again from its previous position in sub-steps that stop at the first wall or sphere it would hit.
+    /// \param walls boxes of the static world
+    /// \param wallTree tree over walls, user data is the index into walls
+    /// \return number of hits found
+    int SweepFastBodies(PhysicsWorld& world, float deltaTime, const std::vector<OBB>& walls, const AABBTree& wallTree);
+
+    static SimdLevel DetectSimdLevel();
+
+    // Instruction set used by SphereCollisionBatch, picked from the CPU at startup
+    SimdLevel simdLevel = SimdScalar;
+
+    void ResetCounters();
+
+    // Narrowphase stats, reset every frame
+    int sphereTests = 0;
+    int sphereContacts = 0;
+
+    // Every contact the functions above resolve, for game code to Pop or for StartLogging to print
+    CollisionEventRing events;
+
+private:
+
+    /// \brief Kernel loop behind SphereCollisionBatch, touches nothing but the bodies in pairs
+    /// \param tests number of pairs tested
+    /// \param woken sleeping bodies hit faster than sleepVelocity, the caller wakes them once it is safe to
+    /// \param events safe to share between threads
+    /// \return number of pairs in contact
+    static int ResolveSpan(PhysicsWorld& world, const std::pair<int, int>* pairs, int count, SimdLevel simdLevel,
+        int& tests, std::vector<int>& woken, CollisionEventRing& events);
+
+    void WakeAll(PhysicsWorld& world, std::vector<int>& woken);
+
+    ContactColoring coloring;
 
-    bool SphereCollision(Mesh* mesh1, Mesh* mesh2);
+    // One list per thread for SphereCollisionParallel
+    std::vector<std::vector<int>> wokenBodies;
 
-    bool SphereToAABBCollision(Mesh* mesh1, Mesh* mesh2);
+    // SweepFastBodies: the box around each body's path through the step, kept between steps like the
+    // broadphase trees. A body knocked off its path restarts from prev at sweepStart into the step
+    AABBTree sweepTree;
+    std::vector<int> sweepProxies;
+    std::vector<float> sweepStart;
+    std::vector<int> sweepCandidates;
     
 };
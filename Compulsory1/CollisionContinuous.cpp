@@ -0,0 +1,269 @@
+﻿#include "Collision.h"
+
+#include <algorithm>
+#include <cmath>
+
+#include "Physics/PhysicsWorld.h"
+
+#include <glm/geometric.hpp>
+
+namespace
+{
+    // Sub-steps per fast body and step, a sphere bouncing in a corner can hit a lot in one step
+    const int MaxSweepIterations = 8;
+
+    // Fraction of the time of impact we stop short, so the contact isn't found again right away
+    const float ContactSlop = 1e-4f;
+
+    /// \brief Time a sphere moving from start by velocity first touches box, found as a ray against the
+    /// box grown by radius. Corners are treated as square, which can only report a hit slightly early.
+    /// \param normal face the sphere hits
+    /// \return false if it doesn't hit within maxTime, or already overlaps the box at the start
+    bool SweepSphereAABB(const glm::vec3& start, const glm::vec3& velocity, float radius, const AABB& box,
+        float maxTime, float& time, glm::vec3& normal)
+    {
+        float enter = 0.0f;
+        float exit = maxTime;
+        int enterAxis = -1;
+
+        for (int axis = 0; axis < 3; ++axis)
+        {
+            float min = box.min[axis] - radius;
+            float max = box.max[axis] + radius;
+
+            if (velocity[axis] == 0.0f)
+            {
+                if (start[axis] < min || start[axis] > max) return false;
+                continue;
+            }
+
+            float t1 = (min - start[axis]) / velocity[axis];
+            float t2 = (max - start[axis]) / velocity[axis];
+            if (t1 > t2) std::swap(t1, t2);
+
+            if (t1 > enter)
+            {
+                enter = t1;
+                enterAxis = axis;
+            }
+            if (t2 < exit) exit = t2;
+            if (enter > exit) return false;
+        }
+
+        // Inside from the start, the discrete test deals with that
+        if (enterAxis == -1) return false;
+
+        time = enter;
+        normal = glm::vec3(0.0f);
+        normal[enterAxis] = velocity[enterAxis] > 0.0f ? -1.0f : 1.0f;
+        return true;
+    }
+
+    /// \brief SweepSphereAABB done in the box's own frame
+    bool SweepSphereOBB(const glm::vec3& start, const glm::vec3& velocity, float radius, const OBB& box,
+        float maxTime, float& time, glm::vec3& normal)
+    {
+        glm::vec3 localVelocity(glm::dot(velocity, box.axes[0]), glm::dot(velocity, box.axes[1]), glm::dot(velocity, box.axes[2]));
+        glm::vec3 localNormal;
+        if (!SweepSphereAABB(box.ToLocal(start), localVelocity, radius, AABB(-box.halfExtents, box.halfExtents),
+            maxTime, time, localNormal)) return false;
+
+        normal = box.ToWorldDirection(localNormal);
+        return true;
+    }
+
+    /// \brief Time two spheres first touch, given their offset and relative velocity
+    /// \return false if they don't within maxTime, or already overlap
+    bool SweepSpheres(const glm::vec3& offset, const glm::vec3& relativeVelocity, float sumRadius, float maxTime, float& time)
+    {
+        float c = glm::dot(offset, offset) - sumRadius * sumRadius;
+        if (c <= 0.0f) return false;
+
+        float b = glm::dot(offset, relativeVelocity);
+        if (b >= 0.0f) return false;
+
+        float a = glm::dot(relativeVelocity, relativeVelocity);
+        float d = b * b - a * c;
+        if (d < 0.0f) return false;
+
+        time = (-b - std::sqrt(d)) / a;
+        return time <= maxTime;
+    }
+
+    /// \brief Bodies that move less than their radius can't skip over anything the discrete test would miss
+    bool IsFast(const PhysicsWorld& world, int body, float deltaTime)
+    {
+        glm::vec3 velocity = world.GetVelocity(body);
+        return glm::dot(velocity, velocity) * deltaTime * deltaTime > world.radius[body] * world.radius[body];
+    }
+
+    /// \brief Where a body's straight path through the step begins. Sleeping bodies keep no previous position
+    glm::vec3 PathStart(const PhysicsWorld& world, int body)
+    {
+        return world.IsAwake(body) ? glm::vec3(world.prevX[body], world.prevY[body], world.prevZ[body]) : world.GetPosition(body);
+    }
+
+    /// \brief Box around a sphere of radius going from start to end
+    AABB PathBox(const glm::vec3& start, const glm::vec3& end, float radius)
+    {
+        return AABB(glm::min(start, end) - glm::vec3(radius), glm::max(start, end) + glm::vec3(radius));
+    }
+}
+
+int Collision::SweepFastBodies(PhysicsWorld& world, float deltaTime, const std::vector<OBB>& walls, const AABBTree& wallTree)
+{
+    int hits = 0;
+    const int count = world.GetBodyCount();
+
+    bool anyFast = false;
+    for (int body : world.activeBodies)
+    {
+        anyFast = anyFast || IsFast(world, body, deltaTime);
+    }
+    if (!anyFast) return 0;
+
+    // Every body's path through the step, so a fast body only looks at the ones it can meet
+    if ((int)sweepProxies.size() > count)
+    {
+        sweepTree = AABBTree();
+        sweepProxies.clear();
+    }
+    sweepStart.assign(count, 0.0f);
+    for (int body = 0; body < count; ++body)
+    {
+        AABB path = PathBox(PathStart(world, body), world.GetPosition(body), world.radius[body]);
+        if (body == (int)sweepProxies.size()) sweepProxies.push_back(sweepTree.CreateProxy(path, body));
+        else sweepTree.MoveProxy(sweepProxies[body], path, world.GetVelocity(body) * deltaTime);
+    }
+
+    // Where a body is time into the step, on its straight path from where it last started
+    auto positionAt = [&](int body, float time)
+    {
+        return PathStart(world, body) + world.GetVelocity(body) * std::max(time - sweepStart[body], 0.0f);
+    };
+
+    // Indexed, waking a body that gets hit appends to activeBodies
+    for (int a = 0; a < world.GetActiveCount(); ++a)
+    {
+        const int body = world.activeBodies[a];
+        const float radius = world.radius[body];
+        glm::vec3 velocity = world.GetVelocity(body);
+
+        if (!IsFast(world, body, deltaTime)) continue;
+
+        // Start over from where the step began, or from where another fast body knocked it this step
+        glm::vec3 position = PathStart(world, body);
+        float elapsed = sweepStart[body];
+        glm::vec3 bouncePosition = position;
+        float bounceTime = elapsed;
+
+        for (int iteration = 0; iteration < MaxSweepIterations; ++iteration)
+        {
+            const float remaining = deltaTime - elapsed;
+            const AABB swept = PathBox(position, position + velocity * remaining, radius);
+
+            float hitTime = remaining;
+            int hitBody = -1;
+            glm::vec3 hitNormal(0.0f);
+
+            wallTree.Query(swept, [&](int wall)
+            {
+                float time;
+                glm::vec3 normal;
+                if (SweepSphereOBB(position, velocity, radius, walls[wall], hitTime, time, normal))
+                {
+                    hitTime = time;
+                    hitBody = -1;
+                    hitNormal = normal;
+                }
+                return true;
+            });
+
+            sweepCandidates.clear();
+            sweepTree.Query(swept, [&](int other)
+            {
+                if (other != body) sweepCandidates.push_back(other);
+                return true;
+            });
+
+            for (int other : sweepCandidates)
+            {
+                // The tree box covers the whole step, this is only what is left of it
+                glm::vec3 otherVelocity = world.GetVelocity(other);
+                glm::vec3 otherPosition = positionAt(other, elapsed);
+                if (!swept.Overlaps(PathBox(otherPosition, otherPosition + otherVelocity * remaining, world.radius[other]))) continue;
+
+                float time;
+                if (SweepSpheres(position - otherPosition, velocity - otherVelocity, radius + world.radius[other], hitTime, time))
+                {
+                    hitTime = time;
+                    hitBody = other;
+                }
+            }
+
+            bool hit = hitTime < remaining || hitBody != -1;
+            if (!hit)
+            {
+                position += velocity * remaining;
+                break;
+            }
+
+            hits++;
+            hitTime *= 1.0f - ContactSlop;
+            position += velocity * hitTime;
+            elapsed += hitTime;
+            bouncePosition = position;
+            bounceTime = elapsed;
+
+            if (hitBody == -1)
+            {
+                // Same response as SphereToOBBCollision
+                float impulse = world.invMass[body] > 0.0f ? -2.0f * glm::dot(velocity, hitNormal) / world.invMass[body] : 0.0f;
+                velocity = glm::reflect(velocity, hitNormal);
+                events.Push({ body, -1, hitNormal, 0.0f, impulse });
+                continue;
+            }
+
+            // Same impulse as SphereCollision
+            glm::vec3 otherVelocity = world.GetVelocity(hitBody);
+            glm::vec3 otherPosition = positionAt(hitBody, elapsed);
+
+            glm::vec3 collisionNormal = glm::normalize(position - otherPosition);
+            float velocityAlongNormal = glm::dot(velocity - otherVelocity, collisionNormal);
+            float invMassSum = world.invMass[body] + world.invMass[hitBody];
+            float impulseMagnitude = 0.0f;
+            if (velocityAlongNormal < 0.0f && invMassSum > 0.0f)
+            {
+                float e = 1.f;
+                impulseMagnitude = -(1 + e) * velocityAlongNormal / invMassSum;
+                velocity += collisionNormal * impulseMagnitude * world.invMass[body];
+                otherVelocity -= collisionNormal * impulseMagnitude * world.invMass[hitBody];
+            }
+            events.Push({ body, hitBody, collisionNormal, 0.0f, impulseMagnitude });
+
+            // The other body starts a new path from the bounce, so later sweeps and the interpolated
+            // drawing both begin there instead of from a start it never had
+            world.WakeBody(hitBody);
+            world.SetPosition(hitBody, otherPosition + otherVelocity * (deltaTime - elapsed));
+            world.SetVelocity(hitBody, otherVelocity);
+            world.prevX[hitBody] = otherPosition.x;
+            world.prevY[hitBody] = otherPosition.y;
+            world.prevZ[hitBody] = otherPosition.z;
+            sweepStart[hitBody] = elapsed;
+            sweepTree.MoveProxy(sweepProxies[hitBody], PathBox(otherPosition, world.GetPosition(hitBody), world.radius[hitBody]),
+                otherVelocity * deltaTime);
+        }
+
+        world.SetPosition(body, position);
+        world.SetVelocity(body, velocity);
+
+        // Same for this body after its last bounce
+        world.prevX[body] = bouncePosition.x;
+        world.prevY[body] = bouncePosition.y;
+        world.prevZ[body] = bouncePosition.z;
+        sweepStart[body] = bounceTime;
+        sweepTree.MoveProxy(sweepProxies[body], PathBox(bouncePosition, position, radius), velocity * deltaTime);
+    }
+
+    return hits;
+}
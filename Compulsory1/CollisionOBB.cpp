@@ -0,0 +1,188 @@
+﻿#include "Collision.h"
+
+#include <cfloat>
+#include <cmath>
+#include <immintrin.h>
+
+#include "Physics/PhysicsWorld.h"
+
+namespace
+{
+    // 3 face axes of each box plus the 9 edge cross products, padded to a multiple of 4 lanes
+    const int AxisCount = 15;
+    const int AxisLanes = 16;
+
+    // Cross products of nearly parallel edges are too short to give a direction, they are skipped
+    const float MinAxisLengthSq = 1e-6f;
+
+    inline __m128 Abs(__m128 value)
+    {
+        return _mm_andnot_ps(_mm_set1_ps(-0.0f), value);
+    }
+
+    inline __m128 Dot(__m128 ax, __m128 ay, __m128 az, const glm::vec3& v)
+    {
+        return _mm_add_ps(_mm_add_ps(_mm_mul_ps(ax, _mm_set1_ps(v.x)), _mm_mul_ps(ay, _mm_set1_ps(v.y))),
+            _mm_mul_ps(az, _mm_set1_ps(v.z)));
+    }
+}
+
+bool Collision::OBBOverlap(const OBB& a, const OBB& b, glm::vec3& normal, float& depth)
+{
+    alignas(16) float axisX[AxisLanes], axisY[AxisLanes], axisZ[AxisLanes];
+
+    int count = 0;
+    for (int i = 0; i < 3; ++i)
+    {
+        axisX[count] = a.axes[i].x; axisY[count] = a.axes[i].y; axisZ[count] = a.axes[i].z; count++;
+    }
+    for (int i = 0; i < 3; ++i)
+    {
+        axisX[count] = b.axes[i].x; axisY[count] = b.axes[i].y; axisZ[count] = b.axes[i].z; count++;
+    }
+    for (int i = 0; i < 3; ++i)
+    {
+        for (int j = 0; j < 3; ++j)
+        {
+            glm::vec3 axis = glm::cross(a.axes[i], b.axes[j]);
+            axisX[count] = axis.x; axisY[count] = axis.y; axisZ[count] = axis.z; count++;
+        }
+    }
+    for (; count < AxisLanes; ++count)
+    {
+        axisX[count] = axisY[count] = axisZ[count] = 0.0f;
+    }
+
+    const glm::vec3 offset = b.center - a.center;
+    const __m128 minLengthSq = _mm_set1_ps(MinAxisLengthSq);
+
+    float bestOverlap = FLT_MAX;
+    int bestAxis = -1;
+    float bestSide = 0.0f;
+
+    for (int lane = 0; lane < AxisLanes; lane += 4)
+    {
+        __m128 lx = _mm_load_ps(axisX + lane);
+        __m128 ly = _mm_load_ps(axisY + lane);
+        __m128 lz = _mm_load_ps(axisZ + lane);
+
+        __m128 lengthSq = _mm_add_ps(_mm_add_ps(_mm_mul_ps(lx, lx), _mm_mul_ps(ly, ly)), _mm_mul_ps(lz, lz));
+        __m128 valid = _mm_cmpgt_ps(lengthSq, minLengthSq);
+
+        // Projected radius of each box on the axis, and the distance between their centres
+        __m128 radiusA = _mm_add_ps(_mm_add_ps(
+            _mm_mul_ps(_mm_set1_ps(a.halfExtents.x), Abs(Dot(lx, ly, lz, a.axes[0]))),
+            _mm_mul_ps(_mm_set1_ps(a.halfExtents.y), Abs(Dot(lx, ly, lz, a.axes[1])))),
+            _mm_mul_ps(_mm_set1_ps(a.halfExtents.z), Abs(Dot(lx, ly, lz, a.axes[2]))));
+        __m128 radiusB = _mm_add_ps(_mm_add_ps(
+            _mm_mul_ps(_mm_set1_ps(b.halfExtents.x), Abs(Dot(lx, ly, lz, b.axes[0]))),
+            _mm_mul_ps(_mm_set1_ps(b.halfExtents.y), Abs(Dot(lx, ly, lz, b.axes[1])))),
+            _mm_mul_ps(_mm_set1_ps(b.halfExtents.z), Abs(Dot(lx, ly, lz, b.axes[2]))));
+        __m128 side = Dot(lx, ly, lz, offset);
+
+        // Overlap along the unit axis, so axes of different lengths can be compared
+        __m128 overlap = _mm_div_ps(_mm_sub_ps(_mm_add_ps(radiusA, radiusB), Abs(side)),
+            _mm_sqrt_ps(_mm_max_ps(lengthSq, minLengthSq)));
+
+        // One separating axis is enough to know they don't touch
+        if (_mm_movemask_ps(_mm_and_ps(valid, _mm_cmplt_ps(overlap, _mm_setzero_ps()))) != 0) return false;
+
+        alignas(16) float overlaps[4], sides[4];
+        _mm_store_ps(overlaps, overlap);
+        _mm_store_ps(sides, side);
+        int validMask = _mm_movemask_ps(valid);
+        for (int l = 0; l < 4; ++l)
+        {
+            if ((validMask & (1 << l)) && overlaps[l] < bestOverlap)
+            {
+                bestOverlap = overlaps[l];
+                bestAxis = lane + l;
+                bestSide = sides[l];
+            }
+        }
+    }
+
+    // Push a out of b the short way, the normal points from b towards a
+    glm::vec3 axis = glm::normalize(glm::vec3(axisX[bestAxis], axisY[bestAxis], axisZ[bestAxis]));
+    normal = bestSide > 0.0f ? -axis : axis;
+    depth = bestOverlap;
+    return true;
+}
+
+bool Collision::SphereOBBContact(const glm::vec3& center, float radius, const OBB& box, glm::vec3& normal, float& depth)
+{
+    glm::vec3 offset = center - box.center;
+
+    // Sphere centre in the box frame for all three axes at once, lane 3 stays zero
+    __m128 axisX = _mm_set_ps(0.0f, box.axes[2].x, box.axes[1].x, box.axes[0].x);
+    __m128 axisY = _mm_set_ps(0.0f, box.axes[2].y, box.axes[1].y, box.axes[0].y);
+    __m128 axisZ = _mm_set_ps(0.0f, box.axes[2].z, box.axes[1].z, box.axes[0].z);
+    __m128 local = Dot(axisX, axisY, axisZ, offset);
+
+    __m128 half = _mm_set_ps(0.0f, box.halfExtents.z, box.halfExtents.y, box.halfExtents.x);
+    __m128 clamped = _mm_min_ps(_mm_max_ps(local, _mm_sub_ps(_mm_setzero_ps(), half)), half);
+    __m128 outside = _mm_sub_ps(local, clamped);
+
+    alignas(16) float localPoint[4], away[4];
+    _mm_store_ps(localPoint, local);
+    _mm_store_ps(away, outside);
+
+    // The frame is orthonormal, so distances in it are world distances
+    float distanceSq = away[0] * away[0] + away[1] * away[1] + away[2] * away[2];
+    if (distanceSq >= radius * radius) return false;
+
+    if (distanceSq == 0.0f)
+    {
+        // Centre inside the box, pushed in by another sphere. Leave through the nearest face
+        int nearestAxis = 0;
+        float nearest = FLT_MAX;
+        for (int axis = 0; axis < 3; ++axis)
+        {
+            float toFace = box.halfExtents[axis] - std::fabs(localPoint[axis]);
+            if (toFace < nearest)
+            {
+                nearest = toFace;
+                nearestAxis = axis;
+            }
+        }
+
+        glm::vec3 localNormal(0.0f);
+        localNormal[nearestAxis] = localPoint[nearestAxis] < 0.0f ? -1.0f : 1.0f;
+        normal = box.ToWorldDirection(localNormal);
+        depth = radius + nearest;
+        return true;
+    }
+
+    float distance = std::sqrt(distanceSq);
+    normal = box.ToWorldDirection(glm::vec3(away[0], away[1], away[2]) / distance);
+    depth = radius - distance;
+    return true;
+}
+
+bool Collision::SphereToOBBCollision(PhysicsWorld& world, int body, const OBB& box)
+{
+    glm::vec3 position = world.GetPosition(body);
+    float radius = world.radius[body];
+
+    glm::vec3 collisionNormal;
+    float depth;
+    if (!SphereOBBContact(position, radius, box, collisionNormal, depth)) return false;
+
+    // Centre was inside the box, move it out through the face now, a reflection alone wouldn't get it out
+    if (depth >= radius)
+    {
+        world.SetPosition(body, position + collisionNormal * depth);
+    }
+
+    glm::vec3 velocity = world.GetVelocity(body);
+    float velocityAlongNormal = glm::dot(velocity, collisionNormal);
+    float impulse = 0.0f;
+    if (velocityAlongNormal < 0.0f)
+    {
+        impulse = world.invMass[body] > 0.0f ? -2.0f * velocityAlongNormal / world.invMass[body] : 0.0f;
+        world.SetVelocity(body, glm::reflect(velocity, collisionNormal));
+    }
+
+    events.Push({ body, -1, collisionNormal, depth, impulse });
+    return true;
+}
@@ -0,0 +1,64 @@
+﻿#include "Collision.h"
+
+#include "Physics/PhysicsWorld.h"
+#include "Physics/ThreadPool.h"
+
+namespace
+{
+    // Below this many pairs a colour is solved on the calling thread, waking the pool costs more
+    const int MinParallelPairs = 256;
+
+    const int MaxThreads = 64;
+}
+
+int Collision::SphereCollisionParallel(PhysicsWorld& world, const std::vector<std::pair<int, int>>& pairs, ThreadPool& pool)
+{
+    coloring.Build(pairs, world.GetBodyCount());
+    if ((int)wokenBodies.size() < MaxThreads) wokenBodies.resize(MaxThreads);
+
+    int tests = 0;
+    int contacts = 0;
+
+    // Per chunk counters, summed after each colour so nothing is shared while the workers run
+    int chunkTests[MaxThreads];
+    int chunkContacts[MaxThreads];
+    const int threads = pool.GetThreadCount() < MaxThreads ? pool.GetThreadCount() : MaxThreads;
+
+    for (int color = 0; color < coloring.GetColorCount(); ++color)
+    {
+        const std::pair<int, int>* colorPairs = coloring.GetColorPairs(color);
+        const int size = coloring.GetColorSize(color);
+
+        bool serial = coloring.HasSerialColor() && color == coloring.GetColorCount() - 1;
+        if (serial || size < MinParallelPairs || threads == 1 || pool.GetThreadCount() > MaxThreads)
+        {
+            // The overflow colour can share bodies between pairs, ResolveSpan handles that in order
+            contacts += ResolveSpan(world, colorPairs, size, simdLevel, tests, wokenBodies[0], events);
+            WakeAll(world, wokenBodies[0]);
+            continue;
+        }
+
+        for (int t = 0; t < threads; ++t)
+        {
+            chunkTests[t] = 0;
+            chunkContacts[t] = 0;
+        }
+
+        const SimdLevel level = simdLevel;
+        pool.ParallelFor(size, [&](int chunk, int begin, int end)
+        {
+            chunkContacts[chunk] = ResolveSpan(world, colorPairs + begin, end - begin, level, chunkTests[chunk], wokenBodies[chunk], events);
+        });
+
+        for (int t = 0; t < threads; ++t)
+        {
+            tests += chunkTests[t];
+            contacts += chunkContacts[t];
+            WakeAll(world, wokenBodies[t]);
+        }
+    }
+
+    sphereTests += tests;
+    sphereContacts += contacts;
+    return contacts;
+}
@@ -0,0 +1,330 @@
+﻿#include "Collision.h"
+
+#include <cmath>
+#include <immintrin.h>
+
+#include "Physics/PhysicsWorld.h"
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+// MSVC lets us call AVX2 intrinsics without compiling the whole file for AVX2
+#define TARGET_AVX2
+#else
+#define TARGET_AVX2 __attribute__((target("avx2,fma")))
+#endif
+
+namespace
+{
+    const int MaxLanes = 8;
+
+    // Bounciness, same as Collision::SphereCollision
+    const float Restitution = 1.0f;
+
+    /// Per lane output of a kernel, only lanes with their bit set in mask are written
+    struct BatchResult
+    {
+        alignas(32) float nx[MaxLanes];
+        alignas(32) float ny[MaxLanes];
+        alignas(32) float nz[MaxLanes];
+        alignas(32) float depth[MaxLanes];
+        alignas(32) float impulse[MaxLanes];
+        int mask;
+    };
+
+    void KernelScalar(const PhysicsWorld& world, const int* a, const int* b, int count, BatchResult& out)
+    {
+        out.mask = 0;
+        for (int l = 0; l < count; ++l)
+        {
+            float dx = world.posX[a[l]] - world.posX[b[l]];
+            float dy = world.posY[a[l]] - world.posY[b[l]];
+            float dz = world.posZ[a[l]] - world.posZ[b[l]];
+            float sumRadius = world.radius[a[l]] + world.radius[b[l]];
+
+            float distanceSq = dx * dx + dy * dy + dz * dz;
+            if (!(distanceSq < sumRadius * sumRadius)) continue;
+
+            float distance = std::sqrt(distanceSq);
+            float nx = dx / distance;
+            float ny = dy / distance;
+            float nz = dz / distance;
+
+            float velocityAlongNormal =
+                (world.velX[a[l]] - world.velX[b[l]]) * nx +
+                (world.velY[a[l]] - world.velY[b[l]]) * ny +
+                (world.velZ[a[l]] - world.velZ[b[l]]) * nz;
+            float invMassSum = world.invMass[a[l]] + world.invMass[b[l]];
+
+            float impulse = 0.0f;
+            if (velocityAlongNormal <= 0.0f && invMassSum > 0.0f)
+            {
+                impulse = -(1 + Restitution) * velocityAlongNormal / invMassSum;
+            }
+
+            out.nx[l] = nx;
+            out.ny[l] = ny;
+            out.nz[l] = nz;
+            out.depth[l] = sumRadius - distance;
+            out.impulse[l] = impulse;
+            out.mask |= 1 << l;
+        }
+    }
+
+    inline __m128 Gather4(const float* base, const int* index)
+    {
+        return _mm_set_ps(base[index[3]], base[index[2]], base[index[1]], base[index[0]]);
+    }
+
+    void KernelSSE(const PhysicsWorld& world, const int* a, const int* b, int count, BatchResult& out)
+    {
+        // Pad unused lanes with the first pair, they are masked off at the end
+        int ia[4], ib[4];
+        for (int l = 0; l < 4; ++l)
+        {
+            ia[l] = a[l < count ? l : 0];
+            ib[l] = b[l < count ? l : 0];
+        }
+
+        __m128 dx = _mm_sub_ps(Gather4(world.posX.data(), ia), Gather4(world.posX.data(), ib));
+        __m128 dy = _mm_sub_ps(Gather4(world.posY.data(), ia), Gather4(world.posY.data(), ib));
+        __m128 dz = _mm_sub_ps(Gather4(world.posZ.data(), ia), Gather4(world.posZ.data(), ib));
+        __m128 sumRadius = _mm_add_ps(Gather4(world.radius.data(), ia), Gather4(world.radius.data(), ib));
+
+        __m128 distanceSq = _mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)), _mm_mul_ps(dz, dz));
+        __m128 contact = _mm_cmplt_ps(distanceSq, _mm_mul_ps(sumRadius, sumRadius));
+
+        int mask = _mm_movemask_ps(contact) & ((1 << count) - 1);
+        out.mask = mask;
+        if (mask == 0) return;
+
+        __m128 distance = _mm_sqrt_ps(distanceSq);
+        __m128 nx = _mm_div_ps(dx, distance);
+        __m128 ny = _mm_div_ps(dy, distance);
+        __m128 nz = _mm_div_ps(dz, distance);
+
+        __m128 dvx = _mm_sub_ps(Gather4(world.velX.data(), ia), Gather4(world.velX.data(), ib));
+        __m128 dvy = _mm_sub_ps(Gather4(world.velY.data(), ia), Gather4(world.velY.data(), ib));
+        __m128 dvz = _mm_sub_ps(Gather4(world.velZ.data(), ia), Gather4(world.velZ.data(), ib));
+        __m128 velocityAlongNormal = _mm_add_ps(_mm_add_ps(_mm_mul_ps(dvx, nx), _mm_mul_ps(dvy, ny)), _mm_mul_ps(dvz, nz));
+        __m128 invMassSum = _mm_add_ps(Gather4(world.invMass.data(), ia), Gather4(world.invMass.data(), ib));
+
+        __m128 impulse = _mm_div_ps(_mm_mul_ps(_mm_set1_ps(-(1 + Restitution)), velocityAlongNormal), invMassSum);
+        __m128 approaching = _mm_and_ps(
+            _mm_cmple_ps(velocityAlongNormal, _mm_setzero_ps()),
+            _mm_cmpgt_ps(invMassSum, _mm_setzero_ps()));
+        impulse = _mm_and_ps(impulse, approaching);
+
+        // SSE2 has no cheap masked store, zero the lanes that aren't in contact instead
+        _mm_store_ps(out.nx, _mm_and_ps(nx, contact));
+        _mm_store_ps(out.ny, _mm_and_ps(ny, contact));
+        _mm_store_ps(out.nz, _mm_and_ps(nz, contact));
+        _mm_store_ps(out.depth, _mm_and_ps(_mm_sub_ps(sumRadius, distance), contact));
+        _mm_store_ps(out.impulse, _mm_and_ps(impulse, contact));
+    }
+
+    TARGET_AVX2
+    void KernelAVX2(const PhysicsWorld& world, const int* a, const int* b, int count, BatchResult& out)
+    {
+        int ia[8], ib[8];
+        for (int l = 0; l < 8; ++l)
+        {
+            ia[l] = a[l < count ? l : 0];
+            ib[l] = b[l < count ? l : 0];
+        }
+        __m256i indexA = _mm256_loadu_si256((const __m256i*)ia);
+        __m256i indexB = _mm256_loadu_si256((const __m256i*)ib);
+
+        __m256 dx = _mm256_sub_ps(_mm256_i32gather_ps(world.posX.data(), indexA, 4), _mm256_i32gather_ps(world.posX.data(), indexB, 4));
+        __m256 dy = _mm256_sub_ps(_mm256_i32gather_ps(world.posY.data(), indexA, 4), _mm256_i32gather_ps(world.posY.data(), indexB, 4));
+        __m256 dz = _mm256_sub_ps(_mm256_i32gather_ps(world.posZ.data(), indexA, 4), _mm256_i32gather_ps(world.posZ.data(), indexB, 4));
+        __m256 sumRadius = _mm256_add_ps(_mm256_i32gather_ps(world.radius.data(), indexA, 4), _mm256_i32gather_ps(world.radius.data(), indexB, 4));
+
+        __m256 distanceSq = _mm256_fmadd_ps(dz, dz, _mm256_fmadd_ps(dy, dy, _mm256_mul_ps(dx, dx)));
+        __m256 contact = _mm256_cmp_ps(distanceSq, _mm256_mul_ps(sumRadius, sumRadius), _CMP_LT_OQ);
+
+        int mask = _mm256_movemask_ps(contact) & ((1 << count) - 1);
+        out.mask = mask;
+        if (mask == 0) return;
+
+        __m256 distance = _mm256_sqrt_ps(distanceSq);
+        __m256 nx = _mm256_div_ps(dx, distance);
+        __m256 ny = _mm256_div_ps(dy, distance);
+        __m256 nz = _mm256_div_ps(dz, distance);
+
+        __m256 dvx = _mm256_sub_ps(_mm256_i32gather_ps(world.velX.data(), indexA, 4), _mm256_i32gather_ps(world.velX.data(), indexB, 4));
+        __m256 dvy = _mm256_sub_ps(_mm256_i32gather_ps(world.velY.data(), indexA, 4), _mm256_i32gather_ps(world.velY.data(), indexB, 4));
+        __m256 dvz = _mm256_sub_ps(_mm256_i32gather_ps(world.velZ.data(), indexA, 4), _mm256_i32gather_ps(world.velZ.data(), indexB, 4));
+        __m256 velocityAlongNormal = _mm256_fmadd_ps(dvz, nz, _mm256_fmadd_ps(dvy, ny, _mm256_mul_ps(dvx, nx)));
+        __m256 invMassSum = _mm256_add_ps(_mm256_i32gather_ps(world.invMass.data(), indexA, 4), _mm256_i32gather_ps(world.invMass.data(), indexB, 4));
+
+        __m256 impulse = _mm256_div_ps(_mm256_mul_ps(_mm256_set1_ps(-(1 + Restitution)), velocityAlongNormal), invMassSum);
+        __m256 approaching = _mm256_and_ps(
+            _mm256_cmp_ps(velocityAlongNormal, _mm256_setzero_ps(), _CMP_LE_OQ),
+            _mm256_cmp_ps(invMassSum, _mm256_setzero_ps(), _CMP_GT_OQ));
+        impulse = _mm256_and_ps(impulse, approaching);
+
+        __m256i store = _mm256_castps_si256(contact);
+        _mm256_maskstore_ps(out.nx, store, nx);
+        _mm256_maskstore_ps(out.ny, store, ny);
+        _mm256_maskstore_ps(out.nz, store, nz);
+        _mm256_maskstore_ps(out.depth, store, _mm256_sub_ps(sumRadius, distance));
+        _mm256_maskstore_ps(out.impulse, store, impulse);
+    }
+}
+
+SimdLevel Collision::DetectSimdLevel()
+{
+#if defined(_MSC_VER)
+    int info[4];
+    __cpuid(info, 0);
+    if (info[0] >= 7)
+    {
+        __cpuid(info, 1);
+        bool osSavesYmm = (info[2] & (1 << 27)) && (_xgetbv(0) & 0x6) == 0x6;
+        bool fma = (info[2] & (1 << 12)) != 0;
+        __cpuidex(info, 7, 0);
+        bool avx2 = (info[1] & (1 << 5)) != 0;
+        if (osSavesYmm && fma && avx2) return SimdAVX2;
+    }
+    return SimdSSE;
+#elif defined(__x86_64__) || defined(__i386__)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) return SimdAVX2;
+    if (__builtin_cpu_supports("sse2")) return SimdSSE;
+    return SimdScalar;
+#else
+    return SimdScalar;
+#endif
+}
+
+int Collision::SphereCollisionBatch(PhysicsWorld& world, const std::vector<std::pair<int, int>>& pairs)
+{
+    if (wokenBodies.empty()) wokenBodies.resize(1);
+
+    int tests = 0;
+    int contacts = ResolveSpan(world, pairs.data(), (int)pairs.size(), simdLevel, tests, wokenBodies[0], events);
+    WakeAll(world, wokenBodies[0]);
+
+    sphereTests += tests;
+    sphereContacts += contacts;
+    return contacts;
+}
+
+void Collision::WakeAll(PhysicsWorld& world, std::vector<int>& woken)
+{
+    for (int body : woken)
+    {
+        world.WakeBody(body);
+    }
+    woken.clear();
+}
+
+int Collision::ResolveSpan(PhysicsWorld& world, const std::pair<int, int>* pairs, int count, SimdLevel simdLevel,
+    int& tests, std::vector<int>& woken, CollisionEventRing& events)
+{
+    const int lanes = simdLevel == SimdAVX2 ? 8 : simdLevel == SimdSSE ? 4 : 1;
+    int contacts = 0;
+
+    int a[MaxLanes], b[MaxLanes];
+    BatchResult result;
+
+    int k = 0;
+    while (k < count)
+    {
+        int width = count - k < lanes ? count - k : lanes;
+        for (int l = 0; l < width; ++l)
+        {
+            a[l] = pairs[k + l].first;
+            b[l] = pairs[k + l].second;
+        }
+
+        switch (simdLevel)
+        {
+        case SimdAVX2:
+            KernelAVX2(world, a, b, width, result);
+            break;
+        case SimdSSE:
+            KernelSSE(world, a, b, width, result);
+            break;
+        default:
+            KernelScalar(world, a, b, width, result);
+            break;
+        }
+
+        if (result.mask == 0)
+        {
+            tests += width;
+            k += width;
+            continue;
+        }
+
+        // Apply contacts in pair order. The whole batch was computed from the same state, so a
+        // lane that shares a body with an already resolved lane is stale and the next batch starts there
+        int touched[MaxLanes * 2];
+        int touchedCount = 0;
+        int l = 0;
+        for (; l < width; ++l)
+        {
+            bool stale = false;
+            for (int t = 0; t < touchedCount; ++t)
+            {
+                stale |= touched[t] == a[l] || touched[t] == b[l];
+            }
+            if (stale) break;
+
+            tests++;
+            if (!(result.mask & (1 << l))) continue;
+
+            contacts++;
+
+            float impulse = result.impulse[l];
+            int body1 = a[l];
+            int body2 = b[l];
+            float invMass1 = world.invMass[body1];
+            float invMass2 = world.invMass[body2];
+
+            // A sleeper only wakes when the pair closes faster than sleepVelocity, like in Collision::SphereCollision.
+            // Below that it stays put and the awake one bounces off it alone
+            float closingSpeed = impulse * (invMass1 + invMass2) / (1 + Restitution);
+            bool hit = closingSpeed > world.sleepVelocity;
+            bool moves1 = hit || world.IsAwake(body1);
+            bool moves2 = hit || world.IsAwake(body2);
+            if (!moves1 || !moves2)
+            {
+                float movingInvMass = moves1 ? invMass1 : invMass2;
+                impulse = movingInvMass > 0.0f ? impulse * (invMass1 + invMass2) / movingInvMass : 0.0f;
+                if (!moves1) invMass1 = 0.0f;
+                if (!moves2) invMass2 = 0.0f;
+            }
+
+            float depth1 = result.depth[l] * (moves1 ? (moves2 ? 0.5f : 1.0f) : 0.0f);
+            float depth2 = result.depth[l] * (moves2 ? (moves1 ? 0.5f : 1.0f) : 0.0f);
+
+            world.posX[body1] += result.nx[l] * depth1;
+            world.posY[body1] += result.ny[l] * depth1;
+            world.posZ[body1] += result.nz[l] * depth1;
+            world.posX[body2] -= result.nx[l] * depth2;
+            world.posY[body2] -= result.ny[l] * depth2;
+            world.posZ[body2] -= result.nz[l] * depth2;
+
+            world.velX[body1] += result.nx[l] * impulse * invMass1;
+            world.velY[body1] += result.ny[l] * impulse * invMass1;
+            world.velZ[body1] += result.nz[l] * impulse * invMass1;
+            world.velX[body2] -= result.nx[l] * impulse * invMass2;
+            world.velY[body2] -= result.ny[l] * impulse * invMass2;
+            world.velZ[body2] -= result.nz[l] * impulse * invMass2;
+
+            // Only read here, the caller does the waking so parallel chunks don't share activeBodies
+            if (hit && !world.IsAwake(body1)) woken.push_back(body1);
+            if (hit && !world.IsAwake(body2)) woken.push_back(body2);
+
+            events.Push({ body1, body2, glm::vec3(result.nx[l], result.ny[l], result.nz[l]), result.depth[l], impulse });
+
+            touched[touchedCount++] = body1;
+            touched[touchedCount++] = body2;
+        }
+        k += l;
+    }
+
+    return contacts;
+}
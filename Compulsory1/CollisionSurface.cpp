@@ -0,0 +1,91 @@
+﻿#include "Collision.h"
+
+#include <algorithm>
+#include <cmath>
+
+#include "glm/geometric.hpp"
+#include "Mesh/Surface.h"
+
+namespace
+{
+    /// \brief Point of triangle abc closest to p, walking the Voronoi regions of its corners and edges
+    glm::vec3 ClosestPointOnTriangle(const glm::vec3& p, const glm::vec3& a, const glm::vec3& b, const glm::vec3& c)
+    {
+        glm::vec3 ab = b - a;
+        glm::vec3 ac = c - a;
+        glm::vec3 ap = p - a;
+        float d1 = glm::dot(ab, ap);
+        float d2 = glm::dot(ac, ap);
+        if (d1 <= 0.0f && d2 <= 0.0f) return a;
+
+        glm::vec3 bp = p - b;
+        float d3 = glm::dot(ab, bp);
+        float d4 = glm::dot(ac, bp);
+        if (d3 >= 0.0f && d4 <= d3) return b;
+
+        float vc = d1 * d4 - d3 * d2;
+        if (vc <= 0.0f && d1 >= 0.0f && d3 <= 0.0f) return a + ab * (d1 / (d1 - d3));
+
+        glm::vec3 cp = p - c;
+        float d5 = glm::dot(ab, cp);
+        float d6 = glm::dot(ac, cp);
+        if (d6 >= 0.0f && d5 <= d6) return c;
+
+        float vb = d5 * d2 - d1 * d6;
+        if (vb <= 0.0f && d2 >= 0.0f && d6 <= 0.0f) return a + ac * (d2 / (d2 - d6));
+
+        float va = d3 * d6 - d5 * d4;
+        if (va <= 0.0f && (d4 - d3) >= 0.0f && (d5 - d6) >= 0.0f) return b + (c - b) * ((d4 - d3) / ((d4 - d3) + (d5 - d6)));
+
+        float denominator = 1.0f / (va + vb + vc);
+        return a + ab * (vb * denominator) + ac * (vc * denominator);
+    }
+}
+
+bool Collision::SphereSurfaceContact(const glm::vec3& center, float radius, const Surface& surface, glm::vec3& normal, float& depth)
+{
+    if (surface.triangles.empty()) return false;
+
+    // Centre under the surface, a closest point could be on the wrong side, so climb out along the face above it
+    float height;
+    if (surface.GetHeight(center, height) && center.y < height)
+    {
+        normal = surface.GetUpNormal(surface.GetTriangle(center));
+        depth = radius + (height - center.y) * normal.y;
+        return true;
+    }
+
+    // Cells under the sphere's footprint: the one under the centre and the neighbours the sphere reaches into
+    const glm::vec3 local = center - surface.globalPosition;
+    int firstRow = std::max((int)std::floor((local.x - radius - surface.origin.x) / surface.spacing), 0);
+    int lastRow = std::min((int)std::floor((local.x + radius - surface.origin.x) / surface.spacing), surface.size - 1);
+    int firstColumn = std::max((int)std::floor((local.z - radius - surface.origin.z) / surface.spacing), 0);
+    int lastColumn = std::min((int)std::floor((local.z + radius - surface.origin.z) / surface.spacing), surface.size - 1);
+
+    float deepest = 0.0f;
+    for (int row = firstRow; row <= lastRow; ++row)
+    {
+        for (int column = firstColumn; column <= lastColumn; ++column)
+        {
+            int first = surface.GetCellTriangle(row, column);
+            for (int t = first; t < first + 2; ++t)
+            {
+                const TriangleStruct& triangle = surface.triangles[t];
+                glm::vec3 offset = local - ClosestPointOnTriangle(local, triangle.v0, triangle.v1, triangle.v2);
+                float distanceSq = glm::dot(offset, offset);
+                if (distanceSq >= radius * radius) continue;
+
+                // Deepest triangle wins, an edge or corner contact pushes straight away from it
+                float distance = std::sqrt(distanceSq);
+                if (radius - distance > deepest)
+                {
+                    deepest = radius - distance;
+                    normal = distance > 0.0f ? offset / distance : surface.GetUpNormal(t);
+                }
+            }
+        }
+    }
+
+    depth = deepest;
+    return deepest > 0.0f;
+}
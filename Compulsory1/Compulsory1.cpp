@@ -1,5 +1,9 @@
+﻿#ifndef COMPULSORY1_HEADLESS
 #include "Shader.h"
 #include "ShaderFileLoader.h"
+#endif
+#include <algorithm>
+#include <chrono>
 #include <iostream>
 #include <map>
 #include <glm/fwd.hpp>
@@ -12,16 +16,43 @@
 #include "Math.h"
 #include "Mesh/Mesh.h"
 #include "Mesh/Surface.h"
+#include "Physics/AABBTree.h"
+#include "Physics/Benchmark.h"
+#include "Physics/ContactSolver.h"
+#include "Physics/EventSimulation.h"
+#include "Physics/LinearBVH.h"
+#include "Physics/NeighbourList.h"
+#include "Physics/PhysicsWorld.h"
+#include "Physics/PositionSolver.h"
+#include "Physics/SceneQuery.h"
+#include "Physics/SelfCheck.h"
+#include "Physics/SpatialGrid.h"
+#include "Physics/SweepAndPrune.h"
+#include "Physics/ThreadPool.h"
+#include "Physics/TriggerSystem.h"
 #include "glm/mat4x3.hpp"
 
+#ifndef COMPULSORY1_HEADLESS
 void framebuffer_size_callback(GLFWwindow* window, int width, int height);
 void processInput(GLFWwindow* window);
 
 void CameraView(std::vector<unsigned> shaderPrograms, glm::mat4 trans, glm::mat4 projection);
 void mouse_callback(GLFWwindow* window, double xpos, double ypos);
 void DrawObjects(unsigned VAO, Shader ShaderProgram);
+#endif
 
 void CollisionChecking();
+AABB SphereQueryBox(int body);
+void CoverPositionSolverReach();
+void StepPhysics();
+void ReorderSpheres();
+void ResolvePairs();
+void EnableGravity(bool enable);
+void HandleTriggerEvents();
+bool PickupSpotFree();
+void BuildSceneQuery();
+void AdvanceEvents(float time);
+int RunHeadless(int argc, char* argv[]);
 
 glm::vec3 RandomColor();
 
@@ -33,6 +64,67 @@ std::vector<Mesh*> sphereMeshes;
 Math math;
 Collision collision;
 
+// Every sphere's position and velocity lives here, sphereMeshes[i] is body i
+PhysicsWorld physicsWorld;
+
+BroadphaseType broadphase = UniformGrid;
+SpatialGrid sphereGrid;
+std::vector<int> sphereNeighbours;
+SweepAndPrune sphereSweep;
+NeighbourList sphereNeighbourList;
+LinearBVH sphereLinearBVH;
+
+// Walls and floor never move, so their tree is built once in SetupMeshes
+AABBTree worldTree;
+std::vector<OBB> wallBoxes;
+AABBTree sphereTree;
+std::vector<int> sphereProxies;
+
+// Resolve sphere pairs on every core instead of one at a time on the main thread
+bool parallelResolve = false;
+ThreadPool workerPool;
+std::vector<std::pair<int, int>> spherePairs;
+
+// Solve the pair list with warm started sequential impulses instead of one pass in list order
+bool iterativeSolver = false;
+ContactSolver contactSolver;
+
+// Spheres fall and come to rest on the floor. Bouncing alone can't hold them still, so this uses contactSolver too
+bool useGravity = false;
+std::vector<std::pair<int, int>> wallPairs;
+
+// Move and solve the spheres in XPBD substeps instead, on the worker threads when parallelResolve is on
+bool positionBased = false;
+
+// Link every four spheres into a chain with positionSolver distance constraints, xpbd only
+bool linkChains = false;
+PositionSolver positionSolver;
+
+// Hills for the spheres to roll over, handed to both solvers. Headless runs only, nothing draws it yet
+bool useTerrain = false;
+Surface terrain;
+
+// Jump from collision to collision instead of stepping. Spheres only bounce off each other and arenaBounds
+bool eventDriven = false;
+EventSimulation eventSimulation;
+AABB arenaBounds;
+
+// Pickup zones and other volumes that only report who is inside them
+TriggerSystem triggers;
+int spheresInPickupZone = 0;
+int triggerCrossings = 0;
+int pickupTrigger = -1;
+int pickupsCollected = 0;
+
+// Rays and overlap tests against the walls and spheres, rebuilt by BuildSceneQuery before use
+SceneQuery sceneQuery;
+bool sceneQueryStale = true;    // Set when a physics step moved any sphere since the last build
+
+// Sweep spheres that move further than their radius in one step, so they can't tunnel through walls or each other
+bool continuousCollision = true;
+
+int sceneSphereCount = 200;
+
 Mesh sphere_mesh;
 
 Mesh sphere2Mesh;
@@ -46,6 +138,9 @@ Mesh wall1_mesh;
 Mesh wall2_mesh;
 Mesh wall3_mesh;
 Mesh wall4_mesh;
+Mesh crate_mesh;
+
+Mesh pickup_mesh;
 
 
 // settings
@@ -74,16 +169,26 @@ colorStruct colors;
 float deltaTime = 0.0f;	// Time between current frame and last frame
 float lastFrame = 0.0f; // Time of last frame
 
+///Physics timestep variables
+///--------------------------
+float physicsTimeStep = 1.0f / 120.0f; // Physics always advances by this much, whatever the frame rate
+int maxPhysicsSteps = 8;               // Past this many steps in one frame the simulation slows down instead
+float physicsAccumulator = 0.0f;       // Frame time not simulated yet
+float physicsAlpha = 0.0f;             // How far the renderer is between the last two steps
+int reorderInterval = 120;             // Steps between Morton reorders of the bodies, 0 turns it off
+int stepsSinceReorder = 0;
+
 ///Mouse Input Variables
 ///---------------------
 bool firstMouse = true;
 float lastX = SCR_WIDTH / 2.0f, lastY = SCR_HEIGHT / 2.0f;
 
-std::string vfs = ShaderLoader::LoadShaderFromFile("Triangle.vs");
-std::string fs = ShaderLoader::LoadShaderFromFile("Triangle.vs");
-
 Camera MainCamera;
 
+// Everything from here to SetupMeshes draws, COMPULSORY1_HEADLESS builds leave it out along with GL and GLFW
+#ifndef COMPULSORY1_HEADLESS
+std::string vfs = ShaderLoader::LoadShaderFromFile("Triangle.vs");
+std::string fs = ShaderLoader::LoadShaderFromFile("Triangle.vs");
 
 std::vector<unsigned> shaderPrograms;
 
@@ -97,6 +202,18 @@ void DrawObjects(unsigned VAO, Shader ShaderProgram)
     // sphere_mesh.Draw(ShaderProgram.ID);
     // sphere2Mesh.Draw(ShaderProgram.ID);
 
+    // Moving meshes get their position and bounding box on every core, only the GL calls stay on this thread
+    workerPool.GetJobSystem().ParallelFor((int)sphereMeshes.size(), 64, [](int begin, int end)
+    {
+        for (int i = begin; i < end; ++i)
+        {
+            Mesh* sphere = sphereMeshes[i];
+            sphere->globalPosition = physicsWorld.GetInterpolatedPosition(sphere->physicsHandle, physicsAlpha);
+            sphere->orientation = physicsWorld.GetOrientation(sphere->physicsHandle);
+            sphere->CalculateBoundingBox();
+        }
+    });
+
     //draw all meshes
     for (Mesh* sphere : sphereMeshes)
     {
@@ -109,6 +226,8 @@ void DrawObjects(unsigned VAO, Shader ShaderProgram)
     wall2_mesh.Draw(ShaderProgram.ID);
     wall3_mesh.Draw(ShaderProgram.ID);
     wall4_mesh.Draw(ShaderProgram.ID);
+    crate_mesh.Draw(ShaderProgram.ID);
+    pickup_mesh.Draw(ShaderProgram.ID);
     //CameraMesh.Draw(ShaderProgram.ID);
     
     
@@ -158,12 +277,6 @@ void render(GLFWwindow* window, Shader ourShader, unsigned VAO)
 
         plane_mesh.CalculateBoundingBox();
         
-        //for every sphere do physics
-        for (Mesh* sphere : sphereMeshes)
-        {
-            sphere->Physics(deltaTime);
-        }
-        
         //cout camera position
         //std::cout << "Camera Position: " << MainCamera.cameraPos.x << " " << MainCamera.cameraPos.y << " " << MainCamera.cameraPos.z << std::endl;
         
@@ -172,6 +285,30 @@ void render(GLFWwindow* window, Shader ourShader, unsigned VAO)
         // input
         // -----
         processInput(window);
+
+        // physics
+        // -------
+        if (eventDriven)
+        {
+            AdvanceEvents(deltaTime);
+        }
+        else
+        {
+            physicsAccumulator += deltaTime;
+            int physicsSteps = 0;
+            while (physicsAccumulator >= physicsTimeStep && physicsSteps < maxPhysicsSteps)
+            {
+                StepPhysics();
+                physicsAccumulator -= physicsTimeStep;
+                physicsSteps++;
+            }
+            if (physicsSteps == maxPhysicsSteps && physicsAccumulator >= physicsTimeStep)
+            {
+                // Too far behind, drop the rest of this frame rather than spiral
+                physicsAccumulator = 0.0f;
+            }
+            physicsAlpha = physicsAccumulator / physicsTimeStep;
+        }
         
         // render
         // ------
@@ -179,8 +316,6 @@ void render(GLFWwindow* window, Shader ourShader, unsigned VAO)
         glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
         
         DrawObjects(VAO, ourShader);
-
-        CollisionChecking();
         
 
         // glfw: swap buffers and poll IO events (keys pressed/released, mouse moved etc.)
@@ -189,25 +324,43 @@ void render(GLFWwindow* window, Shader ourShader, unsigned VAO)
         glfwPollEvents();
     }
 }
+#endif
 
 void SetupMeshes()
 {
     //Create meshes here, Make meshes here, Setup meshes here, define meshes here, setupObjects setup objects create objects
     //(this comment is for CTRL + F search)
-    int SphereCount = 200;
-    
-    for (int i = 0; i < SphereCount; ++i) {
-        Mesh* sphere = new Mesh(Sphere, 1.f, 4, RandomColor());
-
-        sphere->globalPosition = glm::vec3(
+    for (int i = 0; i < sceneSphereCount; ++i) {
+        glm::vec3 position = glm::vec3(
         math.RandomVec3(-3.7, 3.7).x,
         0.5, // y
         math.RandomVec3(-3.7, 3.7).z);
-        
-        sphere->globalScale = glm::vec3(0.1f, 0.1f, 0.1f);
-        sphere->velocity = glm::vec3(0.f);
 
-        sphereMeshes.push_back(sphere);
+        int body;
+        if (Mesh::headless)
+        {
+            // Nothing gets drawn, so skip the sphere mesh and its thousands of vertices
+            body = physicsWorld.AddBody(position, glm::vec3(0.f), 0.1f, 1.f);
+        }
+        else
+        {
+            Mesh* sphere = new Mesh(Sphere, 1.f, 4, RandomColor());
+
+            sphere->globalPosition = position;
+            sphere->globalScale = glm::vec3(0.1f, 0.1f, 0.1f);
+            sphere->velocity = glm::vec3(0.f);
+
+            sphereMeshes.push_back(sphere);
+
+            sphere->CalculateBoundingBox();
+            sphere->physicsHandle = physicsWorld.AddBody(sphere->globalPosition, sphere->velocity, sphere->Radius, sphere->mass);
+            physicsWorld.SetInertia(sphere->physicsHandle, sphere->CalculateInertia());
+            body = sphere->physicsHandle;
+        }
+
+        AABB box = physicsWorld.GetAABB(body);
+        sphereSweep.AddBody(box);
+        sphereProxies.push_back(sphereTree.CreateProxy(box, body));
     }
 
 #pragma region OtherMeshes
@@ -240,12 +393,102 @@ void SetupMeshes()
     wall4_mesh.globalPosition = glm::vec3(4.0f, 0.0f, 0.0f);
     wall4_mesh.globalScale = glm::vec3(0.1f, wallScale*heightScale, wallScale);
     wallMeshes.push_back(&wall4_mesh);
+
+    // Turned on its side so the spheres have something that isn't lined up with the world axes
+    crate_mesh = Mesh(Cube, 0.4f, colors.white);
+    crate_mesh.globalPosition = glm::vec3(2.0f, -0.1f, 2.0f);
+    crate_mesh.SetRotation(glm::vec3(0.0f, 45.0f, 0.0f));
+    wallMeshes.push_back(&crate_mesh);
 #pragma endregion
+
+    worldTree.margin = 0.0f;
+    for (int i = 0; i < (int)wallMeshes.size(); ++i)
+    {
+        wallMeshes[i]->CalculateBoundingBox();
+        wallBoxes.push_back(wallMeshes[i]->CalculateOrientedBox());
+        worldTree.CreateProxy(wallBoxes.back().GetAABB(), i);
+    }
+
+    // Box on the floor in the middle of the arena, the first sphere to roll into it collects it and it
+    // moves somewhere else. Nothing bounces off it. Tall enough to reach the spheres floating at y 0.5
+    // while gravity is off
+    pickup_mesh = Mesh(Cube, 0.25f, colors.magenta);
+    pickup_mesh.globalScale = glm::vec3(1.0f, 3.0f, 1.0f);
+    pickup_mesh.globalPosition = glm::vec3(0.0f, plane_mesh.maxVert.y + 0.75f, 0.0f);
+    pickup_mesh.pickupable = true;
+    pickup_mesh.CalculateBoundingBox();
+    pickupTrigger = triggers.AddTrigger(AABB(pickup_mesh.minVert, pickup_mesh.maxVert));
+
+    // Inside faces of the walls, from the floor up to the top of the walls
+    arenaBounds = AABB(
+        glm::vec3(wall3_mesh.maxVert.x, plane_mesh.maxVert.y, wall1_mesh.maxVert.z),
+        glm::vec3(wall4_mesh.minVert.x, wall1_mesh.maxVert.y, wall2_mesh.minVert.z));
+    positionSolver.bounds = arenaBounds;
+    positionSolver.useBounds = true;
 }
 
-int main()
+int main(int argc, char* argv[])
 {
+    contactSolver.events = &collision.events;
+    positionSolver.events = &collision.events;
+
+    // Compulsory1 --bench-narrowphase [bodies] prints batched narrowphase throughput and exits
+    if (argc > 1 && std::string(argv[1]) == "--bench-narrowphase")
+    {
+        RunNarrowphaseBenchmark(argc > 2 ? atoi(argv[2]) : 2000);
+        return 0;
+    }
+
+    // Compulsory1 --bench-reorder prints collision step time before and after Morton reordering
+    if (argc > 1 && std::string(argv[1]) == "--bench-reorder")
+    {
+        RunReorderBenchmark(10000);
+        RunReorderBenchmark(100000);
+        RunReorderBenchmark(1000000);
+        return 0;
+    }
+
+    // Compulsory1 --bench-lbvh [bodies] prints linear BVH build and pair times on every core
+    if (argc > 1 && std::string(argv[1]) == "--bench-lbvh")
+    {
+        RunLinearBVHBenchmark(argc > 2 ? atoi(argv[2]) : 1000000);
+        return 0;
+    }
+
+    // Compulsory1 --bench-raycast [rays] prints scene query throughput for single, packet and threaded rays
+    if (argc > 1 && std::string(argv[1]) == "--bench-raycast")
+    {
+        RunRaycastBenchmark(argc > 2 ? atoi(argv[2]) : 10000);
+        return 0;
+    }
+
+    // Compulsory1 --bench-integrate [bodies] prints integration throughput on 1 job system thread up to one per core
+    if (argc > 1 && std::string(argv[1]) == "--bench-integrate")
+    {
+        RunIntegrationBenchmark(argc > 2 ? atoi(argv[2]) : 1000000);
+        return 0;
+    }
+
+    // Compulsory1 --self-check runs the small known-outcome scenes and exits with the number that failed
+    if (argc > 1 && std::string(argv[1]) == "--self-check")
+    {
+        return RunSelfChecks();
+    }
+
+    // Compulsory1 --headless ... steps the scene without opening a window, see RunHeadless
+    if (argc > 1 && std::string(argv[1]) == "--headless")
+    {
+        return RunHeadless(argc, argv);
+    }
+
+#ifdef COMPULSORY1_HEADLESS
+    std::cout << "Built without a window, run with --headless, --self-check or one of the --bench options" << std::endl;
+    return 1;
+#else
     srand(time(0));
+
+    // Print contacts to the console like before, but from a thread of its own so the physics never waits on it
+    collision.events.StartLogging(std::cout);
     
     
     
@@ -334,10 +577,13 @@ int main()
 
     // glfw: terminate, clearing all previously allocated GLFW resources.
     // ------------------------------------------------------------------
+    collision.events.StopLogging();
     glfwTerminate();
     return 0;
+#endif
 }
 
+#ifndef COMPULSORY1_HEADLESS
 // process all input: query GLFW whether relevant keys are pressed/released this frame and react accordingly
 // ---------------------------------------------------------------------------------------------------------
 void processInput(GLFWwindow* window)
@@ -350,10 +596,10 @@ void processInput(GLFWwindow* window)
     if (glfwGetKey(window, GLFW_KEY_P) == GLFW_PRESS)
     {
         //make random sphere move
-        int randomSphere = rand() % sphereMeshes.size();
-        if (sphereMeshes[randomSphere]->velocity == glm::vec3(0.f,0.f,0.f))
+        int randomSphere = sphereMeshes[rand() % sphereMeshes.size()]->physicsHandle;
+        if (physicsWorld.GetVelocity(randomSphere) == glm::vec3(0.f,0.f,0.f))
         {
-            sphereMeshes[randomSphere]->velocity = glm::vec3(math.RandomVec3(-4, 4).x, 0.0f, math.RandomVec3(-4, 4).z);
+            physicsWorld.SetVelocity(randomSphere, glm::vec3(math.RandomVec3(-4, 4).x, 0.0f, math.RandomVec3(-4, 4).z));
         }
     }
     if (glfwGetKey(window, GLFW_KEY_I) == GLFW_PRESS)
@@ -361,16 +607,37 @@ void processInput(GLFWwindow* window)
         //make all spheres move
         for (auto ballsphere : sphereMeshes)
         {
-            ballsphere->velocity = glm::vec3(math.RandomVec3(-2, 2).x, 0.0f, math.RandomVec3(-2, 2).z);
+            physicsWorld.SetVelocity(ballsphere->physicsHandle, glm::vec3(math.RandomVec3(-2, 2).x, 0.0f, math.RandomVec3(-2, 2).z));
 
         }
     }
+    if (glfwGetKey(window, GLFW_KEY_F) == GLFW_PRESS)
+    {
+        //push the sphere in the middle of the screen away from the camera
+        if (sceneQueryStale) BuildSceneQuery();
+        glm::vec3 direction = glm::normalize(MainCamera.cameraFront);
+        RayHit hit;
+        if (sceneQuery.Raycast({ MainCamera.cameraPos, direction, 50.0f }, hit) && sceneQuery.IsSphere(hit.shape))
+        {
+            physicsWorld.SetVelocity(sceneQuery.GetUserData(hit.shape), glm::vec3(direction.x, 0.0f, direction.z) * 4.0f);
+        }
+    }
+    if (glfwGetKey(window, GLFW_KEY_G) == GLFW_PRESS && !useGravity)
+    {
+        //drop the balls onto the floor, this goes through the contact solver instead of the SIMD and parallel bounces
+        EnableGravity(true);
+    }
+    if (glfwGetKey(window, GLFW_KEY_H) == GLFW_PRESS && useGravity)
+    {
+        //back to the weightless table
+        EnableGravity(false);
+    }
     if (glfwGetKey(window, GLFW_KEY_O) == GLFW_PRESS)
     {
         //stop all velocity
         for (Mesh* sphere : sphereMeshes)
         {
-            sphere->velocity = glm::vec3(0.0f, 0.0f, 0.0f);
+            physicsWorld.SetVelocity(sphere->physicsHandle, glm::vec3(0.0f, 0.0f, 0.0f));
         }
     }
     
@@ -479,29 +746,561 @@ void CameraView(std::vector<unsigned> shaderPrograms, glm::mat4 trans, glm::mat4
         glUniformMatrix4fv(transformLoc, 1, GL_FALSE, glm::value_ptr(trans));
     }
 }
-
-void CollisionChecking()
+#endif
+
+/// \brief Builds the scene without GL and times StepPhysics, for batch jobs on machines with no display.
+/// Arguments after --headless, in any order: tick count, then sphere count, as plain numbers
+/// (default 1000 ticks, 200 spheres), a broadphase (brute, grid, sweep, tree, verlet, lbvh), "parallel", "solver",
+/// "xpbd", "chains", "gravity", "terrain" and "event". With "event" each tick runs the event driven simulation for physicsTimeStep
+/// instead, which only knows straight lines, so gravity and terrain are left off there. Terrain turns gravity on.
+/// Chains need xpbd, the other solvers have no distance constraints.
+/// \return exit code for main
+int RunHeadless(int argc, char* argv[])
 {
-    int W = 0;
-    for (Mesh* wall : wallMeshes)
+    // In BroadphaseType order
+    const char* broadphaseNames[] = { "brute", "grid", "sweep", "tree", "verlet", "lbvh" };
+    const std::pair<const char*, bool*> switches[] = {
+        { "parallel", &parallelResolve }, { "solver", &iterativeSolver }, { "xpbd", &positionBased },
+        { "chains", &linkChains }, { "gravity", &useGravity }, { "terrain", &useTerrain }, { "event", &eventDriven } };
+    int ticks = 1000;
+    // Plain numbers fill these in order
+    int* numbers[] = { &ticks, &sceneSphereCount };
+    int numbersRead = 0;
+
+    for (int a = 2; a < argc; ++a)
     {
-        for (int i = 0; i < sphereMeshes.size(); ++i)
+        std::string arg = argv[a];
+        bool known = false;
+        for (int b = BruteForce; b <= MortonBVH; ++b)
+        {
+            if (arg == broadphaseNames[b]) { broadphase = (BroadphaseType)b; known = true; }
+        }
+        for (const std::pair<const char*, bool*>& flag : switches)
         {
-            collision.SphereToAABBCollision(sphereMeshes[i], wall);
+            if (arg == flag.first) { *flag.second = true; known = true; }
+        }
+        if (!known && atoi(arg.c_str()) > 0 && numbersRead < 2)
+        {
+            *numbers[numbersRead++] = atoi(arg.c_str());
+            known = true;
+        }
+
+        if (!known)
+        {
+            std::cout << "Unknown headless argument " << arg << std::endl;
+            return 1;
         }
-        W++;
     }
-    
-    int p = 0;
+
+    // Same scene every run so numbers can be compared between builds
+    srand(1234);
+    Mesh::headless = true;
+    SetupMeshes();
+
+    // Spheres start at rest and would all fall asleep, kick them like the I key does
+    for (int i = 0; i < physicsWorld.GetBodyCount(); ++i)
+    {
+        physicsWorld.SetVelocity(i, glm::vec3(math.RandomVec3(-2, 2).x, 0.0f, math.RandomVec3(-2, 2).z));
+    }
+    if (useTerrain && !eventDriven)
+    {
+        // Peaks in the middle and near the corners, the valleys between them sink under the floor
+        terrain = Surface(5, colors.green);
+        terrain.globalPosition.y = -1.0f;
+        contactSolver.terrain = &terrain;
+        positionSolver.terrain = &terrain;
+    }
+    else
+    {
+        useTerrain = false;
+    }
+    EnableGravity((useGravity || useTerrain) && !eventDriven);
+
+    linkChains = linkChains && positionBased && !eventDriven;
+    if (linkChains)
+    {
+        // Four spheres in a row hang together. The last three are laid out touching the first one, heading for the
+        // middle so they stay inside the walls, pulling them together from across the arena would throw them at
+        // hundreds of metres a second. Headless runs have no sphere meshes, the bodies are simply numbered in
+        // the order SetupMeshes added them
+        for (int body = 0; body + 1 < physicsWorld.GetBodyCount(); ++body)
+        {
+            if (body % 4 == 3) continue;
+
+            glm::vec3 position = physicsWorld.GetPosition(body);
+            glm::vec3 towardMiddle = glm::vec3(-position.x, 0.0f, -position.z);
+            towardMiddle = glm::dot(towardMiddle, towardMiddle) > 0.0f ? glm::normalize(towardMiddle) : glm::vec3(1.0f, 0.0f, 0.0f);
+            if (body % 4 != 0) towardMiddle = glm::normalize(position - physicsWorld.GetPosition(body - 1));
+
+            float restLength = physicsWorld.radius[body] + physicsWorld.radius[body + 1];
+            physicsWorld.SetPosition(body + 1, position + towardMiddle * restLength);
+            positionSolver.AddDistanceConstraint(body, body + 1, restLength);
+        }
+    }
+
+    std::cout << "Headless: " << sceneSphereCount << " spheres, " << ticks << " ticks of " << physicsTimeStep * 1000.0f
+        << " ms, " << (eventDriven ? "event driven" : "broadphase ") << (eventDriven ? "" : broadphaseNames[broadphase])
+        << (parallelResolve && !eventDriven ? " parallel" : "") << (iterativeSolver && !eventDriven ? " solver" : "")
+        << (positionBased && !eventDriven ? " xpbd" : "")
+        << (linkChains ? " chains of " + std::to_string(positionSolver.GetDistanceConstraintCount()) + " links" : "")
+        << (useGravity ? " gravity" : "") << (useTerrain ? " terrain" : "") << std::endl;
+
+    long long pairsTested = 0;
+    long long contacts = 0;
+    long long events = 0;
+    long long collisionEvents = 0;
+    double totalMs = 0.0;
+    double worstMs = 0.0;
+
+    for (int t = 0; t < ticks; ++t)
+    {
+        auto begin = std::chrono::high_resolution_clock::now();
+        if (eventDriven) AdvanceEvents(physicsTimeStep);
+        else StepPhysics();
+        auto end = std::chrono::high_resolution_clock::now();
+
+        double ms = std::chrono::duration<double, std::milli>(end - begin).count();
+        totalMs += ms;
+        worstMs = std::max(worstMs, ms);
+        pairsTested += eventDriven ? eventSimulation.predictions : collision.sphereTests;
+        contacts += eventDriven ? eventSimulation.eventsProcessed : collision.sphereContacts;
+        events += eventSimulation.eventsStale;
+
+        // Take the contacts out between ticks like game code would, so the ring never fills up
+        CollisionEvent event;
+        while (collision.events.Pop(event)) collisionEvents++;
+    }
+
+    std::cout << "  " << totalMs / ticks << " ms/tick (worst " << worstMs << " ms)" << std::endl;
+    std::cout << "  " << (double)pairsTested / ticks << " pairs tested/tick, "
+        << (double)contacts / ticks << " contacts resolved/tick" << std::endl;
+    if (eventDriven)
+    {
+        std::cout << "  " << (double)events / ticks << " stale events dropped/tick" << std::endl;
+    }
+    else
+    {
+        std::cout << "  " << (double)collisionEvents / ticks << " collision events/tick, "
+            << collision.events.dropped << " dropped" << std::endl;
+    }
+    std::cout << "  " << (double)triggerCrossings / ticks << " trigger enters and exits/tick, "
+        << spheresInPickupZone << " spheres in the pickup zone at the end, "
+        << pickupsCollected << " pickups collected" << std::endl;
+    std::cout << "  " << physicsWorld.GetActiveCount() << " of " << physicsWorld.GetBodyCount() << " spheres awake at the end" << std::endl;
+    return 0;
+}
+
+/// \brief Runs the event driven simulation forward, used instead of StepPhysics when eventDriven is set
+void AdvanceEvents(float time)
+{
+    if (!eventSimulation.IsInitialized())
+    {
+        eventSimulation.Initialize(physicsWorld, arenaBounds);
+    }
+    eventSimulation.Advance(time);
+
+    // Every position is exact at the end of Advance, nothing to blend
+    physicsAlpha = 1.0f;
+}
+
+/// \brief Renumbers the bodies along a Morton curve and remaps every handle that points at one
+void ReorderSpheres()
+{
+    std::vector<int> oldToNew = physicsWorld.SortByMorton();
+
+    // sphereMeshes[i] has to stay body i
+    std::vector<Mesh*> meshes(sphereMeshes.size());
     for (Mesh* sphere : sphereMeshes)
     {
+        sphere->physicsHandle = oldToNew[sphere->physicsHandle];
+        meshes[sphere->physicsHandle] = sphere;
+    }
+    sphereMeshes.swap(meshes);
+
+    std::vector<int> proxies(sphereProxies.size());
+    for (int old = 0; old < (int)sphereProxies.size(); ++old)
+    {
+        proxies[oldToNew[old]] = sphereProxies[old];
+        sphereTree.SetUserData(sphereProxies[old], oldToNew[old]);
+    }
+    sphereProxies.swap(proxies);
+
+    sphereSweep.RemapBodies(oldToNew);
+    triggers.RemapBodies(oldToNew);
+    contactSolver.RemapBodies(oldToNew);
+    positionSolver.RemapBodies(oldToNew);
+
+    // These index by handle and are cheap to rebuild
+    if (broadphase == UniformGrid) sphereGrid.Build(physicsWorld);
+    if (broadphase == VerletList) sphereNeighbourList.Build(physicsWorld);
+}
+
+/// \brief Advances the spheres by one physicsTimeStep
+void StepPhysics()
+{
+    // Bodies drift apart in memory as they move, put neighbours back next to each other now and then
+    if (reorderInterval > 0 && ++stepsSinceReorder >= reorderInterval)
+    {
+        ReorderSpheres();
+        stepsSinceReorder = 0;
+    }
+
+    physicsWorld.SavePreviousPositions(workerPool.GetJobSystem());
+
+    // positionSolver moves the bodies itself, after the pairs are gathered, so it is not swept.
+    // CollisionChecking grows each box by how far its sphere can get this step instead
+    if (!positionBased)
+    {
+        //for every sphere do physics
+        physicsWorld.Integrate(physicsTimeStep, workerPool.GetJobSystem());
+
+        if (continuousCollision) collision.SweepFastBodies(physicsWorld, physicsTimeStep, wallBoxes, worldTree);
+    }
+
+    CollisionChecking();
+
+    triggers.Update(physicsWorld);
+    HandleTriggerEvents();
+
+    // Sleeping spheres didn't move, so once everything sleeps the last build stays good
+    if (physicsWorld.GetActiveCount() > 0) sceneQueryStale = true;
+
+    physicsWorld.UpdateSleeping();
+}
+
+/// \brief Puts the walls and every sphere where it is now into sceneQuery.
+/// Spheres get their body as user data, walls -1 - their index in wallMeshes
+void BuildSceneQuery()
+{
+    sceneQuery.Clear();
+    for (int i = 0; i < (int)wallMeshes.size(); ++i)
+    {
+        sceneQuery.AddMesh(wallMeshes[i], -1 - i);
+    }
+    for (int i = 0; i < physicsWorld.GetBodyCount(); ++i)
+    {
+        sceneQuery.AddSphere(physicsWorld.GetPosition(i), physicsWorld.radius[i], i);
+    }
+    sceneQuery.Build();
+    sceneQueryStale = false;
+}
+
+/// \brief True if the pickup box at its current position is clear of the walls, using the rotated wall
+/// boxes, and of every sphere with some room to spare, using sceneQuery
+bool PickupSpotFree()
+{
+    OBB pickupBox = pickup_mesh.CalculateOrientedBox();
+    glm::vec3 normal;
+    float depth;
+    for (int i = 0; i < (int)wallMeshes.size(); ++i)
+    {
+        if (wallMeshes[i] == &plane_mesh) continue;
+        if (Collision::OBBOverlap(pickupBox, wallBoxes[i], normal, depth)) return false;
+    }
+
+    // Room for a sphere rolling past to miss it next step
+    const glm::vec3 room(0.1f);
+    pickup_mesh.CalculateBoundingBox();
+    if (sceneQueryStale) BuildSceneQuery();
+    sphereNeighbours.clear();
+    sceneQuery.OverlapAABB(AABB(pickup_mesh.minVert - room, pickup_mesh.maxVert + room), sphereNeighbours);
+    for (int shape : sphereNeighbours)
+    {
+        if (sceneQuery.IsSphere(shape)) return false;
+    }
+    return true;
+}
+
+/// \brief Game side of the triggers, keeps count of the spheres in the pickup zone and moves the
+/// pickup once a sphere has rolled into it
+void HandleTriggerEvents()
+{
+    bool collected = false;
+    for (const TriggerEvent& event : triggers.GetEvents())
+    {
+        if (event.type == TriggerEnter) spheresInPickupZone++;
+        if (event.type == TriggerExit) spheresInPickupZone--;
+        triggerCrossings++;
 
-        for (int i = p+1; i < sphereMeshes.size(); ++i)
+        if (event.type == TriggerEnter && event.trigger == pickupTrigger && pickup_mesh.pickupable)
         {
-            collision.SphereCollision(sphere, sphereMeshes[i]);
+            collected = true;
         }
-        p++;
     }
+
+    if (collected)
+    {
+        // Only one pickup per frame even if several spheres entered together, the spheres still
+        // inside get their exit events on the next Update
+        pickupsCollected++;
+
+        // A few tries at a spot away from the walls and the spheres, so it isn't collected again right away
+        for (int attempt = 0; attempt < 32; ++attempt)
+        {
+            glm::vec3 spot = math.RandomVec3(-3.0f, 3.0f);
+            pickup_mesh.globalPosition.x = spot.x;
+            pickup_mesh.globalPosition.z = spot.z;
+            if (PickupSpotFree()) break;
+        }
+        pickup_mesh.CalculateBoundingBox();
+        triggers.SetTriggerBox(pickupTrigger, AABB(pickup_mesh.minVert, pickup_mesh.maxVert));
+    }
+}
+
+/// \brief True if the pair (i, j) should be gathered from body i, which is awake.
+/// Pairs of two awake bodies are only gathered from the lower index, pairs with a sleeping body always
+bool TestFromAwake(int i, int j)
+{
+    return !physicsWorld.IsAwake(j) || i < j;
+}
+
+/// \brief Turns gravity on or off, with a softer bounce while it is on so piles can settle
+void EnableGravity(bool enable)
+{
+    useGravity = enable;
+    physicsWorld.gravity = enable ? glm::vec3(0.0f, -9.81f, 0.0f) : glm::vec3(0.0f);
+    contactSolver.restitution = enable ? 0.5f : 1.0f;
+
+    // Sleeping spheres would hang in the air until something hit them
+    for (int i = 0; i < physicsWorld.GetBodyCount(); ++i)
+    {
+        physicsWorld.WakeBody(i);
+    }
+}
+
+/// \brief Box the broadphase looks for partners and walls in. positionSolver moves the bodies after the
+/// pairs are gathered, so there it covers everywhere the sphere can get this step
+AABB SphereQueryBox(int body)
+{
+    return positionBased ? physicsWorld.GetSweptAABB(body, physicsTimeStep) : physicsWorld.GetAABB(body);
+}
+
+/// \brief Makes the grid cells and the neighbour list skin wide enough for the furthest an awake sphere
+/// can get this step, so pairs gathered before positionSolver moves them still hold every contact
+void CoverPositionSolverReach()
+{
+    sphereLinearBVH.sweepTime = positionBased ? physicsTimeStep : 0.0f;
+    sphereNeighbourList.sweepTime = positionBased ? physicsTimeStep : 0.0f;
+    if (!positionBased) return;
+
+    float maxReach = 0.0f;
+    for (int i : physicsWorld.activeBodies)
+    {
+        maxReach = std::max(maxReach, physicsWorld.GetReach(i, physicsTimeStep));
+    }
+
+    // Two spheres heading for each other close the gap by twice the reach. Grown with room to spare and only
+    // shrunk once it is four times too big, so speeds going up and down don't rebuild every step
+    float gridMargin = 2.0f * maxReach;
+    if (broadphase == UniformGrid && (sphereGrid.margin < gridMargin || sphereGrid.margin > 4.0f * gridMargin))
+    {
+        sphereGrid.margin = 2.0f * gridMargin;
+        sphereGrid.Build(physicsWorld);
+    }
+
+    // The list takes half its skin per body, and never goes below the skin it has on its own
+    float skin = std::max(4.0f * maxReach, NeighbourList().skin);
+    if (broadphase == VerletList && (sphereNeighbourList.skin < skin || sphereNeighbourList.skin > 4.0f * skin))
+    {
+        sphereNeighbourList.skin = std::max(8.0f * maxReach, NeighbourList().skin);
+        sphereNeighbourList.Build(physicsWorld);
+    }
+}
+
+/// \brief Resolves wallPairs and spherePairs with whichever narrowphase is switched on
+void ResolvePairs()
+{
+    if (positionBased)
+    {
+        collision.sphereTests += (int)spherePairs.size();
+        collision.sphereContacts += parallelResolve
+            ? positionSolver.Step(physicsWorld, physicsTimeStep, spherePairs, wallPairs, wallBoxes, workerPool.GetJobSystem())
+            : positionSolver.Step(physicsWorld, physicsTimeStep, spherePairs, wallPairs, wallBoxes);
+        return;
+    }
+    if (iterativeSolver || useGravity)
+    {
+        collision.sphereTests += (int)spherePairs.size();
+        collision.sphereContacts += contactSolver.Solve(physicsWorld, spherePairs, wallPairs, wallBoxes);
+        return;
+    }
+
+    // Without a solver the walls are bounced one at a time, the rotated box decides if the sphere really touches
+    for (const std::pair<int, int>& pair : wallPairs)
+    {
+        collision.SphereToOBBCollision(physicsWorld, pair.first, wallBoxes[pair.second]);
+    }
+
+    if (parallelResolve)
+    {
+        collision.SphereCollisionParallel(physicsWorld, spherePairs, workerPool);
+    }
+    else
+    {
+        // The pair list is already flat, so resolve it several pairs at a time
+        collision.SphereCollisionBatch(physicsWorld, spherePairs);
+    }
+}
+
+/// \brief Every awake sphere against the walls its box touches, as (body, index in wallBoxes).
+/// Sleeping spheres don't move, so only awake ones can hit a wall
+void FindWallPairs(std::vector<std::pair<int, int>>& pairs)
+{
+    pairs.clear();
+    for (int i : physicsWorld.activeBodies)
+    {
+        if (broadphase == BruteForce)
+        {
+            for (int wall = 0; wall < (int)wallBoxes.size(); ++wall)
+            {
+                pairs.emplace_back(i, wall);
+            }
+            continue;
+        }
+
+        // The tree only knows the box around each wall
+        worldTree.Query(SphereQueryBox(i), [i, &pairs](int wall)
+        {
+            pairs.emplace_back(i, wall);
+            return true;
+        });
+    }
+}
+
+/// \brief Every pair with at least one awake sphere, whether they are close or not
+void BruteForcePairs(std::vector<std::pair<int, int>>& pairs)
+{
+    const int sphereCount = physicsWorld.GetBodyCount();
+    pairs.clear();
+    for (int p = 0; p < sphereCount; ++p)
+    {
+        for (int i = p+1; i < sphereCount; ++i)
+        {
+            if (physicsWorld.IsAwake(p) || physicsWorld.IsAwake(i)) pairs.emplace_back(p, i);
+        }
+    }
+}
+
+/// \brief Awake spheres against everyone in their own and the neighbouring cells of sphereGrid
+void GridPairs(std::vector<std::pair<int, int>>& pairs)
+{
+    // Sleeping spheres keep their cell, only awake ones are re-binned
+    if (sphereGrid.GetBodyCount() != physicsWorld.GetBodyCount())
+    {
+        sphereGrid.Build(physicsWorld);
+    }
+    else
+    {
+        for (int i : physicsWorld.activeBodies)
+        {
+            sphereGrid.Update(i);
+        }
+    }
+
+    pairs.clear();
+    for (int i : physicsWorld.activeBodies)
+    {
+        sphereGrid.Neighbours(i, -1, sphereNeighbours);
+        for (int j : sphereNeighbours)
+        {
+            if (TestFromAwake(i, j)) pairs.emplace_back(i, j);
+        }
+    }
+}
+
+/// \brief Pairs whose boxes overlap on all three axes in sphereSweep
+void SweepPairs(std::vector<std::pair<int, int>>& pairs)
+{
+    // Pair list is kept between frames, only swapped endpoints touch it
+    for (int i : physicsWorld.activeBodies)
+    {
+        sphereSweep.SetBox(i, SphereQueryBox(i));
+    }
+    sphereSweep.Update();
+
+    pairs.clear();
+    for (const std::pair<int, int>& pair : sphereSweep.GetPairs())
+    {
+        if (physicsWorld.IsAwake(pair.first) || physicsWorld.IsAwake(pair.second)) pairs.push_back(pair);
+    }
+}
+
+/// \brief Awake spheres against everyone whose fattened box in sphereTree overlaps theirs
+void TreePairs(std::vector<std::pair<int, int>>& pairs)
+{
+    for (int i : physicsWorld.activeBodies)
+    {
+        sphereTree.MoveProxy(sphereProxies[i], SphereQueryBox(i), physicsWorld.GetVelocity(i) * physicsTimeStep);
+    }
+
+    pairs.clear();
+    for (int i : physicsWorld.activeBodies)
+    {
+        sphereTree.Query(SphereQueryBox(i), [i, &pairs](int other)
+        {
+            if (other != i && TestFromAwake(i, other)) pairs.emplace_back(i, other);
+            return true;
+        });
+    }
+}
+
+/// \brief Pairs in sphereNeighbourList with at least one awake sphere
+void NeighbourListPairs(std::vector<std::pair<int, int>>& pairs)
+{
+    // Same pairs as last step unless someone has moved more than half the skin
+    sphereNeighbourList.Update(physicsWorld);
+
+    pairs.clear();
+    for (const std::pair<int, int>& pair : sphereNeighbourList.GetPairs())
+    {
+        if (physicsWorld.IsAwake(pair.first) || physicsWorld.IsAwake(pair.second)) pairs.push_back(pair);
+    }
+}
+
+/// \brief Pairs found by walking sphereLinearBVH, with at least one awake sphere
+void LinearBVHPairs(std::vector<std::pair<int, int>>& pairs)
+{
+    // Whole hierarchy from scratch every step, built and walked on the worker threads
+    sphereLinearBVH.Build(physicsWorld, workerPool);
+    sphereLinearBVH.FindPairs(workerPool, pairs);
+
+    pairs.erase(std::remove_if(pairs.begin(), pairs.end(), [](const std::pair<int, int>& pair)
+    {
+        return !physicsWorld.IsAwake(pair.first) && !physicsWorld.IsAwake(pair.second);
+    }), pairs.end());
+}
+
+/// \brief Gathers wallPairs and spherePairs with the chosen broadphase, then resolves them all in ResolvePairs
+void CollisionChecking()
+{
+    collision.ResetCounters();
+    CoverPositionSolverReach();
+
+    FindWallPairs(wallPairs);
+
+    switch (broadphase)
+    {
+    case BruteForce:
+        BruteForcePairs(spherePairs);
+        break;
+    case UniformGrid:
+        GridPairs(spherePairs);
+        break;
+    case IncrementalSweep:
+        SweepPairs(spherePairs);
+        break;
+    case DynamicTree:
+        TreePairs(spherePairs);
+        break;
+    case VerletList:
+        NeighbourListPairs(spherePairs);
+        break;
+    case MortonBVH:
+        LinearBVHPairs(spherePairs);
+        break;
+    }
+
+    ResolvePairs();
 }
 
 glm::vec3 RandomColor()
@@ -116,29 +116,15 @@ bool Math::isPointAboveTriangle(const TriangleStruct& triangle, const glm::vec3&
 
 void Math::MapPlayerToSurface(Surface* surface, Mesh& MainMesh, float deltaTime)
 {
-    
-    float x = MainMesh.globalPosition.x;
-    float z = MainMesh.globalPosition.z;
-
-    
-    for (const TriangleStruct& triangle : surface->triangles)
-    {
-        // Check if the camera's position is above the triangle
-        if (isPointAboveTriangle(triangle, glm::vec3(x, MainMesh.globalPosition.y, z)))
-        {
-            // Calculate the barycentric coordinates of the camera's position within the triangle
-            glm::vec3 barycentricCoords = barycentricCoordinates(triangle.v0, triangle.v1, triangle.v2, glm::vec3(x, MainMesh.globalPosition.y, z));
-
-            // Calculate the height at the camera's position by interpolating the heights of the triangle's vertices
-            float height = calculateHeightUsingBarycentric2(triangle.v0, triangle.v1, triangle.v2, glm::vec3(x, MainMesh.globalPosition.y, z));
+    // The grid cell under the player gives the triangle straight away, no need to look at the others
+    float height;
+    if (!surface->GetHeight(MainMesh.globalPosition, height)) return;
 
-            float interpolationSpeed = 6.f* deltaTime;
-            MainMesh.globalPosition.y += ((height - MainMesh.globalPosition.y+1.f) * interpolationSpeed);
+    // Players under the ground are left where they are
+    if (MainMesh.globalPosition.y <= height) return;
 
-            
-            break;
-        }
-    }
+    float interpolationSpeed = 6.f* deltaTime;
+    MainMesh.globalPosition.y += ((height - MainMesh.globalPosition.y+1.f) * interpolationSpeed);
 }
 
 glm::vec3 Math::RandomVec3(float min, float max)
@@ -1,9 +1,14 @@
 ﻿#include "Mesh.h"
+#include <cfloat>
 #include <iostream>
+#ifndef COMPULSORY1_HEADLESS
 #include <glad/glad.h>
+#endif
 #include <glm/matrix.hpp>
 #include <glm/gtc/type_ptr.hpp>
 
+bool Mesh::headless = false;
+
 Mesh::Mesh()
 {
 }
@@ -233,6 +238,12 @@ void Mesh::CreatePlane(float radius, glm::vec3 color)
 
 void Mesh::Setup()
 {
+    hullDirty = true;
+    sphereDirty = true;
+
+    if (headless) return;
+
+#ifndef COMPULSORY1_HEADLESS
     glGenVertexArrays(1, &VAO);
     glGenBuffers(1, &VBO);
     glGenBuffers(1, &EBO);
@@ -258,6 +269,7 @@ void Mesh::Setup()
     // Unbind VAO and VBO
     glBindBuffer(GL_ARRAY_BUFFER, 0);
     glBindVertexArray(0);
+#endif
 }
 
 void Mesh::CalculateBoundingBox()
@@ -275,8 +287,66 @@ void Mesh::CalculateBoundingBox()
     }
 }
 
+OBB Mesh::CalculateOrientedBox()
+{
+    glm::mat4 model = GetTransform();
+
+    // Corner 0 is the local min and corner 7 the local max, see CalculateInitialBoundingBox
+    glm::vec3 localCenter = (boundingBoxCorners[0] + boundingBoxCorners[7]) * 0.5f;
+    glm::vec3 localHalf = (boundingBoxCorners[7] - boundingBoxCorners[0]) * 0.5f;
+
+    OBB box;
+    box.center = glm::vec3(model * glm::vec4(localCenter, 1.0f));
+    for (int axis = 0; axis < 3; ++axis)
+    {
+        // Columns of the model matrix are the local axes with the scale still in them
+        glm::vec3 column = glm::vec3(model[axis]);
+        float scale = glm::length(column);
+        box.axes[axis] = column / scale;
+        box.halfExtents[axis] = localHalf[axis] * scale;
+    }
+    return box;
+}
+
+const ConvexHull& Mesh::GetConvexHull()
+{
+    if (hullDirty)
+    {
+        std::vector<glm::vec3> points;
+        points.reserve(vertices.size());
+        for (const Vertex& vertex : vertices) points.push_back(vertex.Position);
+
+        convexHull.Build(points);
+        hullDirty = false;
+    }
+    return convexHull;
+}
+
+const BoundingSphere& Mesh::GetLocalBoundingSphere()
+{
+    if (sphereDirty)
+    {
+        // Only the hull corners can touch the sphere, so use them when the hull is already there
+        std::vector<glm::vec3> points;
+        if (!hullDirty)
+        {
+            points = convexHull.vertices;
+        }
+        else
+        {
+            points.reserve(vertices.size());
+            for (const Vertex& vertex : vertices) points.push_back(vertex.Position);
+        }
+
+        localBoundingSphere = BoundingSphere::Minimal(points);
+        sphereDirty = false;
+    }
+    return localBoundingSphere;
+}
+
 void Mesh::Draw(unsigned shaderProgram)
 {
+#ifndef COMPULSORY1_HEADLESS
     glm::mat4 model = GetTransform();
     
     int modelLoc = glGetUniformLocation(shaderProgram, "model");
@@ -291,8 +361,9 @@ void Mesh::Draw(unsigned shaderProgram)
     // glBindBuffer(GL_ARRAY_BUFFER, 0);
     // glBindVertexArray(0);
 
-    CalculateBoundingBox();
+    // Bounding boxes are refreshed by whoever moves the mesh, see DrawObjects
     // DrawBoundingBox(shaderProgram);
+#endif
 }
 
 glm::mat4 Mesh::GetTransform()
@@ -300,19 +371,22 @@ glm::mat4 Mesh::GetTransform()
     glm::mat4 model = glm::mat4(1.0f);
     model = glm::translate(model, globalPosition);
     
-    model = glm::rotate(model, glm::radians(globalRotation.x), glm::vec3(1.0f, 0.0f, 0.0f));
-    model = glm::rotate(model, glm::radians(globalRotation.y), glm::vec3(0.0f, 1.0f, 0.0f));
-    model = glm::rotate(model, glm::radians(globalRotation.z), glm::vec3(0.0f, 0.0f, 1.0f));
+    model = model * glm::mat4_cast(orientation);
 
     model = glm::scale(model, globalScale);
-    
-    Radius = 1 * globalScale.x;
+
+    // Radius is used around globalPosition, so shapes whose bounding sphere isn't centred on the
+    // origin get the offset added. Tight for the centred ones, not just the unit sphere
+    const BoundingSphere& bounds = GetLocalBoundingSphere();
+    float scale = glm::max(glm::abs(globalScale.x), glm::max(glm::abs(globalScale.y), glm::abs(globalScale.z)));
+    Radius = (glm::length(bounds.center) + bounds.radius) * scale;
     
     return model;
 }
 
 void Mesh::DrawBoundingBox(unsigned int shaderProgram)
 {
+#ifndef COMPULSORY1_HEADLESS
     glm::vec3 vertices[8] = {
         minVert,
         glm::vec3(minVert.x, minVert.y, maxVert.z),
@@ -363,11 +437,64 @@ void Mesh::DrawBoundingBox(unsigned int shaderProgram)
     glDeleteVertexArrays(1, &VAO);
     glDeleteBuffers(1, &VBO);
     glDeleteBuffers(1, &EBO);
+#endif
 }
 
 void Mesh::Physics(float deltaTime)
 {
     globalPosition += velocity * deltaTime;
+
+    // Same step as PhysicsWorld::Integrate, one mesh at a time
+    if (angularVelocity != glm::vec3(0.0f))
+    {
+        orientation = glm::normalize(orientation + glm::quat(0.0f, angularVelocity) * orientation * (0.5f * deltaTime));
+    }
+}
+
+void Mesh::SetRotation(const glm::vec3& eulerDegrees)
+{
+    orientation =
+        glm::angleAxis(glm::radians(eulerDegrees.x), glm::vec3(1.0f, 0.0f, 0.0f)) *
+        glm::angleAxis(glm::radians(eulerDegrees.y), glm::vec3(0.0f, 1.0f, 0.0f)) *
+        glm::angleAxis(glm::radians(eulerDegrees.z), glm::vec3(0.0f, 0.0f, 1.0f));
+}
+
+glm::vec3 Mesh::CalculateInertia() const
+{
+    // Full size of the shape along each local axis
+    glm::vec3 size = (boundingBoxCorners[7] - boundingBoxCorners[0]) * glm::abs(globalScale);
+    glm::vec3 sizeSq = size * size;
+
+    switch (mType)
+    {
+    case Cube:
+        return mass / 12.0f * glm::vec3(sizeSq.y + sizeSq.z, sizeSq.x + sizeSq.z, sizeSq.x + sizeSq.y);
+    case Pyramid:
+    {
+        // Square base on x and z, point up y, about the centre of mass a quarter of the way up
+        float heightSq = sizeSq.y;
+        return mass * glm::vec3(
+            sizeSq.z / 20.0f + 3.0f * heightSq / 80.0f,
+            (sizeSq.x + sizeSq.z) / 20.0f,
+            sizeSq.x / 20.0f + 3.0f * heightSq / 80.0f);
+    }
+    case Sphere:
+    {
+        float radius = glm::max(size.x, glm::max(size.y, size.z)) * 0.5f;
+        return glm::vec3(0.4f * mass * radius * radius);
+    }
+    case Plane:
+        // Thin plate in x and z
+        return mass / 12.0f * glm::vec3(sizeSq.z, sizeSq.x + sizeSq.z, sizeSq.x);
+    case Square:
+        // Thin plate in x and y
+        return mass / 12.0f * glm::vec3(sizeSq.y, sizeSq.x, sizeSq.x + sizeSq.y);
+    case Triangle:
+        // Thin triangle in x and y, base along x and point up y
+        return mass * glm::vec3(sizeSq.y / 18.0f, sizeSq.x / 24.0f, sizeSq.y / 18.0f + sizeSq.x / 24.0f);
+    }
+
+    return glm::vec3(0.0f);
 }
 
 /// 
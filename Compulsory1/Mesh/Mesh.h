@@ -3,6 +3,10 @@
 #include "../Vertex.h"
 #include "glm/fwd.hpp"
 #include "glm/vec3.hpp"
+#include "glm/gtc/quaternion.hpp"
+#include "../Physics/BoundingSphere.h"
+#include "../Physics/ConvexHull.h"
+#include "../Physics/OBB.h"
 
 enum MeshType {Cube, Triangle, Square, Pyramid, Sphere, Plane};
 
@@ -28,7 +32,19 @@ public:
 
 
     void Setup();
+
+    /// When true Setup() makes no GL calls, so meshes can be built without a window or context
+    static bool headless;
     void CalculateBoundingBox();
+
+    /// \brief Local bounding box corners through GetTransform, without re-fitting to the world axes
+    OBB CalculateOrientedBox();
+
+    /// \brief Convex hull of vertices in local space, built the first time it is asked for
+    const ConvexHull& GetConvexHull();
+
+    /// \brief Smallest sphere around vertices in local space, cached like GetConvexHull
+    const BoundingSphere& GetLocalBoundingSphere();
     
     void Draw(unsigned int shaderProgram);
 
@@ -46,7 +62,8 @@ public:
     std::vector<unsigned int> indices;
 
     glm::vec3 globalPosition = glm::vec3(0.0f, 0.0f, 0.0f);
-    glm::vec3 globalRotation = glm::vec3(0.0f, 0.0f, 0.0f);
+    // GetTransform turns the mesh by this, see SetRotation for angles in degrees
+    glm::quat orientation = glm::quat(1.0f, 0.0f, 0.0f, 0.0f);
     glm::vec3 globalScale = glm::vec3(1.0f, 1.0f, 1.0f);
     
     glm::vec3 minVert = glm::vec3(0.0f, 0.0f, 0.0f);
@@ -56,16 +73,34 @@ public:
 
     void Physics(float deltaTime);
 
+    /// \brief Sets orientation from angles in degrees, turned about x, then y, then z in local space
+    void SetRotation(const glm::vec3& eulerDegrees);
+
+    /// \brief Principal moments of inertia about the centre of mass for mType, from the local bounding
+    /// box times globalScale and mass. Axes are the mesh's own x, y and z
+    glm::vec3 CalculateInertia() const;
+
     glm::vec3 ClosestPointOnAABB(glm::vec3& point) const;
 
     float mass = 1;
     float Radius = 1;
     glm::vec3 velocity = glm::vec3(0.0f, 0.0f, 0.0f);
+    // World space, radians per second
+    glm::vec3 angularVelocity = glm::vec3(0.0f, 0.0f, 0.0f);
+
+    // Body in the PhysicsWorld, -1 if the mesh simulates itself through Physics()
+    int physicsHandle = -1;
 
     glm::vec3 boundingBoxCorners [8];
 
     void CalculateInitialBoundingBox();
 
     glm::vec3 ObjectColor = glm::vec3(1.0f, 1.0f, 1.0f);
+
+    // Local space bounds from vertices, rebuilt after Setup since the vertices may have changed
+    ConvexHull convexHull;
+    BoundingSphere localBoundingSphere;
+    bool hullDirty = true;
+    bool sphereDirty = true;
     
 };
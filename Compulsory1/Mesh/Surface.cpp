@@ -1,9 +1,13 @@
 ﻿#include "Surface.h"
+#include <algorithm>
+#include "Mesh.h"
 #include "../Vertex.h"
 #include "glm/gtc/noise.hpp"
 #include "glm/gtc/matrix_transform.hpp"
 #include "glm/gtc/type_ptr.hpp"
+#ifndef COMPULSORY1_HEADLESS
 #include "glad/glad.h"
+#endif
 
 
 Surface::Surface()
@@ -18,6 +22,8 @@ Surface::Surface(int sizeint, glm::vec3 color) {
     //This is why it is set to 10. 10 is optimal for testing everything in this project
     int detail = 10;
     size = sizeint * detail;
+    origin = glm::vec3(-5.0f, 0.0f, -5.0f);
+    spacing = 2.0f / detail;
     glm::vec3 defaultColor = color;
 
     // Generate vertices and color
@@ -72,11 +78,13 @@ Surface::Surface(int sizeint, glm::vec3 color) {
         vertex.Normal = glm::normalize(vertex.Normal);
     }
 
-    Setup();
+    // Nothing to upload to without a window
+    if (!Mesh::headless) Setup();
 }
 
 void Surface::Setup()
 {
+#ifndef COMPULSORY1_HEADLESS
     glGenVertexArrays(1, &VAO);
     glGenBuffers(1, &VBO);
     glGenBuffers(1, &EBO);
@@ -102,10 +110,12 @@ void Surface::Setup()
     // Unbind VAO and VBO
     glBindBuffer(GL_ARRAY_BUFFER, 0);
     glBindVertexArray(0);
+#endif
 }
 
 void Surface::Draw(unsigned shaderProgram)
 {
+#ifndef COMPULSORY1_HEADLESS
     glm::mat4 model = glm::mat4(1.0f);
     model = glm::translate(model, globalPosition);
 
@@ -115,6 +125,52 @@ void Surface::Draw(unsigned shaderProgram)
     glBindVertexArray(VAO);
     glDrawElements(GL_TRIANGLES, indices.size(), GL_UNSIGNED_INT, 0);
     glBindVertexArray(0); // Unbind VAO
+#endif
+}
+
+bool Surface::GetCell(const glm::vec3& position, int& row, int& column) const
+{
+    float x = (position.x - globalPosition.x - origin.x) / spacing;
+    float z = (position.z - globalPosition.z - origin.z) / spacing;
+    if (x < 0.0f || z < 0.0f || x > (float)size || z > (float)size) return false;
+
+    // The far edge belongs to the last cell
+    row = std::min((int)x, size - 1);
+    column = std::min((int)z, size - 1);
+    return true;
+}
+
+int Surface::GetTriangle(const glm::vec3& position) const
+{
+    int row, column;
+    if (!GetCell(position, row, column)) return -1;
+
+    // Both triangles of a cell share the diagonal from (row + 1, column) to (row, column + 1),
+    // the first one lies on the far side of it
+    float u = (position.x - globalPosition.x - origin.x) / spacing - row;
+    float v = (position.z - globalPosition.z - origin.z) / spacing - column;
+    return GetCellTriangle(row, column) + (u + v >= 1.0f ? 0 : 1);
+}
+
+bool Surface::GetHeight(const glm::vec3& position, float& height) const
+{
+    int triangle = GetTriangle(position);
+    if (triangle < 0) return false;
+
+    // Height of the triangle's plane at x, z
+    const TriangleStruct& face = triangles[triangle];
+    glm::vec3 up = GetUpNormal(triangle);
+    glm::vec3 local = position - globalPosition;
+    height = face.v0.y - (up.x * (local.x - face.v0.x) + up.z * (local.z - face.v0.z)) / up.y + globalPosition.y;
+    return true;
+}
+
+glm::vec3 Surface::GetUpNormal(int triangle) const
+{
+    // The stored normals follow the winding, which isn't the same for the two triangles of a cell
+    const TriangleStruct& face = triangles[triangle];
+    glm::vec3 normal = glm::normalize(glm::cross(face.v1 - face.v0, face.v2 - face.v0));
+    return normal.y < 0.0f ? -normal : normal;
 }
 
 glm::vec3 Surface::RandomColor()
@@ -16,12 +16,34 @@ public:
 
     glm::vec3 RandomColor();
 
+    /// \brief Grid cell under position, worked out from the spacing instead of searching the triangles
+    /// \param row cell index along x, column along z
+    /// \return false if position is outside the surface
+    bool GetCell(const glm::vec3& position, int& row, int& column) const;
+
+    /// \brief Index in triangles of the first of the two triangles of a cell, the second one follows it
+    int GetCellTriangle(int row, int column) const { return 2 * (row * size + column); }
+
+    /// \brief Index in triangles of the triangle straight under position, -1 if it is outside the surface
+    int GetTriangle(const glm::vec3& position) const;
+
+    /// \brief Height of the surface straight under position, from the one triangle it is over
+    /// \return false if position is outside the surface
+    bool GetHeight(const glm::vec3& position, float& height) const;
+
+    /// \brief Unit normal of a triangle, on the side facing up
+    glm::vec3 GetUpNormal(int triangle) const;
+
     std::vector<Vertex> vertices;
     std::vector<unsigned int> indices;
 
     std::vector<TriangleStruct> triangles;
     int size = 10;
 
+    // Vertex (0, 0) and the distance between neighbouring vertices, triangles are relative to globalPosition
+    glm::vec3 origin = glm::vec3(0.0f);
+    float spacing = 1.0f;
+
     unsigned int VBO, VAO, EBO;
 
     glm::vec3 globalPosition = glm::vec3(0.0f, 0.0f, 0.0f);
@@ -0,0 +1,37 @@
+﻿#pragma once
+#include "glm/vec3.hpp"
+#include "glm/common.hpp"
+
+/// \brief Axis aligned box in world space, same layout as Mesh::minVert / Mesh::maxVert
+struct AABB
+{
+    AABB() : min(0.0f), max(0.0f) {}
+    AABB(const glm::vec3& minVert, const glm::vec3& maxVert) : min(minVert), max(maxVert) {}
+
+    glm::vec3 min;
+    glm::vec3 max;
+
+    bool Overlaps(const AABB& other) const
+    {
+        return min.x <= other.max.x && max.x >= other.min.x &&
+               min.y <= other.max.y && max.y >= other.min.y &&
+               min.z <= other.max.z && max.z >= other.min.z;
+    }
+
+    bool Contains(const AABB& other) const
+    {
+        return min.x <= other.min.x && min.y <= other.min.y && min.z <= other.min.z &&
+               max.x >= other.max.x && max.y >= other.max.y && max.z >= other.max.z;
+    }
+
+    float SurfaceArea() const
+    {
+        glm::vec3 d = max - min;
+        return 2.0f * (d.x * d.y + d.y * d.z + d.z * d.x);
+    }
+
+    static AABB Union(const AABB& a, const AABB& b)
+    {
+        return AABB(glm::min(a.min, b.min), glm::max(a.max, b.max));
+    }
+};
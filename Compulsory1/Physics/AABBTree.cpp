@@ -0,0 +1,322 @@
+﻿#include "AABBTree.h"
+
+#include <algorithm>
+
+AABBTree::AABBTree()
+{
+
+}
+
+int AABBTree::AllocateNode()
+{
+    if (freeList == Null)
+    {
+        nodes.emplace_back();
+        return (int)nodes.size() - 1;
+    }
+
+    int nodeId = freeList;
+    freeList = nodes[nodeId].next;
+    nodes[nodeId] = Node();
+    return nodeId;
+}
+
+void AABBTree::FreeNode(int nodeId)
+{
+    nodes[nodeId].next = freeList;
+    nodes[nodeId].height = -1;
+    freeList = nodeId;
+}
+
+int AABBTree::CreateProxy(const AABB& aabb, int userData)
+{
+    int proxyId = AllocateNode();
+
+    glm::vec3 fat(margin);
+    nodes[proxyId].aabb = AABB(aabb.min - fat, aabb.max + fat);
+    nodes[proxyId].userData = userData;
+    nodes[proxyId].height = 0;
+
+    InsertLeaf(proxyId);
+    return proxyId;
+}
+
+void AABBTree::DestroyProxy(int proxyId)
+{
+    RemoveLeaf(proxyId);
+    FreeNode(proxyId);
+}
+
+bool AABBTree::MoveProxy(int proxyId, const AABB& aabb, const glm::vec3& displacement)
+{
+    if (nodes[proxyId].aabb.Contains(aabb)) return false;
+
+    RemoveLeaf(proxyId);
+
+    // Stretch the fat box in the direction the body is going so it isn't re-inserted every frame
+    glm::vec3 fat(margin);
+    AABB fatAABB(aabb.min - fat, aabb.max + fat);
+    glm::vec3 predicted = displacement * 2.0f;
+    fatAABB.min += glm::min(predicted, glm::vec3(0.0f));
+    fatAABB.max += glm::max(predicted, glm::vec3(0.0f));
+
+    nodes[proxyId].aabb = fatAABB;
+    InsertLeaf(proxyId);
+    return true;
+}
+
+void AABBTree::InsertLeaf(int leaf)
+{
+    if (root == Null)
+    {
+        root = leaf;
+        nodes[root].parent = Null;
+        return;
+    }
+
+    // Walk down picking the cheapest child by surface area
+    AABB leafAABB = nodes[leaf].aabb;
+    int index = root;
+    while (!nodes[index].IsLeaf())
+    {
+        int child1 = nodes[index].child1;
+        int child2 = nodes[index].child2;
+
+        float area = nodes[index].aabb.SurfaceArea();
+        float combinedArea = AABB::Union(nodes[index].aabb, leafAABB).SurfaceArea();
+
+        // Cost of making a new parent for this node and the leaf
+        float cost = 2.0f * combinedArea;
+
+        // Minimum cost of pushing the leaf further down
+        float inheritanceCost = 2.0f * (combinedArea - area);
+
+        float cost1 = AABB::Union(leafAABB, nodes[child1].aabb).SurfaceArea() + inheritanceCost;
+        if (!nodes[child1].IsLeaf())
+        {
+            cost1 -= nodes[child1].aabb.SurfaceArea();
+        }
+
+        float cost2 = AABB::Union(leafAABB, nodes[child2].aabb).SurfaceArea() + inheritanceCost;
+        if (!nodes[child2].IsLeaf())
+        {
+            cost2 -= nodes[child2].aabb.SurfaceArea();
+        }
+
+        if (cost < cost1 && cost < cost2) break;
+
+        index = cost1 < cost2 ? child1 : child2;
+    }
+
+    int sibling = index;
+
+    // New parent for the sibling and the leaf
+    int oldParent = nodes[sibling].parent;
+    int newParent = AllocateNode();
+    nodes[newParent].parent = oldParent;
+    nodes[newParent].aabb = AABB::Union(leafAABB, nodes[sibling].aabb);
+    nodes[newParent].height = nodes[sibling].height + 1;
+    nodes[newParent].child1 = sibling;
+    nodes[newParent].child2 = leaf;
+    nodes[sibling].parent = newParent;
+    nodes[leaf].parent = newParent;
+
+    if (oldParent != Null)
+    {
+        if (nodes[oldParent].child1 == sibling)
+        {
+            nodes[oldParent].child1 = newParent;
+        }
+        else
+        {
+            nodes[oldParent].child2 = newParent;
+        }
+    }
+    else
+    {
+        root = newParent;
+    }
+
+    Refit(nodes[leaf].parent);
+}
+
+void AABBTree::RemoveLeaf(int leaf)
+{
+    if (leaf == root)
+    {
+        root = Null;
+        return;
+    }
+
+    int parent = nodes[leaf].parent;
+    int grandParent = nodes[parent].parent;
+    int sibling = nodes[parent].child1 == leaf ? nodes[parent].child2 : nodes[parent].child1;
+
+    if (grandParent != Null)
+    {
+        // Sibling takes the parent's place
+        if (nodes[grandParent].child1 == parent)
+        {
+            nodes[grandParent].child1 = sibling;
+        }
+        else
+        {
+            nodes[grandParent].child2 = sibling;
+        }
+        nodes[sibling].parent = grandParent;
+        FreeNode(parent);
+
+        Refit(grandParent);
+    }
+    else
+    {
+        root = sibling;
+        nodes[sibling].parent = Null;
+        FreeNode(parent);
+    }
+}
+
+void AABBTree::Refit(int nodeId)
+{
+    // Walk back to the root fixing boxes and heights, rotating where it got lopsided
+    int index = nodeId;
+    while (index != Null)
+    {
+        index = Balance(index);
+
+        int child1 = nodes[index].child1;
+        int child2 = nodes[index].child2;
+
+        nodes[index].height = 1 + std::max(nodes[child1].height, nodes[child2].height);
+        nodes[index].aabb = AABB::Union(nodes[child1].aabb, nodes[child2].aabb);
+
+        index = nodes[index].parent;
+    }
+}
+
+int AABBTree::Balance(int iA)
+{
+    Node& A = nodes[iA];
+    if (A.IsLeaf() || A.height < 2) return iA;
+
+    int iB = A.child1;
+    int iC = A.child2;
+    Node& B = nodes[iB];
+    Node& C = nodes[iC];
+
+    int balance = C.height - B.height;
+
+    // Rotate C up
+    if (balance > 1)
+    {
+        int iF = C.child1;
+        int iG = C.child2;
+        Node& F = nodes[iF];
+        Node& G = nodes[iG];
+
+        // Swap A and C
+        C.child1 = iA;
+        C.parent = A.parent;
+        A.parent = iC;
+
+        if (C.parent != Null)
+        {
+            if (nodes[C.parent].child1 == iA)
+            {
+                nodes[C.parent].child1 = iC;
+            }
+            else
+            {
+                nodes[C.parent].child2 = iC;
+            }
+        }
+        else
+        {
+            root = iC;
+        }
+
+        // Keep the taller grandchild under C
+        if (F.height > G.height)
+        {
+            C.child2 = iF;
+            A.child2 = iG;
+            G.parent = iA;
+            A.aabb = AABB::Union(B.aabb, G.aabb);
+            C.aabb = AABB::Union(A.aabb, F.aabb);
+
+            A.height = 1 + std::max(B.height, G.height);
+            C.height = 1 + std::max(A.height, F.height);
+        }
+        else
+        {
+            C.child2 = iG;
+            A.child2 = iF;
+            F.parent = iA;
+            A.aabb = AABB::Union(B.aabb, F.aabb);
+            C.aabb = AABB::Union(A.aabb, G.aabb);
+
+            A.height = 1 + std::max(B.height, F.height);
+            C.height = 1 + std::max(A.height, G.height);
+        }
+
+        return iC;
+    }
+
+    // Rotate B up
+    if (balance < -1)
+    {
+        int iD = B.child1;
+        int iE = B.child2;
+        Node& D = nodes[iD];
+        Node& E = nodes[iE];
+
+        // Swap A and B
+        B.child1 = iA;
+        B.parent = A.parent;
+        A.parent = iB;
+
+        if (B.parent != Null)
+        {
+            if (nodes[B.parent].child1 == iA)
+            {
+                nodes[B.parent].child1 = iB;
+            }
+            else
+            {
+                nodes[B.parent].child2 = iB;
+            }
+        }
+        else
+        {
+            root = iB;
+        }
+
+        // Keep the taller grandchild under B
+        if (D.height > E.height)
+        {
+            B.child2 = iD;
+            A.child1 = iE;
+            E.parent = iA;
+            A.aabb = AABB::Union(C.aabb, E.aabb);
+            B.aabb = AABB::Union(A.aabb, D.aabb);
+
+            A.height = 1 + std::max(C.height, E.height);
+            B.height = 1 + std::max(A.height, D.height);
+        }
+        else
+        {
+            B.child2 = iE;
+            A.child1 = iD;
+            D.parent = iA;
+            A.aabb = AABB::Union(C.aabb, D.aabb);
+            B.aabb = AABB::Union(A.aabb, E.aabb);
+
+            A.height = 1 + std::max(C.height, D.height);
+            B.height = 1 + std::max(A.height, E.height);
+        }
+
+        return iB;
+    }
+
+    return iA;
+}
@@ -0,0 +1,96 @@
+﻿#pragma once
+#include <vector>
+#include "AABB.h"
+
+/// \brief Dynamic bounding volume hierarchy.
+/// Leaves store a fattened AABB so bodies can move a bit without touching the tree. When a body
+/// leaves its fat box the leaf is removed and re-inserted, and the path to the root is rebalanced
+/// with rotations so queries stay logarithmic.
+class AABBTree
+{
+public:
+
+    static const int Null = -1;
+
+    AABBTree();
+
+    /// \param aabb tight world box of the body
+    /// \param userData returned by Query, usually an index into a mesh list
+    /// \return proxy id
+    int CreateProxy(const AABB& aabb, int userData);
+
+    void DestroyProxy(int proxyId);
+
+    /// \brief Refits a proxy after its body moved
+    /// \param displacement how far the body moves next step, the fat box is stretched that way
+    /// \return true if the proxy was re-inserted
+    bool MoveProxy(int proxyId, const AABB& aabb, const glm::vec3& displacement);
+
+    int GetUserData(int proxyId) const { return nodes[proxyId].userData; }
+    void SetUserData(int proxyId, int userData) { nodes[proxyId].userData = userData; }
+    const AABB& GetFatAABB(int proxyId) const { return nodes[proxyId].aabb; }
+
+    int GetHeight() const { return root == Null ? 0 : nodes[root].height; }
+
+    /// \brief Calls callback(userData) for every leaf whose fat box overlaps aabb.
+    /// Return false from the callback to stop early.
+    template <typename T>
+    void Query(const AABB& aabb, T&& callback) const;
+
+    /// Extra space around every leaf box. Zero for trees that never move
+    float margin = 0.1f;
+
+private:
+
+    struct Node
+    {
+        bool IsLeaf() const { return child1 == Null; }
+
+        AABB aabb;
+        int parent = Null;
+        int next = Null;
+        int child1 = Null;
+        int child2 = Null;
+        int height = 0;
+        int userData = -1;
+    };
+
+    int AllocateNode();
+    void FreeNode(int nodeId);
+
+    void InsertLeaf(int leaf);
+    void RemoveLeaf(int leaf);
+    int Balance(int nodeId);
+    void Refit(int nodeId);
+
+    std::vector<Node> nodes;
+    int root = Null;
+    int freeList = Null;
+};
+
+template <typename T>
+void AABBTree::Query(const AABB& aabb, T&& callback) const
+{
+    if (root == Null) return;
+
+    // Balanced trees stay far below this depth, even with millions of leaves
+    int stack[256];
+    int count = 0;
+    stack[count++] = root;
+
+    while (count > 0)
+    {
+        const Node& node = nodes[stack[--count]];
+        if (!node.aabb.Overlaps(aabb)) continue;
+
+        if (node.IsLeaf())
+        {
+            if (!callback(node.userData)) return;
+        }
+        else
+        {
+            stack[count++] = node.child1;
+            stack[count++] = node.child2;
+        }
+    }
+}
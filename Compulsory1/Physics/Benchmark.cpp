@@ -0,0 +1,378 @@
+﻿#include "Benchmark.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "glm/geometric.hpp"
+#include "../Collision.h"
+#include "JobSystem.h"
+#include "LinearBVH.h"
+#include "PhysicsWorld.h"
+#include "SceneQuery.h"
+#include "SpatialGrid.h"
+#include "ThreadPool.h"
+
+namespace
+{
+    float RandomRange(float min, float max)
+    {
+        return min + (max - min) * (rand() / (float)RAND_MAX);
+    }
+
+    /// Spheres with radius 0.1 spread so roughly a third of the candidate pairs touch
+    PhysicsWorld MakeBallPit(int bodyCount)
+    {
+        PhysicsWorld world;
+        float halfSize = std::sqrt((float)bodyCount) * 0.12f;
+        for (int i = 0; i < bodyCount; ++i)
+        {
+            world.AddBody(
+                glm::vec3(RandomRange(-halfSize, halfSize), 0.5f, RandomRange(-halfSize, halfSize)),
+                glm::vec3(RandomRange(-2.0f, 2.0f), 0.0f, RandomRange(-2.0f, 2.0f)),
+                0.1f, 1.0f);
+        }
+        return world;
+    }
+
+    std::vector<std::pair<int, int>> CandidatePairs(const PhysicsWorld& world)
+    {
+        SpatialGrid grid;
+        grid.Build(world);
+
+        std::vector<std::pair<int, int>> pairs;
+        std::vector<int> neighbours;
+        for (int i = 0; i < world.GetBodyCount(); ++i)
+        {
+            grid.Neighbours(i, i, neighbours);
+            for (int j : neighbours)
+            {
+                pairs.emplace_back(i, j);
+            }
+        }
+        return pairs;
+    }
+
+    /// Grid broadphase plus batched narrowphase over the whole world, returns seconds
+    double TimeCollisionStep(PhysicsWorld& world, Collision& collision, SpatialGrid& grid,
+        std::vector<std::pair<int, int>>& pairs, std::vector<int>& neighbours)
+    {
+        auto begin = std::chrono::high_resolution_clock::now();
+
+        grid.Build(world);
+        pairs.clear();
+        for (int i = 0; i < world.GetBodyCount(); ++i)
+        {
+            grid.Neighbours(i, i, neighbours);
+            for (int j : neighbours)
+            {
+                pairs.emplace_back(i, j);
+            }
+        }
+        collision.SphereCollisionBatch(world, pairs);
+
+        auto end = std::chrono::high_resolution_clock::now();
+        return std::chrono::duration<double>(end - begin).count();
+    }
+
+    float MaxDifference(const PhysicsWorld& a, const PhysicsWorld& b)
+    {
+        float difference = 0.0f;
+        for (int i = 0; i < a.GetBodyCount(); ++i)
+        {
+            difference = std::max(difference, glm::length(a.GetPosition(i) - b.GetPosition(i)));
+            difference = std::max(difference, glm::length(a.GetVelocity(i) - b.GetVelocity(i)));
+        }
+        return difference;
+    }
+}
+
+void RunNarrowphaseBenchmark(int bodyCount)
+{
+    srand(1234);
+    const PhysicsWorld start = MakeBallPit(bodyCount);
+    const std::vector<std::pair<int, int>> pairs = CandidatePairs(start);
+
+    // Reference result, one pair at a time
+    PhysicsWorld reference = start;
+    Collision scalar;
+    for (const std::pair<int, int>& pair : pairs)
+    {
+        scalar.SphereCollision(reference, pair.first, pair.second);
+    }
+
+    std::cout << "Narrowphase benchmark: " << bodyCount << " bodies, " << pairs.size() << " pairs, "
+        << scalar.sphereContacts << " contacts" << std::endl;
+
+    const char* names[] = { "Scalar", "SSE", "AVX2" };
+    const int repeats = 20;
+
+    for (int level = SimdScalar; level <= Collision::DetectSimdLevel(); ++level)
+    {
+        Collision batch;
+        batch.simdLevel = (SimdLevel)level;
+
+        PhysicsWorld world = start;
+        batch.SphereCollisionBatch(world, pairs);
+        float difference = MaxDifference(reference, world);
+
+        double seconds = 0.0;
+        for (int r = 0; r < repeats; ++r)
+        {
+            world = start;
+            auto begin = std::chrono::high_resolution_clock::now();
+            batch.SphereCollisionBatch(world, pairs);
+            auto end = std::chrono::high_resolution_clock::now();
+            seconds += std::chrono::duration<double>(end - begin).count();
+        }
+
+        double pairsPerSecond = (double)pairs.size() * repeats / seconds;
+        std::cout << "  " << names[level] << ": " << pairsPerSecond / 1e6 << " M pairs/s, max difference "
+            << difference << std::endl;
+    }
+
+    // Coloured parallel solve. Every thread count has to land on exactly the same state
+    PhysicsWorld parallelReference = start;
+    const int hardwareThreads = std::max(1, (int)std::thread::hardware_concurrency());
+    for (int threads = 1; threads <= hardwareThreads; threads *= 2)
+    {
+        ThreadPool pool(threads);
+        Collision parallel;
+
+        PhysicsWorld world = start;
+        parallel.SphereCollisionParallel(world, pairs, pool);
+        if (threads == 1) parallelReference = world;
+        bool deterministic = MaxDifference(parallelReference, world) == 0.0f;
+
+        double seconds = 0.0;
+        for (int r = 0; r < repeats; ++r)
+        {
+            world = start;
+            auto begin = std::chrono::high_resolution_clock::now();
+            parallel.SphereCollisionParallel(world, pairs, pool);
+            auto end = std::chrono::high_resolution_clock::now();
+            seconds += std::chrono::duration<double>(end - begin).count();
+        }
+
+        double pairsPerSecond = (double)pairs.size() * repeats / seconds;
+        std::cout << "  Parallel x" << threads << ": " << pairsPerSecond / 1e6 << " M pairs/s, "
+            << (deterministic ? "same" : "DIFFERENT") << " result as x1" << std::endl;
+    }
+}
+
+void RunReorderBenchmark(int bodyCount)
+{
+    srand(1234);
+    PhysicsWorld world = MakeBallPit(bodyCount);
+
+    Collision collision;
+    SpatialGrid grid;
+    std::vector<std::pair<int, int>> pairs;
+    std::vector<int> neighbours;
+    const int repeats = 5;
+
+    // Every run starts from the same state so only the memory order differs
+    const PhysicsWorld spawned = world;
+    double spawnOrder = 0.0;
+    for (int r = 0; r < repeats; ++r)
+    {
+        world = spawned;
+        spawnOrder += TimeCollisionStep(world, collision, grid, pairs, neighbours);
+    }
+
+    auto begin = std::chrono::high_resolution_clock::now();
+    PhysicsWorld sorted = spawned;
+    sorted.SortByMorton();
+    auto end = std::chrono::high_resolution_clock::now();
+    double sortSeconds = std::chrono::duration<double>(end - begin).count();
+
+    double mortonOrder = 0.0;
+    for (int r = 0; r < repeats; ++r)
+    {
+        world = sorted;
+        mortonOrder += TimeCollisionStep(world, collision, grid, pairs, neighbours);
+    }
+
+    std::cout << "Reorder benchmark: " << bodyCount << " bodies, " << pairs.size() << " pairs" << std::endl;
+    std::cout << "  spawn order: " << spawnOrder / repeats * 1000.0 << " ms/step" << std::endl;
+    std::cout << "  Morton order: " << mortonOrder / repeats * 1000.0 << " ms/step (sort took "
+        << sortSeconds * 1000.0 << " ms)" << std::endl;
+}
+
+void RunLinearBVHBenchmark(int bodyCount)
+{
+    srand(1234);
+    PhysicsWorld world = MakeBallPit(bodyCount);
+
+    ThreadPool pool;
+    LinearBVH bvh;
+    std::vector<std::pair<int, int>> pairs;
+    const int repeats = 5;
+
+    std::cout << "Linear BVH benchmark: " << bodyCount << " bodies, " << pool.GetThreadCount() << " threads" << std::endl;
+
+    for (int pass = 0; pass < 2; ++pass)
+    {
+        // Second pass with the bodies in Morton order, like after ReorderSpheres
+        if (pass == 1) world.SortByMorton();
+
+        // First build allocates, leave it out
+        bvh.Build(world, pool);
+
+        double buildSeconds = 0.0;
+        double pairSeconds = 0.0;
+        for (int r = 0; r < repeats; ++r)
+        {
+            auto begin = std::chrono::high_resolution_clock::now();
+            bvh.Build(world, pool);
+            auto built = std::chrono::high_resolution_clock::now();
+            bvh.FindPairs(pool, pairs);
+            auto end = std::chrono::high_resolution_clock::now();
+
+            buildSeconds += std::chrono::duration<double>(built - begin).count();
+            pairSeconds += std::chrono::duration<double>(end - built).count();
+        }
+
+        std::cout << "  " << (pass == 0 ? "spawn order: " : "Morton order: ") << buildSeconds / repeats * 1000.0
+            << " ms build, " << pairSeconds / repeats * 1000.0 << " ms for " << pairs.size() << " pairs" << std::endl;
+    }
+}
+
+void RunRaycastBenchmark(int rayCount)
+{
+    srand(1234);
+
+    // Ball pit with some crates in it, 20 by 20 units
+    SceneQuery scene;
+    for (int i = 0; i < 10000; ++i)
+    {
+        scene.AddSphere(glm::vec3(RandomRange(-10.0f, 10.0f), RandomRange(0.0f, 2.0f), RandomRange(-10.0f, 10.0f)), 0.1f, i);
+    }
+    for (int i = 0; i < 200; ++i)
+    {
+        glm::vec3 corner(RandomRange(-10.0f, 10.0f), 0.0f, RandomRange(-10.0f, 10.0f));
+        scene.AddBox(AABB(corner, corner + glm::vec3(RandomRange(0.2f, 1.0f))), i);
+    }
+    scene.Build();
+
+    // Fan of rays from an eye above one edge, looking across the pit
+    int side = std::max(1, (int)std::sqrt((float)rayCount));
+    glm::vec3 eye(0.0f, 3.0f, -12.0f);
+    std::vector<Ray> rays;
+    for (int y = 0; y < side; ++y)
+    {
+        for (int x = 0; x < side; ++x)
+        {
+            glm::vec3 target(-10.0f + 20.0f * x / side, 0.0f, -10.0f + 20.0f * y / side);
+            rays.push_back({ eye, glm::normalize(target - eye), 100.0f });
+        }
+    }
+
+    ThreadPool pool;
+    const int repeats = 10;
+    std::cout << "Raycast benchmark: " << rays.size() << " rays, " << scene.GetShapeCount() << " shapes, "
+        << pool.GetThreadCount() << " threads" << std::endl;
+
+    std::vector<RayHit> single(rays.size()), batch, parallel;
+    auto begin = std::chrono::high_resolution_clock::now();
+    for (int r = 0; r < repeats; ++r)
+    {
+        for (int i = 0; i < (int)rays.size(); ++i)
+        {
+            scene.Raycast(rays[i], single[i]);
+        }
+    }
+    auto singleEnd = std::chrono::high_resolution_clock::now();
+    for (int r = 0; r < repeats; ++r)
+    {
+        scene.RaycastBatch(rays, batch);
+    }
+    auto batchEnd = std::chrono::high_resolution_clock::now();
+    for (int r = 0; r < repeats; ++r)
+    {
+        scene.RaycastParallel(rays, parallel, pool);
+    }
+    auto parallelEnd = std::chrono::high_resolution_clock::now();
+
+    int mismatches = 0;
+    int hitCount = 0;
+    for (int i = 0; i < (int)rays.size(); ++i)
+    {
+        hitCount += single[i].shape != -1;
+        mismatches += single[i].shape != batch[i].shape || single[i].distance != batch[i].distance;
+        mismatches += single[i].shape != parallel[i].shape || single[i].distance != parallel[i].distance;
+    }
+
+    auto raysPerSecond = [&](std::chrono::high_resolution_clock::time_point from, std::chrono::high_resolution_clock::time_point to)
+    {
+        return rays.size() * repeats / std::chrono::duration<double>(to - from).count() / 1e6;
+    };
+    std::cout << "  one at a time: " << raysPerSecond(begin, singleEnd) << " Mrays/s" << std::endl;
+    std::cout << "  packets of " << SceneQuery::PacketSize << ": " << raysPerSecond(singleEnd, batchEnd) << " Mrays/s" << std::endl;
+    std::cout << "  packets on every thread: " << raysPerSecond(batchEnd, parallelEnd) << " Mrays/s" << std::endl;
+    std::cout << "  " << hitCount << " rays hit something, " << mismatches << " results differ" << std::endl;
+
+    std::vector<SphereQuery> queries;
+    for (int i = 0; i < (int)rays.size(); ++i)
+    {
+        queries.push_back({ glm::vec3(RandomRange(-10.0f, 10.0f), 1.0f, RandomRange(-10.0f, 10.0f)), 0.5f });
+    }
+
+    QueryResults serialResults, parallelResults;
+    auto overlapBegin = std::chrono::high_resolution_clock::now();
+    scene.OverlapSphereBatch(queries, serialResults);
+    auto overlapBatchEnd = std::chrono::high_resolution_clock::now();
+    scene.OverlapSphereParallel(queries, parallelResults, pool);
+    auto overlapParallelEnd = std::chrono::high_resolution_clock::now();
+
+    std::cout << "  " << queries.size() << " sphere overlaps: " << std::chrono::duration<double, std::milli>(overlapBatchEnd - overlapBegin).count()
+        << " ms batched, " << std::chrono::duration<double, std::milli>(overlapParallelEnd - overlapBatchEnd).count() << " ms on every thread, "
+        << serialResults.shapes.size() << " shapes found, results "
+        << (serialResults.shapes == parallelResults.shapes && serialResults.offsets == parallelResults.offsets ? "match" : "differ") << std::endl;
+}
+
+void RunIntegrationBenchmark(int bodyCount)
+{
+    srand(1234);
+    const PhysicsWorld start = MakeBallPit(bodyCount);
+    const int steps = 100;
+    const float deltaTime = 1.0f / 120.0f;
+
+    std::cout << "Integration benchmark: " << bodyCount << " bodies, " << steps << " steps" << std::endl;
+
+    PhysicsWorld reference = start;
+    double singleThread = 0.0;
+    // More threads than cores only measures the scheduler. Doubles up to the core count and always
+    // ends on it, so 6 cores runs x1, x2, x4 and x6
+    const int hardwareThreads = std::max(1, (int)std::thread::hardware_concurrency());
+    for (int threads = 1; threads <= hardwareThreads;
+        threads = threads < hardwareThreads ? std::min(threads * 2, hardwareThreads) : threads + 1)
+    {
+        JobSystem jobs(threads);
+        PhysicsWorld world = start;
+
+        auto begin = std::chrono::high_resolution_clock::now();
+        for (int step = 0; step < steps; ++step)
+        {
+            world.SavePreviousPositions(jobs);
+            world.Integrate(deltaTime, jobs);
+        }
+        auto end = std::chrono::high_resolution_clock::now();
+        double seconds = std::chrono::duration<double>(end - begin).count();
+
+        if (threads == 1)
+        {
+            reference = world;
+            singleThread = seconds;
+        }
+        bool same = MaxDifference(reference, world) == 0.0f;
+
+        std::cout << "  x" << threads << ": " << (double)bodyCount * steps / seconds / 1e6 << " M bodies/s, "
+            << singleThread / seconds << "x speedup, " << (same ? "same" : "DIFFERENT") << " result as x1" << std::endl;
+    }
+}
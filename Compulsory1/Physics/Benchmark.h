@@ -0,0 +1,27 @@
+﻿#pragma once
+
+/// \brief Batched narrowphase throughput for every instruction set the CPU supports.
+/// Also checks each one against Collision::SphereCollision and prints the largest difference, then
+/// times Collision::SphereCollisionParallel for 1, 2, 4... threads and checks they all agree.
+/// \param bodyCount spheres packed into the test box
+void RunNarrowphaseBenchmark(int bodyCount);
+
+/// \brief Times one grid broadphase plus narrowphase step over a ball pit in spawn order, then again
+/// after PhysicsWorld::SortByMorton, to show what memory order costs.
+/// \param bodyCount spheres packed into the test box
+void RunReorderBenchmark(int bodyCount);
+
+/// \brief Times LinearBVH::Build and FindPairs on every hardware thread, with the bodies in spawn
+/// order and again in Morton order.
+/// \param bodyCount spheres packed into the test box
+void RunLinearBVHBenchmark(int bodyCount);
+
+/// \brief Times SceneQuery rays one at a time, as packets and as packets on every thread, over a field
+/// of spheres and boxes, and checks all three find the same hits. Then does the same for sphere overlaps.
+/// \param rayCount rays fanned out from one eye point, like a picking or visibility pass
+void RunRaycastBenchmark(int rayCount);
+
+/// \brief Times PhysicsWorld::Integrate on a JobSystem of 1, 2, 4... threads up to the hardware thread
+/// count, prints the speedup over 1 thread and checks they all agree.
+/// \param bodyCount spheres packed into the test box
+void RunIntegrationBenchmark(int bodyCount);
@@ -0,0 +1,120 @@
+﻿#include "BoundingSphere.h"
+
+#include <algorithm>
+#include <cmath>
+#include <random>
+
+#include <glm/geometric.hpp>
+#include <glm/mat3x3.hpp>
+#include <glm/matrix.hpp>
+
+namespace
+{
+    // Relative slack when testing if a point is inside, the spheres below are built from rounded floats
+    const float ContainsTolerance = 1e-5f;
+
+    BoundingSphere FromTwo(const glm::vec3& a, const glm::vec3& b)
+    {
+        return BoundingSphere((a + b) * 0.5f, glm::length(b - a) * 0.5f);
+    }
+
+    /// \brief Smallest sphere with a, b and c on its surface, which is the one through their circumcircle
+    BoundingSphere FromThree(const glm::vec3& a, const glm::vec3& b, const glm::vec3& c)
+    {
+        glm::vec3 ab = b - a;
+        glm::vec3 ac = c - a;
+        glm::vec3 normal = glm::cross(ab, ac);
+        float denominator = 2.0f * glm::dot(normal, normal);
+
+        // On one line, the two furthest apart decide
+        if (denominator < 1e-12f)
+        {
+            BoundingSphere best = FromTwo(a, b);
+            BoundingSphere other = FromTwo(a, c);
+            if (other.radius > best.radius) best = other;
+            other = FromTwo(b, c);
+            if (other.radius > best.radius) best = other;
+            return best;
+        }
+
+        glm::vec3 offset = (glm::cross(normal, ab) * glm::dot(ac, ac) + glm::cross(ac, normal) * glm::dot(ab, ab)) / denominator;
+        return BoundingSphere(a + offset, glm::length(offset));
+    }
+
+    /// \brief Sphere through all four points
+    /// \return false if they lie in one plane
+    bool FromFour(const glm::vec3& a, const glm::vec3& b, const glm::vec3& c, const glm::vec3& d, BoundingSphere& sphere)
+    {
+        // Rows are the edges from a, the centre is equally far from all four
+        glm::mat3 edges = glm::transpose(glm::mat3(b - a, c - a, d - a));
+        float determinant = glm::determinant(edges);
+        if (std::fabs(determinant) < 1e-12f) return false;
+
+        glm::vec3 lengths(glm::dot(b - a, b - a), glm::dot(c - a, c - a), glm::dot(d - a, d - a));
+        glm::vec3 offset = glm::inverse(edges) * (lengths * 0.5f);
+        sphere = BoundingSphere(a + offset, glm::length(offset));
+        return true;
+    }
+
+    /// \brief Grows sphere just enough to also hold point, used when the exact construction is degenerate
+    void Grow(BoundingSphere& sphere, const glm::vec3& point)
+    {
+        glm::vec3 offset = point - sphere.center;
+        float distance = glm::length(offset);
+        if (distance <= sphere.radius) return;
+
+        float radius = (sphere.radius + distance) * 0.5f;
+        sphere.center += offset * ((radius - sphere.radius) / distance);
+        sphere.radius = radius;
+    }
+}
+
+bool BoundingSphere::Contains(const glm::vec3& point) const
+{
+    glm::vec3 offset = point - center;
+    float limit = radius * (1.0f + ContainsTolerance) + ContainsTolerance;
+    return glm::dot(offset, offset) <= limit * limit;
+}
+
+BoundingSphere BoundingSphere::Minimal(const std::vector<glm::vec3>& points)
+{
+    if (points.empty()) return BoundingSphere();
+
+    std::vector<glm::vec3> shuffled = points;
+    std::mt19937 random(12345);
+    std::shuffle(shuffled.begin(), shuffled.end(), random);
+
+    const int count = (int)shuffled.size();
+    BoundingSphere sphere(shuffled[0], 0.0f);
+
+    // Each loop keeps one more point on the surface of the sphere it is growing
+    for (int i = 1; i < count; ++i)
+    {
+        if (sphere.Contains(shuffled[i])) continue;
+
+        sphere = BoundingSphere(shuffled[i], 0.0f);
+        for (int j = 0; j < i; ++j)
+        {
+            if (sphere.Contains(shuffled[j])) continue;
+
+            sphere = FromTwo(shuffled[i], shuffled[j]);
+            for (int k = 0; k < j; ++k)
+            {
+                if (sphere.Contains(shuffled[k])) continue;
+
+                sphere = FromThree(shuffled[i], shuffled[j], shuffled[k]);
+                for (int l = 0; l < k; ++l)
+                {
+                    if (sphere.Contains(shuffled[l])) continue;
+
+                    if (!FromFour(shuffled[i], shuffled[j], shuffled[k], shuffled[l], sphere))
+                    {
+                        Grow(sphere, shuffled[l]);
+                    }
+                }
+            }
+        }
+    }
+
+    return sphere;
+}
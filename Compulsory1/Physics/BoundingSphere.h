@@ -0,0 +1,20 @@
+﻿#pragma once
+#include <vector>
+#include "glm/vec3.hpp"
+
+/// \brief Sphere around a set of points, see BoundingSphere.cpp
+struct BoundingSphere
+{
+    BoundingSphere() : center(0.0f), radius(0.0f) {}
+    BoundingSphere(const glm::vec3& center, float radius) : center(center), radius(radius) {}
+
+    glm::vec3 center;
+    float radius;
+
+    bool Contains(const glm::vec3& point) const;
+
+    /// \brief Smallest sphere around every point, Welzl's algorithm done as the usual nested loops
+    /// over a shuffled copy so there is no deep recursion. Expected linear time, the shuffle has a
+    /// fixed seed so the same points always give the same sphere.
+    static BoundingSphere Minimal(const std::vector<glm::vec3>& points);
+};
@@ -0,0 +1,137 @@
+﻿#include "CollisionEvents.h"
+
+#include <chrono>
+#include <cstdint>
+#include <ostream>
+
+namespace
+{
+    // Lets Push and Pop wrap with a mask instead of a division
+    size_t RoundUpToPowerOfTwo(int value)
+    {
+        size_t size = 1;
+        while (size < (size_t)value) size <<= 1;
+        return size;
+    }
+}
+
+CollisionEventRing::CollisionEventRing(int capacity) : slots(RoundUpToPowerOfTwo(capacity))
+{
+    mask = slots.size() - 1;
+    for (size_t i = 0; i < slots.size(); ++i)
+    {
+        slots[i].sequence.store(i, std::memory_order_relaxed);
+    }
+}
+
+CollisionEventRing::~CollisionEventRing()
+{
+    StopLogging();
+}
+
+bool CollisionEventRing::Push(const CollisionEvent& event)
+{
+    size_t position = tail.load(std::memory_order_relaxed);
+    for (;;)
+    {
+        Slot& slot = slots[position & mask];
+        size_t sequence = slot.sequence.load(std::memory_order_acquire);
+        intptr_t difference = (intptr_t)sequence - (intptr_t)position;
+
+        if (difference == 0)
+        {
+            // Slot is free for this lap, claim it unless another producer got there first
+            if (tail.compare_exchange_weak(position, position + 1, std::memory_order_relaxed))
+            {
+                slot.event = event;
+                slot.sequence.store(position + 1, std::memory_order_release);
+                return true;
+            }
+        }
+        else if (difference < 0)
+        {
+            // The consumer hasn't got to this slot since the last lap
+            dropped.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+        else
+        {
+            position = tail.load(std::memory_order_relaxed);
+        }
+    }
+}
+
+bool CollisionEventRing::Pop(CollisionEvent& event)
+{
+    size_t position = head.load(std::memory_order_relaxed);
+    for (;;)
+    {
+        Slot& slot = slots[position & mask];
+        size_t sequence = slot.sequence.load(std::memory_order_acquire);
+        intptr_t difference = (intptr_t)sequence - (intptr_t)(position + 1);
+
+        if (difference == 0)
+        {
+            if (head.compare_exchange_weak(position, position + 1, std::memory_order_relaxed))
+            {
+                event = slot.event;
+                // Hand the slot back to producers for the next lap
+                slot.sequence.store(position + mask + 1, std::memory_order_release);
+                return true;
+            }
+        }
+        else if (difference < 0)
+        {
+            return false;
+        }
+        else
+        {
+            position = head.load(std::memory_order_relaxed);
+        }
+    }
+}
+
+void CollisionEventRing::Clear()
+{
+    CollisionEvent event;
+    while (Pop(event)) {}
+}
+
+void CollisionEventRing::StartLogging(std::ostream& stream)
+{
+    if (logging) return;
+
+    logging = true;
+    logger = std::thread(&CollisionEventRing::LogLoop, this, &stream);
+}
+
+void CollisionEventRing::StopLogging()
+{
+    if (!logging) return;
+
+    logging = false;
+    logger.join();
+}
+
+void CollisionEventRing::LogLoop(std::ostream* stream)
+{
+    CollisionEvent event;
+    for (;;)
+    {
+        // Read before draining, so whatever was pushed before StopLogging still gets written
+        bool stop = !logging;
+
+        int written = 0;
+        while (Pop(event))
+        {
+            if (event.body2 < 0) *stream << "Sphere AABB Collision detected: " << event.body1;
+            else *stream << "Sphere Collision detected: " << event.body1 << " " << event.body2;
+            *stream << " depth " << event.depth << " impulse " << event.impulse << '\n';
+            written++;
+        }
+
+        if (written > 0) stream->flush();
+        if (stop) return;
+        if (written == 0) std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+}
@@ -0,0 +1,78 @@
+﻿#pragma once
+#include <atomic>
+#include <cstddef>
+#include <iosfwd>
+#include <thread>
+#include <vector>
+#include "glm/vec3.hpp"
+
+/// \brief One resolved contact
+struct CollisionEvent
+{
+    int body1;
+    // Other sphere, or -1 for a wall
+    int body2;
+    // Points from body2 towards body1
+    glm::vec3 normal;
+    float depth;
+    // Size of the impulse along normal, 0 if they were already moving apart
+    float impulse;
+};
+
+/// \brief Bounded multi producer, multi consumer queue of collision events.
+/// All memory is allocated up front, so pushing from the solver (or from several solver threads at once)
+/// never allocates, locks or does I/O. When it is full new events are dropped and counted instead.
+/// Game code can Pop events itself, or StartLogging can drain them to a stream on a thread of its own.
+class CollisionEventRing
+{
+public:
+
+    /// \param capacity rounded up to a power of two
+    explicit CollisionEventRing(int capacity = 4096);
+    ~CollisionEventRing();
+
+    CollisionEventRing(const CollisionEventRing&) = delete;
+    CollisionEventRing& operator=(const CollisionEventRing&) = delete;
+
+    /// \return false if the ring was full and the event was dropped
+    bool Push(const CollisionEvent& event);
+
+    /// \return false if there was nothing to take
+    bool Pop(CollisionEvent& event);
+
+    /// \brief Throws away everything queued
+    void Clear();
+
+    /// \brief Writes every event to stream from a background thread until StopLogging.
+    /// Nothing else should Pop while it runs
+    void StartLogging(std::ostream& stream);
+    void StopLogging();
+
+    bool IsLogging() const { return logging; }
+
+    int GetCapacity() const { return (int)slots.size(); }
+
+    // Events lost because the ring was full, since the start
+    std::atomic<long long> dropped{0};
+
+private:
+
+    void LogLoop(std::ostream* stream);
+
+    struct Slot
+    {
+        // Which lap of the ring the slot is ready for, see Push and Pop
+        std::atomic<size_t> sequence;
+        CollisionEvent event;
+    };
+
+    std::vector<Slot> slots;
+    size_t mask;
+
+    // Producers and consumers live on separate cache lines so they don't slow each other down
+    alignas(64) std::atomic<size_t> head{0};
+    alignas(64) std::atomic<size_t> tail{0};
+
+    std::thread logger;
+    std::atomic<bool> logging{false};
+};
@@ -0,0 +1,57 @@
+﻿#include "ContactColoring.h"
+
+ContactColoring::ContactColoring()
+{
+
+}
+
+void ContactColoring::Build(const std::vector<std::pair<int, int>>& pairs, int bodyCount)
+{
+    const int pairCount = (int)pairs.size();
+
+    bodyColors.assign(bodyCount, 0);
+    pairColor.resize(pairCount);
+
+    int colorCount = 0;
+    hasSerialColor = false;
+
+    for (int p = 0; p < pairCount; ++p)
+    {
+        uint64_t used = bodyColors[pairs[p].first] | bodyColors[pairs[p].second];
+        if (used == ~(uint64_t)0)
+        {
+            // Both bodies are in so many contacts that every colour is taken
+            pairColor[p] = MaxColors;
+            hasSerialColor = true;
+            continue;
+        }
+
+        // Lowest colour neither body is using yet
+        int color = 0;
+        while (used & ((uint64_t)1 << color)) color++;
+
+        pairColor[p] = color;
+        bodyColors[pairs[p].first] |= (uint64_t)1 << color;
+        bodyColors[pairs[p].second] |= (uint64_t)1 << color;
+        if (color + 1 > colorCount) colorCount = color + 1;
+    }
+
+    // Counting sort by colour, keeps the input order inside each colour
+    const int buckets = hasSerialColor ? MaxColors + 1 : colorCount;
+    colorStart.assign(buckets + 1, 0);
+    for (int p = 0; p < pairCount; ++p)
+    {
+        colorStart[pairColor[p] + 1]++;
+    }
+    for (int c = 0; c < buckets; ++c)
+    {
+        colorStart[c + 1] += colorStart[c];
+    }
+
+    sorted.resize(pairCount);
+    std::vector<int> cursor(colorStart.begin(), colorStart.end() - 1);
+    for (int p = 0; p < pairCount; ++p)
+    {
+        sorted[cursor[pairColor[p]]++] = pairs[p];
+    }
+}
@@ -0,0 +1,39 @@
+﻿#pragma once
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+/// \brief Splits a contact pair list into colours where no two pairs of the same colour share a body.
+/// Pairs of one colour can then be solved at the same time on different threads without locking.
+/// Colours are handed out greedily in pair order, so the result only depends on the input list.
+class ContactColoring
+{
+public:
+
+    ContactColoring();
+
+    /// \param pairs body index pairs, every index must be below bodyCount
+    void Build(const std::vector<std::pair<int, int>>& pairs, int bodyCount);
+
+    int GetColorCount() const { return (int)colorStart.size() - 1; }
+
+    /// \brief Pairs of one colour, in the order they had in the input list
+    const std::pair<int, int>* GetColorPairs(int color) const { return sorted.data() + colorStart[color]; }
+    int GetColorSize(int color) const { return colorStart[color + 1] - colorStart[color]; }
+
+    /// Colours a body can be part of before its remaining pairs go to the last, serial colour
+    static const int MaxColors = 64;
+
+    /// True if the last colour holds overflow pairs that may share bodies and has to run on one thread
+    bool HasSerialColor() const { return hasSerialColor; }
+
+private:
+
+    // Bit c is set if the body already has a pair of colour c
+    std::vector<uint64_t> bodyColors;
+    std::vector<int> pairColor;
+
+    std::vector<std::pair<int, int>> sorted;
+    std::vector<int> colorStart;
+    bool hasSerialColor = false;
+};
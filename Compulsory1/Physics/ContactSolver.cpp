@@ -0,0 +1,349 @@
+﻿#include "ContactSolver.h"
+
+#include <algorithm>
+#include <cmath>
+
+#include "glm/geometric.hpp"
+#include "../Collision.h"
+#include "CollisionEvents.h"
+#include "PhysicsWorld.h"
+
+ContactSolver::ContactSolver()
+{
+
+}
+
+uint64_t ContactSolver::PairKey(int a, int b)
+{
+    if (a > b) std::swap(a, b);
+    return ((uint64_t)(uint32_t)a << 32) | (uint32_t)b;
+}
+
+uint64_t ContactSolver::WallKey(int body, int wall)
+{
+    return ((uint64_t)(uint32_t)body << 32) | (uint32_t)wall;
+}
+
+bool ContactSolver::Prepare(PhysicsWorld& world, Contact& contact)
+{
+    const int body1 = contact.body1;
+    const int body2 = contact.body2;
+
+    glm::vec3 velocity2 = body2 >= 0 ? world.GetVelocity(body2) : glm::vec3(0.0f);
+    float velocityAlongNormal = glm::dot(world.GetVelocity(body1) - velocity2, contact.normal);
+
+    // Something ran into a sleeping sphere hard enough to move it. A gentler touch leaves it asleep
+    // and solid, otherwise resting on a settled pile would keep waking it
+    bool hit = velocityAlongNormal < -world.sleepVelocity;
+    if (hit) world.WakeBody(body1);
+    if (hit && body2 >= 0) world.WakeBody(body2);
+
+    bool moves1 = world.IsAwake(body1);
+    bool moves2 = body2 >= 0 && world.IsAwake(body2);
+    contact.invMass1 = moves1 ? world.invMass[body1] : 0.0f;
+    contact.invMass2 = moves2 ? world.invMass[body2] : 0.0f;
+    contact.invInertia1 = moves1 ? world.invInertiaX[body1] : 0.0f;
+    contact.invInertia2 = moves2 ? world.invInertiaX[body2] : 0.0f;
+
+    float invMassSum = contact.invMass1 + contact.invMass2;
+    if (invMassSum <= 0.0f) return false;
+
+    // Both contact points sit on the line between the centres, so the normal impulse never turns a sphere.
+    // Spheres have the same inertia about every axis, so one number per body covers the sliding direction
+    float radius1 = world.radius[body1];
+    float radius2 = body2 >= 0 ? world.radius[body2] : 0.0f;
+    contact.arm1 = -contact.normal * radius1;
+    contact.arm2 = contact.normal * radius2;
+
+    contact.normalMass = 1.0f / invMassSum;
+    contact.tangentMass = 1.0f / (invMassSum + contact.invInertia1 * radius1 * radius1 + contact.invInertia2 * radius2 * radius2);
+    float invInertiaSum = contact.invInertia1 + contact.invInertia2;
+    contact.angularMass = invInertiaSum > 0.0f ? 1.0f / invInertiaSum : 0.0f;
+    contact.rollingLimit = rollingFriction * (body2 >= 0 ? std::min(radius1, radius2) : radius1);
+
+    // Bounce off the speed they came in with, before any impulse this step
+    contact.targetVelocity = velocityAlongNormal < -restitutionThreshold ? -restitution * velocityAlongNormal : 0.0f;
+    return true;
+}
+
+glm::vec3 ContactSolver::ContactVelocity(const PhysicsWorld& world, const Contact& contact) const
+{
+    glm::vec3 velocity = world.GetVelocity(contact.body1) + glm::cross(world.GetAngularVelocity(contact.body1), contact.arm1);
+    if (contact.body2 >= 0)
+    {
+        velocity -= world.GetVelocity(contact.body2) + glm::cross(world.GetAngularVelocity(contact.body2), contact.arm2);
+    }
+    return velocity;
+}
+
+void ContactSolver::ApplyImpulse(PhysicsWorld& world, const Contact& contact, const glm::vec3& impulse)
+{
+    // Written straight into the arrays, Prepare already decided who is awake
+    glm::vec3 linear = impulse * contact.invMass1;
+    glm::vec3 angular = glm::cross(contact.arm1, impulse) * contact.invInertia1;
+    world.velX[contact.body1] += linear.x;
+    world.velY[contact.body1] += linear.y;
+    world.velZ[contact.body1] += linear.z;
+    world.angVelX[contact.body1] += angular.x;
+    world.angVelY[contact.body1] += angular.y;
+    world.angVelZ[contact.body1] += angular.z;
+
+    if (contact.body2 < 0) return;
+
+    linear = impulse * contact.invMass2;
+    angular = glm::cross(contact.arm2, impulse) * contact.invInertia2;
+    world.velX[contact.body2] -= linear.x;
+    world.velY[contact.body2] -= linear.y;
+    world.velZ[contact.body2] -= linear.z;
+    world.angVelX[contact.body2] -= angular.x;
+    world.angVelY[contact.body2] -= angular.y;
+    world.angVelZ[contact.body2] -= angular.z;
+}
+
+void ContactSolver::ApplyAngularImpulse(PhysicsWorld& world, const Contact& contact, const glm::vec3& impulse)
+{
+    world.angVelX[contact.body1] += impulse.x * contact.invInertia1;
+    world.angVelY[contact.body1] += impulse.y * contact.invInertia1;
+    world.angVelZ[contact.body1] += impulse.z * contact.invInertia1;
+
+    if (contact.body2 < 0) return;
+
+    world.angVelX[contact.body2] -= impulse.x * contact.invInertia2;
+    world.angVelY[contact.body2] -= impulse.y * contact.invInertia2;
+    world.angVelZ[contact.body2] -= impulse.z * contact.invInertia2;
+}
+
+int ContactSolver::Solve(PhysicsWorld& world, const std::vector<std::pair<int, int>>& pairs)
+{
+    static const std::vector<std::pair<int, int>> noWallPairs;
+    static const std::vector<OBB> noWalls;
+    return Solve(world, pairs, noWallPairs, noWalls);
+}
+
+int ContactSolver::Solve(PhysicsWorld& world, const std::vector<std::pair<int, int>>& pairs,
+    const std::vector<std::pair<int, int>>& wallPairs, const std::vector<OBB>& walls)
+{
+    contacts.clear();
+    WakeSupported(world, pairs);
+
+    for (const std::pair<int, int>& pair : pairs)
+    {
+        int body1 = pair.first;
+        int body2 = pair.second;
+
+        glm::vec3 offset = world.GetPosition(body1) - world.GetPosition(body2);
+        float distanceSq = offset.x * offset.x + offset.y * offset.y + offset.z * offset.z;
+        float sumRadius = world.radius[body1] + world.radius[body2];
+        if (distanceSq >= sumRadius * sumRadius) continue;
+
+        float distance = std::sqrt(distanceSq);
+        Contact contact;
+        contact.body1 = body1;
+        contact.body2 = body2;
+        contact.wall = -1;
+        // Same direction as Collision::SphereCollision, any axis will do for spheres on top of each other
+        contact.normal = distance > 0.0f ? offset / distance : glm::vec3(0.0f, 1.0f, 0.0f);
+        contact.penetration = sumRadius - distance;
+        if (!Prepare(world, contact)) continue;
+
+        auto cached = cache.find(PairKey(body1, body2));
+        contact.impulse = cached != cache.end() ? cached->second.normal : 0.0f;
+        contact.tangentImpulse = cached != cache.end() ? cached->second.tangent : glm::vec3(0.0f);
+
+        // The cache keeps the lower body first, flip the friction if this pair came the other way round
+        if (body1 > body2) contact.tangentImpulse = -contact.tangentImpulse;
+
+        contacts.push_back(contact);
+    }
+
+    for (const std::pair<int, int>& pair : wallPairs)
+    {
+        Contact contact;
+        contact.body1 = pair.first;
+        contact.body2 = -1;
+        contact.wall = pair.second;
+        if (!Collision::SphereOBBContact(world.GetPosition(pair.first), world.radius[pair.first], walls[pair.second],
+            contact.normal, contact.penetration)) continue;
+        if (!Prepare(world, contact)) continue;
+
+        auto cached = wallCache.find(WallKey(pair.first, pair.second));
+        contact.impulse = cached != wallCache.end() ? cached->second.normal : 0.0f;
+        contact.tangentImpulse = cached != wallCache.end() ? cached->second.tangent : glm::vec3(0.0f);
+
+        contacts.push_back(contact);
+    }
+
+    // The terrain finds its own triangles from the position, so every awake sphere is simply asked
+    const int activeCount = terrain ? world.GetActiveCount() : 0;
+    for (int a = 0; a < activeCount; ++a)
+    {
+        Contact contact;
+        contact.body1 = world.activeBodies[a];
+        contact.body2 = -1;
+        contact.wall = -1;
+        if (!Collision::SphereSurfaceContact(world.GetPosition(contact.body1), world.radius[contact.body1], *terrain,
+            contact.normal, contact.penetration)) continue;
+        if (!Prepare(world, contact)) continue;
+
+        auto cached = wallCache.find(WallKey(contact.body1, -1));
+        contact.impulse = cached != wallCache.end() ? cached->second.normal : 0.0f;
+        contact.tangentImpulse = cached != wallCache.end() ? cached->second.tangent : glm::vec3(0.0f);
+
+        contacts.push_back(contact);
+    }
+
+    // Warm start, last step's impulses are usually most of the answer for a resting pile.
+    // The friction is only kept for the part that still lies along the contact plane
+    for (Contact& contact : contacts)
+    {
+        contact.tangentImpulse -= contact.normal * glm::dot(contact.tangentImpulse, contact.normal);
+        glm::vec3 impulse = contact.normal * contact.impulse + contact.tangentImpulse;
+        if (impulse != glm::vec3(0.0f)) ApplyImpulse(world, contact, impulse);
+    }
+
+    std::vector<glm::vec3> rollingImpulses(contacts.size(), glm::vec3(0.0f));
+
+    for (int iteration = 0; iteration < iterations; ++iteration)
+    {
+        for (int c = 0; c < (int)contacts.size(); ++c)
+        {
+            Contact& contact = contacts[c];
+
+            // Clamp the total, not the change, so a later pass can take back what an earlier one overdid
+            float velocityAlongNormal = glm::dot(ContactVelocity(world, contact), contact.normal);
+            float impulse = contact.normalMass * (contact.targetVelocity - velocityAlongNormal);
+            float accumulated = std::max(contact.impulse + impulse, 0.0f);
+            impulse = accumulated - contact.impulse;
+            contact.impulse = accumulated;
+            if (impulse != 0.0f) ApplyImpulse(world, contact, contact.normal * impulse);
+
+            // Stop the sliding at the contact point, but never push harder than the cone allows
+            glm::vec3 velocity = ContactVelocity(world, contact);
+            glm::vec3 sliding = velocity - contact.normal * glm::dot(velocity, contact.normal);
+            glm::vec3 tangentImpulse = contact.tangentImpulse - sliding * contact.tangentMass;
+            float maxFriction = friction * contact.impulse;
+            float tangentLengthSq = glm::dot(tangentImpulse, tangentImpulse);
+            if (tangentLengthSq > maxFriction * maxFriction)
+            {
+                tangentImpulse *= maxFriction / std::sqrt(tangentLengthSq);
+            }
+            glm::vec3 tangentChange = tangentImpulse - contact.tangentImpulse;
+            contact.tangentImpulse = tangentImpulse;
+            if (tangentChange != glm::vec3(0.0f)) ApplyImpulse(world, contact, tangentChange);
+
+            // Rolling friction works on the difference in spin the same way
+            if (contact.angularMass > 0.0f)
+            {
+                glm::vec3 spin = world.GetAngularVelocity(contact.body1);
+                if (contact.body2 >= 0) spin -= world.GetAngularVelocity(contact.body2);
+
+                glm::vec3 rolling = rollingImpulses[c] - spin * contact.angularMass;
+                float maxRolling = contact.rollingLimit * contact.impulse;
+                float rollingLengthSq = glm::dot(rolling, rolling);
+                if (rollingLengthSq > maxRolling * maxRolling)
+                {
+                    rolling *= maxRolling / std::sqrt(rollingLengthSq);
+                }
+                glm::vec3 rollingChange = rolling - rollingImpulses[c];
+                rollingImpulses[c] = rolling;
+                if (rollingChange != glm::vec3(0.0f)) ApplyAngularImpulse(world, contact, rollingChange);
+            }
+        }
+    }
+
+    // Overlap is pushed out by moving the bodies, like Collision::SphereCollision does, so it never turns into speed
+    for (const Contact& contact : contacts)
+    {
+        float correction = std::max(contact.penetration - slop, 0.0f) * positionCorrection * contact.normalMass;
+        glm::vec3 offset = contact.normal * correction;
+
+        world.posX[contact.body1] += offset.x * contact.invMass1;
+        world.posY[contact.body1] += offset.y * contact.invMass1;
+        world.posZ[contact.body1] += offset.z * contact.invMass1;
+        if (contact.body2 < 0) continue;
+
+        world.posX[contact.body2] -= offset.x * contact.invMass2;
+        world.posY[contact.body2] -= offset.y * contact.invMass2;
+        world.posZ[contact.body2] -= offset.z * contact.invMass2;
+    }
+
+    // Pairs that stopped touching drop out of the cache here
+    cache.swap(previousCache);
+    cache.clear();
+    wallCache.clear();
+    for (const Contact& contact : contacts)
+    {
+        if (contact.body2 >= 0)
+        {
+            glm::vec3 tangent = contact.body1 > contact.body2 ? -contact.tangentImpulse : contact.tangentImpulse;
+            cache[PairKey(contact.body1, contact.body2)] = { contact.impulse, tangent };
+        }
+        else
+        {
+            wallCache[WallKey(contact.body1, contact.wall)] = { contact.impulse, contact.tangentImpulse };
+        }
+        if (events) events->Push({ contact.body1, contact.body2, contact.normal, contact.penetration, contact.impulse });
+    }
+
+    // A sleeper whose awake support moved away this step would hang in the air, let it fall.
+    // Pairs that both fell asleep drop out of the cache too, but those two still touch
+    for (const std::pair<const uint64_t, CachedImpulse>& entry : previousCache)
+    {
+        int a = (int)(entry.first >> 32);
+        int b = (int)(uint32_t)entry.first;
+        if (world.IsAwake(a) == world.IsAwake(b) || cache.count(entry.first)) continue;
+        world.WakeBody(world.IsAwake(a) ? b : a);
+    }
+
+    return (int)contacts.size();
+}
+
+void ContactSolver::WakeSupported(PhysicsWorld& world, const std::vector<std::pair<int, int>>& pairs)
+{
+    // Only bodies that moved last step pass it on, so a ball resting on a settled pile doesn't keep the pile awake.
+    // Everything is decided before anyone wakes, so the wake spreads one contact per step whatever the pair order
+    wokenBodies.clear();
+    for (const std::pair<int, int>& pair : pairs)
+    {
+        if (world.IsAwake(pair.first) == world.IsAwake(pair.second)) continue;
+
+        int sleeper = world.IsAwake(pair.first) ? pair.second : pair.first;
+        int mover = sleeper == pair.first ? pair.second : pair.first;
+        if (world.slowSteps[mover] != 0) continue;
+
+        glm::vec3 offset = world.GetPosition(pair.first) - world.GetPosition(pair.second);
+        float sumRadius = world.radius[pair.first] + world.radius[pair.second];
+        if (glm::dot(offset, offset) < sumRadius * sumRadius) wokenBodies.push_back(sleeper);
+    }
+
+    for (int body : wokenBodies)
+    {
+        world.WakeBody(body);
+    }
+}
+
+void ContactSolver::RemapBodies(const std::vector<int>& oldToNew)
+{
+    // Friction is stored for the lower body first, which may not be the lower one any more
+    std::unordered_map<uint64_t, CachedImpulse> remapped;
+    remapped.reserve(cache.size());
+    for (const std::pair<const uint64_t, CachedImpulse>& entry : cache)
+    {
+        int a = oldToNew[(int)(entry.first >> 32)];
+        int b = oldToNew[(int)(uint32_t)entry.first];
+        CachedImpulse impulse = entry.second;
+        if (a > b) impulse.tangent = -impulse.tangent;
+        remapped[PairKey(a, b)] = impulse;
+    }
+    cache.swap(remapped);
+
+    std::unordered_map<uint64_t, CachedImpulse> remappedWalls;
+    remappedWalls.reserve(wallCache.size());
+    for (const std::pair<const uint64_t, CachedImpulse>& entry : wallCache)
+    {
+        int body = oldToNew[(int)(entry.first >> 32)];
+        int wall = (int)(uint32_t)entry.first;
+        remappedWalls[WallKey(body, wall)] = entry.second;
+    }
+    wallCache.swap(remappedWalls);
+}
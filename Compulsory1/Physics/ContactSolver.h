@@ -0,0 +1,127 @@
+﻿#pragma once
+#include <cstdint>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include "glm/vec3.hpp"
+#include "OBB.h"
+
+class CollisionEventRing;
+class PhysicsWorld;
+class Surface;
+
+/// \brief Iterative sequential impulse solver for sphere contacts, with each other and with static boxes.
+/// The impulses each touching pair ended up with are cached by pair and applied again at the start of the
+/// next step, so piles start close to the answer and settle in a few iterations instead of jittering.
+/// Friction is a Coulomb cone: the sliding impulse is clamped to friction times the normal impulse, and
+/// it acts at the contact point, so it also sets the spheres rolling. Rolling friction slows the spin
+/// the same way, so a ball on the floor stops and can fall asleep.
+/// A sleeping sphere is woken by a contact coming in faster than PhysicsWorld::sleepVelocity, by touching a
+/// body that moved last step, or by losing the contact with an awake body it rested on. Otherwise it is
+/// solved as if it couldn't move, so a settled pile stays asleep under a resting ball.
+class ContactSolver
+{
+public:
+
+    ContactSolver();
+
+    /// \brief Finds which of pairs touch and solves them together, warm started from the last call
+    /// \param pairs candidate pairs from the broadphase, in any order
+    /// \return number of pairs in contact
+    int Solve(PhysicsWorld& world, const std::vector<std::pair<int, int>>& pairs);
+
+    /// \brief Same, with contacts against static boxes solved in the same passes
+    /// \param wallPairs candidate (body, index into walls) pairs
+    /// \return number of sphere and wall pairs in contact
+    int Solve(PhysicsWorld& world, const std::vector<std::pair<int, int>>& pairs,
+        const std::vector<std::pair<int, int>>& wallPairs, const std::vector<OBB>& walls);
+
+    /// \brief Renames the bodies in the cache after PhysicsWorld::SortByMorton
+    void RemapBodies(const std::vector<int>& oldToNew);
+
+    void Clear() { cache.clear(); wallCache.clear(); }
+
+    /// Passes over all contacts per step
+    int iterations = 8;
+
+    /// Bounciness, 1 like Collision::SphereCollision
+    float restitution = 1.0f;
+
+    /// Slower impacts than this don't bounce, so resting spheres can settle
+    float restitutionThreshold = 0.2f;
+
+    /// Coulomb friction, the sliding impulse is at most this times the normal impulse
+    float friction = 0.4f;
+
+    /// Spin impulse is at most this times the normal impulse and the radius
+    float rollingFriction = 0.05f;
+
+    /// Fraction of the overlap pushed out per step, and overlap that is left alone so resting contacts persist
+    float positionCorrection = 0.8f;
+    float slop = 0.005f;
+
+    /// Where each solved contact is reported, nothing is reported if null
+    CollisionEventRing* events = nullptr;
+
+    /// Heightfield every awake sphere is tested against along with the walls, none if null
+    const Surface* terrain = nullptr;
+
+private:
+
+    struct Contact
+    {
+        int body1;
+        // -1 for a wall
+        int body2;
+        // Index into walls, -1 for the terrain
+        int wall;
+        // Points from body2 or the wall towards body1
+        glm::vec3 normal;
+        // From each centre to the contact point
+        glm::vec3 arm1;
+        glm::vec3 arm2;
+        // Zero for walls and for sleeping bodies that weren't woken
+        float invMass1, invMass2;
+        float invInertia1, invInertia2;
+        float normalMass;
+        float tangentMass;
+        float angularMass;
+        // Separating speed the solver aims for, from the bounce
+        float targetVelocity;
+        float penetration;
+        float rollingLimit;
+        float impulse;
+        glm::vec3 tangentImpulse;
+    };
+
+    struct CachedImpulse
+    {
+        float normal;
+        glm::vec3 tangent;
+    };
+
+    static uint64_t PairKey(int a, int b);
+    static uint64_t WallKey(int body, int wall);
+
+    /// \brief Fills in everything but the normal, penetration and cached impulses, wakes the bodies if needed
+    /// \return false if nothing in the contact can move
+    bool Prepare(PhysicsWorld& world, Contact& contact);
+
+    /// \brief Wakes the sleepers in pairs that touch a body that moved last step
+    void WakeSupported(PhysicsWorld& world, const std::vector<std::pair<int, int>>& pairs);
+
+    void ApplyImpulse(PhysicsWorld& world, const Contact& contact, const glm::vec3& impulse);
+    void ApplyAngularImpulse(PhysicsWorld& world, const Contact& contact, const glm::vec3& impulse);
+
+    glm::vec3 ContactVelocity(const PhysicsWorld& world, const Contact& contact) const;
+
+    std::vector<Contact> contacts;
+
+    // Accumulated impulses of every pair that touched last step
+    std::unordered_map<uint64_t, CachedImpulse> cache;
+    std::unordered_map<uint64_t, CachedImpulse> wallCache;
+
+    // Last step's cache while the new one is filled in, to find the contacts that went away
+    std::unordered_map<uint64_t, CachedImpulse> previousCache;
+    std::vector<int> wokenBodies;
+};
@@ -0,0 +1,311 @@
+﻿#include "ConvexHull.h"
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <cstdint>
+#include <unordered_map>
+
+#include <glm/geometric.hpp>
+
+namespace
+{
+    struct Face
+    {
+        int v[3];
+        glm::vec3 normal;
+        float offset;
+        // Input points outside this face, each point is only in one face's list
+        std::vector<int> outside;
+        bool removed = false;
+    };
+
+    uint64_t EdgeKey(int from, int to)
+    {
+        return ((uint64_t)(uint32_t)from << 32) | (uint32_t)to;
+    }
+
+    Face MakeFace(const std::vector<glm::vec3>& points, int a, int b, int c)
+    {
+        Face face;
+        face.v[0] = a;
+        face.v[1] = b;
+        face.v[2] = c;
+        face.normal = glm::normalize(glm::cross(points[b] - points[a], points[c] - points[a]));
+        face.offset = glm::dot(face.normal, points[a]);
+        return face;
+    }
+
+    float Distance(const Face& face, const glm::vec3& point)
+    {
+        return glm::dot(face.normal, point) - face.offset;
+    }
+
+    /// \brief Gives each point to the first face it is outside of, drops the rest for good
+    void AssignOutside(const std::vector<glm::vec3>& points, const std::vector<int>& candidates,
+        std::vector<Face>& faces, int firstFace, float epsilon)
+    {
+        for (int point : candidates)
+        {
+            for (int f = firstFace; f < (int)faces.size(); ++f)
+            {
+                if (!faces[f].removed && Distance(faces[f], points[point]) > epsilon)
+                {
+                    faces[f].outside.push_back(point);
+                    break;
+                }
+            }
+        }
+    }
+}
+
+ConvexHull::ConvexHull()
+{
+
+}
+
+void ConvexHull::Clear()
+{
+    vertices.clear();
+    indices.clear();
+    faceNormals.clear();
+    faceOffsets.clear();
+}
+
+bool ConvexHull::Build(const std::vector<glm::vec3>& points)
+{
+    Clear();
+    if (points.empty()) return false;
+
+    glm::vec3 min(FLT_MAX), max(-FLT_MAX);
+    for (const glm::vec3& point : points)
+    {
+        min = glm::min(min, point);
+        max = glm::max(max, point);
+    }
+    glm::vec3 size = max - min;
+    epsilon = 1e-5f * std::fmax(size.x, std::fmax(size.y, size.z));
+
+    // Mesh vertices repeat a lot, one per triangle corner for the spheres, and corners are copied bit for bit
+    std::vector<int> unique(points.size());
+    for (int i = 0; i < (int)points.size(); ++i) unique[i] = i;
+    auto less = [&points](int a, int b)
+    {
+        const glm::vec3& p = points[a];
+        const glm::vec3& q = points[b];
+        return p.x < q.x || (p.x == q.x && (p.y < q.y || (p.y == q.y && p.z < q.z)));
+    };
+    std::sort(unique.begin(), unique.end(), less);
+    unique.erase(std::unique(unique.begin(), unique.end(), [&points](int a, int b) { return points[a] == points[b]; }), unique.end());
+
+    auto fallback = [&]()
+    {
+        for (int i : unique) vertices.push_back(points[i]);
+        return false;
+    };
+
+    // Initial tetrahedron: the two extreme points furthest apart, the point furthest from their line,
+    // then the point furthest from their plane
+    int extremes[6] = { unique[0], unique[0], unique[0], unique[0], unique[0], unique[0] };
+    for (int i : unique)
+    {
+        for (int axis = 0; axis < 3; ++axis)
+        {
+            if (points[i][axis] < points[extremes[axis * 2]][axis]) extremes[axis * 2] = i;
+            if (points[i][axis] > points[extremes[axis * 2 + 1]][axis]) extremes[axis * 2 + 1] = i;
+        }
+    }
+
+    int p0 = extremes[0], p1 = extremes[1];
+    float best = -1.0f;
+    for (int axis = 0; axis < 3; ++axis)
+    {
+        glm::vec3 span = points[extremes[axis * 2 + 1]] - points[extremes[axis * 2]];
+        if (glm::dot(span, span) > best)
+        {
+            best = glm::dot(span, span);
+            p0 = extremes[axis * 2];
+            p1 = extremes[axis * 2 + 1];
+        }
+    }
+    if (std::sqrt(best) <= epsilon) return fallback();
+
+    glm::vec3 line = glm::normalize(points[p1] - points[p0]);
+    int p2 = -1;
+    best = epsilon;
+    for (int i : unique)
+    {
+        glm::vec3 offset = points[i] - points[p0];
+        float distance = glm::length(offset - line * glm::dot(offset, line));
+        if (distance > best)
+        {
+            best = distance;
+            p2 = i;
+        }
+    }
+    if (p2 == -1) return fallback();
+
+    glm::vec3 planeNormal = glm::normalize(glm::cross(points[p1] - points[p0], points[p2] - points[p0]));
+    int p3 = -1;
+    best = epsilon;
+    for (int i : unique)
+    {
+        float distance = std::fabs(glm::dot(points[i] - points[p0], planeNormal));
+        if (distance > best)
+        {
+            best = distance;
+            p3 = i;
+        }
+    }
+    if (p3 == -1) return fallback();
+
+    std::vector<Face> faces;
+    faces.push_back(MakeFace(points, p0, p1, p2));
+    faces.push_back(MakeFace(points, p0, p3, p1));
+    faces.push_back(MakeFace(points, p1, p3, p2));
+    faces.push_back(MakeFace(points, p2, p3, p0));
+
+    // Turn any face whose normal points at the middle of the tetrahedron
+    glm::vec3 middle = (points[p0] + points[p1] + points[p2] + points[p3]) * 0.25f;
+    for (Face& face : faces)
+    {
+        if (Distance(face, middle) > 0.0f) face = MakeFace(points, face.v[0], face.v[2], face.v[1]);
+    }
+    AssignOutside(points, unique, faces, 0, epsilon);
+
+    // Face on the left of every directed edge, to walk from a face to its neighbours
+    std::unordered_map<uint64_t, int> edgeFace;
+    for (int f = 0; f < (int)faces.size(); ++f)
+    {
+        for (int e = 0; e < 3; ++e) edgeFace[EdgeKey(faces[f].v[e], faces[f].v[(e + 1) % 3])] = f;
+    }
+
+    std::vector<int> visible;
+    std::vector<char> isVisible(faces.size(), 0);
+    std::vector<std::pair<int, int>> horizon;
+    std::vector<int> orphans;
+
+    for (int current = 0; current < (int)faces.size(); ++current)
+    {
+        // Faces made later are appended, so this loop also reaches them
+        while (!faces[current].removed && !faces[current].outside.empty())
+        {
+            // Furthest point outside this face is surely a hull corner
+            int eye = -1;
+            best = -FLT_MAX;
+            for (int point : faces[current].outside)
+            {
+                float distance = Distance(faces[current], points[point]);
+                if (distance > best)
+                {
+                    best = distance;
+                    eye = point;
+                }
+            }
+
+            // Faces the eye can see are connected, flood out from this one over shared edges.
+            // Edges leading to a face it can't see form the horizon
+            visible.assign(1, current);
+            isVisible[current] = 1;
+            horizon.clear();
+            for (int v = 0; v < (int)visible.size(); ++v)
+            {
+                const Face& face = faces[visible[v]];
+                for (int e = 0; e < 3; ++e)
+                {
+                    int from = face.v[e];
+                    int to = face.v[(e + 1) % 3];
+                    int neighbour = edgeFace[EdgeKey(to, from)];
+                    if (isVisible[neighbour]) continue;
+
+                    // No tolerance here: keeping a face the eye is barely in front of leaves a fold in
+                    // the hull that points dropped as inside can end up outside of
+                    if (Distance(faces[neighbour], points[eye]) > 0.0f)
+                    {
+                        visible.push_back(neighbour);
+                        isVisible[neighbour] = 1;
+                    }
+                    else
+                    {
+                        horizon.emplace_back(from, to);
+                    }
+                }
+            }
+
+            orphans.clear();
+            for (int f : visible)
+            {
+                faces[f].removed = true;
+                for (int point : faces[f].outside)
+                {
+                    if (point != eye) orphans.push_back(point);
+                }
+                faces[f].outside.clear();
+                faces[f].outside.shrink_to_fit();
+            }
+
+            // Close the hole with a fan from the eye, the new faces keep the winding of the old edges
+            int firstNew = (int)faces.size();
+            for (const std::pair<int, int>& edge : horizon)
+            {
+                faces.push_back(MakeFace(points, edge.first, edge.second, eye));
+                isVisible.push_back(0);
+
+                int f = (int)faces.size() - 1;
+                edgeFace[EdgeKey(edge.first, edge.second)] = f;
+                edgeFace[EdgeKey(edge.second, eye)] = f;
+                edgeFace[EdgeKey(eye, edge.first)] = f;
+            }
+            AssignOutside(points, orphans, faces, firstNew, epsilon);
+        }
+    }
+
+    // Keep only the corners that are used, renumbered in the order they are first met
+    std::unordered_map<int, unsigned int> remap;
+    for (const Face& face : faces)
+    {
+        if (face.removed) continue;
+
+        for (int corner : face.v)
+        {
+            auto it = remap.find(corner);
+            if (it == remap.end())
+            {
+                it = remap.emplace(corner, (unsigned int)vertices.size()).first;
+                vertices.push_back(points[corner]);
+            }
+            indices.push_back(it->second);
+        }
+        faceNormals.push_back(face.normal);
+        faceOffsets.push_back(face.offset);
+    }
+
+    return true;
+}
+
+glm::vec3 ConvexHull::Support(const glm::vec3& direction) const
+{
+    glm::vec3 furthest(0.0f);
+    float best = -FLT_MAX;
+    for (const glm::vec3& vertex : vertices)
+    {
+        float distance = glm::dot(vertex, direction);
+        if (distance > best)
+        {
+            best = distance;
+            furthest = vertex;
+        }
+    }
+    return furthest;
+}
+
+bool ConvexHull::Contains(const glm::vec3& point) const
+{
+    if (faceNormals.empty()) return false;
+
+    for (int f = 0; f < (int)faceNormals.size(); ++f)
+    {
+        if (glm::dot(faceNormals[f], point) - faceOffsets[f] > epsilon) return false;
+    }
+    return true;
+}
@@ -0,0 +1,43 @@
+﻿#pragma once
+#include <vector>
+#include "glm/vec3.hpp"
+
+/// \brief Convex hull of a point cloud, built with QuickHull.
+/// Starts from a tetrahedron of extreme points, then keeps adding the point furthest outside any face:
+/// every face that point can see is removed and the hole is closed with a fan from the point to the
+/// horizon. Points that end up inside are never looked at again, so it is close to O(n log n) for meshes.
+class ConvexHull
+{
+public:
+
+    ConvexHull();
+
+    /// \brief Replaces the hull with the hull of points
+    /// \return false if the points are all on one plane or line, then the hull is just the unique
+    /// points with no faces, which is still enough for Support and the bounds
+    bool Build(const std::vector<glm::vec3>& points);
+
+    void Clear();
+
+    /// \brief Hull vertex furthest along direction, what GJK and other convex tests need
+    glm::vec3 Support(const glm::vec3& direction) const;
+
+    /// \brief True if point is inside or on every face, always false for a flat hull
+    bool Contains(const glm::vec3& point) const;
+
+    bool IsEmpty() const { return vertices.empty(); }
+
+    // Only the points that are corners of the hull
+    std::vector<glm::vec3> vertices;
+
+    // Triangles into vertices, counter clockwise seen from outside
+    std::vector<unsigned int> indices;
+
+    // Outward unit normal of each triangle and its distance from the origin, so dot(normal, p) - offset
+    // is how far p is outside that face
+    std::vector<glm::vec3> faceNormals;
+    std::vector<float> faceOffsets;
+
+    // Distance a point has to be outside a face to count, scales with the size of the input
+    float epsilon = 0.0f;
+};
@@ -0,0 +1,242 @@
+﻿#include "EventSimulation.h"
+
+#include <cmath>
+#include <limits>
+
+#include "PhysicsWorld.h"
+
+namespace
+{
+    const double Never = std::numeric_limits<double>::infinity();
+}
+
+EventSimulation::EventSimulation()
+{
+
+}
+
+void EventSimulation::Initialize(PhysicsWorld& world, const AABB& bounds)
+{
+    bodies = &world;
+    box = bounds;
+    now = 0.0;
+
+    const int count = world.GetBodyCount();
+    bodyTime.assign(count, 0.0);
+    collisionCount.assign(count, 0);
+    knownVelX = world.velX;
+    knownVelY = world.velY;
+    knownVelZ = world.velZ;
+
+    events = decltype(events)();
+    predictions = 0;
+    for (int i = 0; i < count; ++i)
+    {
+        Predict(i);
+    }
+}
+
+void EventSimulation::Sync(int body)
+{
+    float dt = (float)(now - bodyTime[body]);
+    bodies->posX[body] += bodies->velX[body] * dt;
+    bodies->posY[body] += bodies->velY[body] * dt;
+    bodies->posZ[body] += bodies->velZ[body] * dt;
+    bodyTime[body] = now;
+}
+
+double EventSimulation::TimeToHit(int a, int b) const
+{
+    const PhysicsWorld& world = *bodies;
+
+    // Both positions at the current time, b may not have been synced for a while
+    double ta = now - bodyTime[a];
+    double tb = now - bodyTime[b];
+    double dx = (world.posX[b] + world.velX[b] * tb) - (world.posX[a] + world.velX[a] * ta);
+    double dy = (world.posY[b] + world.velY[b] * tb) - (world.posY[a] + world.velY[a] * ta);
+    double dz = (world.posZ[b] + world.velZ[b] * tb) - (world.posZ[a] + world.velZ[a] * ta);
+    double dvx = world.velX[b] - world.velX[a];
+    double dvy = world.velY[b] - world.velY[a];
+    double dvz = world.velZ[b] - world.velZ[a];
+
+    double dvdr = dx * dvx + dy * dvy + dz * dvz;
+    if (dvdr >= 0.0) return Never;
+
+    double dvdv = dvx * dvx + dvy * dvy + dvz * dvz;
+    double drdr = dx * dx + dy * dy + dz * dz;
+    double sigma = world.radius[a] + world.radius[b];
+
+    double d = dvdr * dvdr - dvdv * (drdr - sigma * sigma);
+    if (d < 0.0) return Never;
+
+    // Already overlapping and closing in, hit right away
+    double t = -(dvdr + std::sqrt(d)) / dvdv;
+    return t < 0.0 ? 0.0 : t;
+}
+
+double EventSimulation::TimeToWall(int body, int& axis) const
+{
+    const PhysicsWorld& world = *bodies;
+    const float position[3] = { world.posX[body], world.posY[body], world.posZ[body] };
+    const float velocity[3] = { world.velX[body], world.velY[body], world.velZ[body] };
+    const double age = now - bodyTime[body];
+    const float radius = world.radius[body];
+
+    double best = Never;
+    axis = -1;
+    for (int k = 0; k < 3; ++k)
+    {
+        double p = position[k] + velocity[k] * age;
+        double t = Never;
+        if (velocity[k] > 0.0f) t = (box.max[k] - radius - p) / velocity[k];
+        else if (velocity[k] < 0.0f) t = (box.min[k] + radius - p) / velocity[k];
+
+        if (t < best)
+        {
+            best = t < 0.0 ? 0.0 : t;
+            axis = k;
+        }
+    }
+    return best;
+}
+
+void EventSimulation::Predict(int body)
+{
+    const int count = bodies->GetBodyCount();
+
+    for (int other = 0; other < count; ++other)
+    {
+        if (other == body) continue;
+
+        predictions++;
+        double t = TimeToHit(body, other);
+        if (t != Never)
+        {
+            events.push({ now + t, body, other, collisionCount[body], collisionCount[other] });
+        }
+    }
+
+    int axis;
+    double t = TimeToWall(body, axis);
+    if (t != Never)
+    {
+        events.push({ now + t, body, -1 - axis, collisionCount[body], 0 });
+    }
+}
+
+void EventSimulation::ResolveSpheres(int a, int b)
+{
+    PhysicsWorld& world = *bodies;
+
+    float dx = world.posX[b] - world.posX[a];
+    float dy = world.posY[b] - world.posY[a];
+    float dz = world.posZ[b] - world.posZ[a];
+    float distance = std::sqrt(dx * dx + dy * dy + dz * dz);
+    if (distance <= 0.0f) return;
+
+    float nx = dx / distance;
+    float ny = dy / distance;
+    float nz = dz / distance;
+
+    float velocityAlongNormal =
+        (world.velX[b] - world.velX[a]) * nx +
+        (world.velY[b] - world.velY[a]) * ny +
+        (world.velZ[b] - world.velZ[a]) * nz;
+
+    float invMassSum = world.invMass[a] + world.invMass[b];
+    if (velocityAlongNormal >= 0.0f || invMassSum <= 0.0f) return;
+
+    float impulse = (1.0f + restitution) * velocityAlongNormal / invMassSum;
+
+    world.velX[a] += impulse * world.invMass[a] * nx;
+    world.velY[a] += impulse * world.invMass[a] * ny;
+    world.velZ[a] += impulse * world.invMass[a] * nz;
+    world.velX[b] -= impulse * world.invMass[b] * nx;
+    world.velY[b] -= impulse * world.invMass[b] * ny;
+    world.velZ[b] -= impulse * world.invMass[b] * nz;
+}
+
+void EventSimulation::ResolveWall(int body, int axis)
+{
+    std::vector<float>& velocity = axis == 0 ? bodies->velX : axis == 1 ? bodies->velY : bodies->velZ;
+    velocity[body] = -velocity[body] * restitution;
+}
+
+void EventSimulation::PickUpExternalChanges()
+{
+    PhysicsWorld& world = *bodies;
+    const int count = world.GetBodyCount();
+
+    for (int i = 0; i < count; ++i)
+    {
+        if (world.velX[i] == knownVelX[i] && world.velY[i] == knownVelY[i] && world.velZ[i] == knownVelZ[i]) continue;
+
+        // Old predictions for this body are wrong now, bumping the count drops them
+        collisionCount[i]++;
+        bodyTime[i] = now;
+        knownVelX[i] = world.velX[i];
+        knownVelY[i] = world.velY[i];
+        knownVelZ[i] = world.velZ[i];
+        Predict(i);
+    }
+}
+
+void EventSimulation::Advance(float deltaTime)
+{
+    eventsProcessed = 0;
+    eventsStale = 0;
+    predictions = 0;
+
+    PickUpExternalChanges();
+
+    const double end = now + deltaTime;
+    while (!events.empty() && events.top().time <= end)
+    {
+        Event event = events.top();
+        events.pop();
+
+        bool stale = collisionCount[event.a] != event.countA ||
+            (event.b >= 0 && collisionCount[event.b] != event.countB);
+        if (stale)
+        {
+            eventsStale++;
+            continue;
+        }
+
+        eventsProcessed++;
+        now = event.time;
+
+        Sync(event.a);
+        collisionCount[event.a]++;
+        if (event.b >= 0)
+        {
+            Sync(event.b);
+            collisionCount[event.b]++;
+            ResolveSpheres(event.a, event.b);
+        }
+        else
+        {
+            ResolveWall(event.a, -1 - event.b);
+        }
+
+        knownVelX[event.a] = bodies->velX[event.a];
+        knownVelY[event.a] = bodies->velY[event.a];
+        knownVelZ[event.a] = bodies->velZ[event.a];
+        Predict(event.a);
+
+        if (event.b >= 0)
+        {
+            knownVelX[event.b] = bodies->velX[event.b];
+            knownVelY[event.b] = bodies->velY[event.b];
+            knownVelZ[event.b] = bodies->velZ[event.b];
+            Predict(event.b);
+        }
+    }
+
+    // Bring everyone up to the end of the frame for drawing
+    now = end;
+    for (int i = 0; i < bodies->GetBodyCount(); ++i)
+    {
+        Sync(i);
+    }
+}
@@ -0,0 +1,79 @@
+﻿#pragma once
+#include <functional>
+#include <queue>
+#include <vector>
+#include "AABB.h"
+
+class PhysicsWorld;
+
+/// \brief Event driven hard sphere simulation for spheres bouncing around inside a box.
+/// Instead of stepping, it predicts the exact time every sphere next hits another sphere or a wall,
+/// keeps those predictions in a priority queue and jumps from one collision to the next.
+/// Every body has a collision count; an event remembers the counts it was predicted with and is
+/// thrown away when popped if either body has collided since. Bodies are only moved up to the
+/// current time when something happens to them, so a quiet sphere costs nothing between events.
+class EventSimulation
+{
+public:
+
+    EventSimulation();
+
+    /// \brief Predicts every event from scratch
+    /// \param bounds inside of the box the spheres bounce in
+    void Initialize(PhysicsWorld& world, const AABB& bounds);
+
+    bool IsInitialized() const { return bodies != nullptr; }
+
+    /// \brief Runs every event in the next deltaTime seconds and leaves all positions at the new time.
+    /// Velocities written to the world from outside since the last call are picked up first.
+    void Advance(float deltaTime);
+
+    double GetTime() const { return now; }
+
+    // Stats for the last Advance
+    int eventsProcessed = 0;
+    int eventsStale = 0;
+    int predictions = 0;
+
+    /// Same bounciness as Collision::SphereCollision
+    float restitution = 1.0f;
+
+private:
+
+    // Wall events use a negative other body, -1 - axis
+    struct Event
+    {
+        double time;
+        int a;
+        int b;
+        int countA;
+        int countB;
+
+        bool operator>(const Event& other) const { return time > other.time; }
+    };
+
+    /// Moves a body along its velocity from its own timestamp to now
+    void Sync(int body);
+
+    /// Queues the next sphere and wall hits of one body
+    void Predict(int body);
+
+    double TimeToHit(int a, int b) const;
+    double TimeToWall(int body, int& axis) const;
+
+    void ResolveSpheres(int a, int b);
+    void ResolveWall(int body, int axis);
+
+    /// Compares world velocities with the ones we last set and re-predicts bodies that differ
+    void PickUpExternalChanges();
+
+    PhysicsWorld* bodies = nullptr;
+    AABB box;
+
+    double now = 0.0;
+    std::vector<double> bodyTime;
+    std::vector<int> collisionCount;
+    std::vector<float> knownVelX, knownVelY, knownVelZ;
+
+    std::priority_queue<Event, std::vector<Event>, std::greater<Event>> events;
+};
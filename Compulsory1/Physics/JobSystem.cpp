@@ -0,0 +1,218 @@
+﻿#include "JobSystem.h"
+
+#include <algorithm>
+
+struct JobSystem::Job
+{
+    std::function<void()> work;
+
+    // Dependencies not finished yet, plus one held by Schedule until it has looked at all of them
+    std::atomic<int> waitingFor{ 1 };
+
+    // Jobs waiting on this one, guarded by mutex together with finished
+    std::mutex mutex;
+    std::vector<JobHandle> continuations;
+    std::atomic<bool> finished{ false };
+};
+
+namespace
+{
+    // Which system and queue the current thread works for
+    thread_local const JobSystem* currentSystem = nullptr;
+    thread_local int currentQueue = 0;
+}
+
+JobSystem::JobSystem(int threadCount)
+{
+    if (threadCount <= 0)
+    {
+        threadCount = (int)std::thread::hardware_concurrency();
+        if (threadCount <= 0) threadCount = 1;
+    }
+
+    for (int queue = 0; queue < threadCount; ++queue)
+    {
+        queues.push_back(std::make_unique<WorkQueue>());
+    }
+    for (int queue = 1; queue < threadCount; ++queue)
+    {
+        workers.emplace_back(&JobSystem::WorkerLoop, this, queue);
+    }
+}
+
+JobSystem::~JobSystem()
+{
+    {
+        std::lock_guard<std::mutex> lock(sleepMutex);
+        stopping = true;
+    }
+    sleepCondition.notify_all();
+
+    for (std::thread& worker : workers)
+    {
+        worker.join();
+    }
+}
+
+int JobSystem::CurrentQueue() const
+{
+    return currentSystem == this ? currentQueue : 0;
+}
+
+JobSystem::JobHandle JobSystem::Schedule(std::function<void()> work, const std::vector<JobHandle>& dependencies)
+{
+    JobHandle job = std::make_shared<Job>();
+    job->work = std::move(work);
+
+    for (const JobHandle& dependency : dependencies)
+    {
+        if (!dependency) continue;
+
+        // The dependency either sees this job in its list when it finishes, or has finished already
+        std::lock_guard<std::mutex> lock(dependency->mutex);
+        if (dependency->finished) continue;
+
+        dependency->continuations.push_back(job);
+        job->waitingFor++;
+    }
+
+    if (--job->waitingFor == 0) Push(job);
+    return job;
+}
+
+bool JobSystem::IsFinished(const JobHandle& job)
+{
+    return !job || job->finished.load(std::memory_order_acquire);
+}
+
+void JobSystem::Wait(const JobHandle& job)
+{
+    const int queue = CurrentQueue();
+    while (!IsFinished(job))
+    {
+        JobHandle other;
+        if (TryTake(queue, other))
+        {
+            Execute(other);
+        }
+        else
+        {
+            std::this_thread::yield();
+        }
+    }
+}
+
+void JobSystem::ParallelFor(int count, int grainSize, const std::function<void(int, int)>& work)
+{
+    if (count <= 0) return;
+
+    grainSize = std::max(grainSize, 1);
+    const int ranges = std::min((count + grainSize - 1) / grainSize, GetThreadCount() * 4);
+    if (ranges < 2 || workers.empty())
+    {
+        work(0, count);
+        return;
+    }
+
+    std::vector<JobHandle> jobs;
+    jobs.reserve(ranges - 1);
+    for (int range = 1; range < ranges; ++range)
+    {
+        int begin = (int)((long long)count * range / ranges);
+        int end = (int)((long long)count * (range + 1) / ranges);
+        jobs.push_back(Schedule([&work, begin, end] { work(begin, end); }));
+    }
+
+    // The caller takes the first range instead of sleeping
+    work(0, (int)((long long)count / ranges));
+
+    for (const JobHandle& job : jobs)
+    {
+        Wait(job);
+    }
+}
+
+void JobSystem::Push(const JobHandle& job)
+{
+    WorkQueue& queue = *queues[CurrentQueue()];
+    {
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        queue.jobs.push_back(job);
+    }
+    queued++;
+
+    // Taking the lock means a worker between checking queued and going to sleep can't miss this
+    {
+        std::lock_guard<std::mutex> lock(sleepMutex);
+    }
+    sleepCondition.notify_one();
+}
+
+bool JobSystem::TryTake(int queue, JobHandle& job)
+{
+    {
+        WorkQueue& own = *queues[queue];
+        std::lock_guard<std::mutex> lock(own.mutex);
+        if (!own.jobs.empty())
+        {
+            job = std::move(own.jobs.back());
+            own.jobs.pop_back();
+            queued--;
+            return true;
+        }
+    }
+
+    const int count = (int)queues.size();
+    for (int offset = 1; offset < count; ++offset)
+    {
+        WorkQueue& victim = *queues[(queue + offset) % count];
+        std::lock_guard<std::mutex> lock(victim.mutex);
+        if (!victim.jobs.empty())
+        {
+            job = std::move(victim.jobs.front());
+            victim.jobs.pop_front();
+            queued--;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+void JobSystem::Execute(const JobHandle& job)
+{
+    job->work();
+    job->work = nullptr;
+
+    std::vector<JobHandle> ready;
+    {
+        std::lock_guard<std::mutex> lock(job->mutex);
+        job->finished.store(true, std::memory_order_release);
+        ready.swap(job->continuations);
+    }
+
+    for (const JobHandle& continuation : ready)
+    {
+        if (--continuation->waitingFor == 0) Push(continuation);
+    }
+}
+
+void JobSystem::WorkerLoop(int queue)
+{
+    currentSystem = this;
+    currentQueue = queue;
+
+    while (true)
+    {
+        JobHandle job;
+        if (TryTake(queue, job))
+        {
+            Execute(job);
+            continue;
+        }
+
+        std::unique_lock<std::mutex> lock(sleepMutex);
+        sleepCondition.wait(lock, [this] { return stopping || queued.load() > 0; });
+        if (stopping) return;
+    }
+}
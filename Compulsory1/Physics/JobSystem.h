@@ -0,0 +1,76 @@
+﻿#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/// \brief Work-stealing job system.
+/// Every thread has its own deque of ready jobs. A thread pushes and pops at the back of its own deque,
+/// so it keeps working on what it just made while the data is still in cache, and idle threads steal the
+/// oldest job from the front of someone else's. A job can wait on other jobs, it is only queued once
+/// all of them have finished. The thread that made the system counts as thread 0 and runs jobs while
+/// it waits, so a system of 1 thread runs everything inline.
+class JobSystem
+{
+public:
+
+    struct Job;
+
+    /// Shared so a handle stays valid after the job ran, an empty handle counts as finished
+    using JobHandle = std::shared_ptr<Job>;
+
+    /// \param threadCount total threads including the caller, 0 uses every hardware thread
+    explicit JobSystem(int threadCount = 0);
+    ~JobSystem();
+
+    JobSystem(const JobSystem&) = delete;
+    JobSystem& operator=(const JobSystem&) = delete;
+
+    int GetThreadCount() const { return (int)workers.size() + 1; }
+
+    /// \brief Queues work to run once every job in dependencies has finished
+    JobHandle Schedule(std::function<void()> work, const std::vector<JobHandle>& dependencies = {});
+
+    /// \brief Runs other jobs on this thread until job has finished
+    void Wait(const JobHandle& job);
+
+    static bool IsFinished(const JobHandle& job);
+
+    /// \brief Calls work(begin, end) over [0, count) in ranges of at least grainSize and waits for all of them.
+    /// Cuts a few ranges per thread so a thread that finishes early can steal the rest, and runs
+    /// inline when there is less than two ranges of work.
+    void ParallelFor(int count, int grainSize, const std::function<void(int, int)>& work);
+
+private:
+
+    struct WorkQueue
+    {
+        std::mutex mutex;
+        std::deque<JobHandle> jobs;
+    };
+
+    void WorkerLoop(int queue);
+
+    /// \brief Queue of the calling thread, 0 for threads that aren't ours
+    int CurrentQueue() const;
+
+    void Push(const JobHandle& job);
+
+    /// \brief Newest job of queue, or the oldest one of any other queue
+    bool TryTake(int queue, JobHandle& job);
+
+    void Execute(const JobHandle& job);
+
+    std::vector<std::thread> workers;
+    std::vector<std::unique_ptr<WorkQueue>> queues;
+
+    // Jobs sitting in any queue, idle workers sleep while it is 0
+    std::atomic<int> queued{ 0 };
+    std::mutex sleepMutex;
+    std::condition_variable sleepCondition;
+    bool stopping = false;
+};
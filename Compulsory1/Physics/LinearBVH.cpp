@@ -0,0 +1,229 @@
+﻿#include "LinearBVH.h"
+
+#include <algorithm>
+
+#include "Morton.h"
+#include "PhysicsWorld.h"
+#include "ThreadPool.h"
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+namespace
+{
+    int CountLeadingZeros(uint32_t value)
+    {
+        if (value == 0) return 32;
+#if defined(_MSC_VER)
+        unsigned long index;
+        _BitScanReverse(&index, value);
+        return 31 - (int)index;
+#else
+        return __builtin_clz(value);
+#endif
+    }
+}
+
+LinearBVH::LinearBVH()
+{
+
+}
+
+int LinearBVH::Delta(int i, int j) const
+{
+    if (j < 0 || j >= leafCount) return -1;
+
+    // Equal codes fall back to the position so every key is unique
+    if (codes[i] == codes[j]) return 32 + CountLeadingZeros((uint32_t)i ^ (uint32_t)j);
+    return CountLeadingZeros(codes[i] ^ codes[j]);
+}
+
+void LinearBVH::BuildInternal(int i)
+{
+    // Which way the node's range goes from i
+    int direction = Delta(i, i + 1) - Delta(i, i - 1) >= 0 ? 1 : -1;
+    int deltaMin = Delta(i, i - direction);
+
+    // Upper bound on the range length, then binary search for the exact other end
+    int lengthMax = 2;
+    while (Delta(i, i + lengthMax * direction) > deltaMin) lengthMax *= 2;
+
+    int length = 0;
+    for (int step = lengthMax / 2; step >= 1; step /= 2)
+    {
+        if (Delta(i, i + (length + step) * direction) > deltaMin) length += step;
+    }
+    int j = i + length * direction;
+
+    // Split where the prefix shared with i gets shorter than the whole range's
+    int deltaNode = Delta(i, j);
+    int split = 0;
+    for (int step = (length + 1) / 2; ; step = (step + 1) / 2)
+    {
+        if (split + step < length && Delta(i, i + (split + step) * direction) > deltaNode) split += step;
+        if (step == 1) break;
+    }
+    int gamma = i + split * direction + std::min(direction, 0);
+
+    const int first = std::min(i, j);
+    const int last = std::max(i, j);
+    const int leafBase = leafCount - 1;
+
+    Node& node = nodes[i];
+    node.left = first == gamma ? leafBase + gamma : gamma;
+    node.right = last == gamma + 1 ? leafBase + gamma + 1 : gamma + 1;
+    node.last = last;
+    nodes[node.left].parent = i;
+    nodes[node.right].parent = i;
+}
+
+void LinearBVH::Build(const PhysicsWorld& world, ThreadPool& pool)
+{
+    leafCount = world.GetBodyCount();
+    if (leafCount == 0)
+    {
+        nodes.clear();
+        return;
+    }
+
+    // Bounds of the centres, one slice per thread then merged
+    const int threads = pool.GetThreadCount();
+    std::vector<AABB> chunkBounds(threads, AABB(world.GetPosition(0), world.GetPosition(0)));
+    pool.ParallelFor(leafCount, [&](int chunk, int begin, int end)
+    {
+        AABB box(world.GetPosition(begin), world.GetPosition(begin));
+        for (int i = begin + 1; i < end; ++i)
+        {
+            box.min = glm::min(box.min, world.GetPosition(i));
+            box.max = glm::max(box.max, world.GetPosition(i));
+        }
+        chunkBounds[chunk] = box;
+    });
+    AABB bounds = chunkBounds[0];
+    for (int t = 1; t < threads; ++t)
+    {
+        bounds = AABB::Union(bounds, chunkBounds[t]);
+    }
+
+    codes.resize(leafCount);
+    pool.ParallelFor(leafCount, [&](int, int begin, int end)
+    {
+        for (int i = begin; i < end; ++i)
+        {
+            codes[i] = Morton::Encode(world.GetPosition(i), bounds);
+        }
+    });
+    Morton::Sort(codes, order, pool);
+
+    const int leafBase = leafCount - 1;
+    nodes.resize(2 * leafCount - 1);
+    nodes[0].parent = -1;
+
+    // Leaves, each one body
+    pool.ParallelFor(leafCount, [&](int, int begin, int end)
+    {
+        for (int i = begin; i < end; ++i)
+        {
+            Node& leaf = nodes[leafBase + i];
+            leaf.box = world.GetSweptAABB(order[i], sweepTime);
+            leaf.left = -1;
+            leaf.right = -1;
+            leaf.last = i;
+        }
+    });
+
+    if (leafCount == 1)
+    {
+        nodes[0].parent = -1;
+        return;
+    }
+
+    pool.ParallelFor(leafCount - 1, [&](int, int begin, int end)
+    {
+        for (int i = begin; i < end; ++i)
+        {
+            BuildInternal(i);
+        }
+    });
+    nodes[0].parent = -1;
+
+    if (visitsSize < leafCount - 1)
+    {
+        visitsSize = leafCount - 1;
+        visits.reset(new std::atomic<int>[visitsSize]);
+    }
+    pool.ParallelFor(leafCount - 1, [&](int, int begin, int end)
+    {
+        for (int i = begin; i < end; ++i) visits[i].store(0, std::memory_order_relaxed);
+    });
+
+    // Walk up from every leaf. The first child to reach a node stops, the second one has both
+    // boxes ready and carries on upwards
+    pool.ParallelFor(leafCount, [&](int, int begin, int end)
+    {
+        for (int i = begin; i < end; ++i)
+        {
+            int node = nodes[leafBase + i].parent;
+            while (node != -1)
+            {
+                if (visits[node].fetch_add(1, std::memory_order_acq_rel) == 0) break;
+
+                Node& parent = nodes[node];
+                parent.box = AABB::Union(nodes[parent.left].box, nodes[parent.right].box);
+                node = parent.parent;
+            }
+        }
+    });
+}
+
+void LinearBVH::FindPairs(ThreadPool& pool, std::vector<std::pair<int, int>>& pairs)
+{
+    pairs.clear();
+    if (leafCount < 2) return;
+
+    const int threads = pool.GetThreadCount();
+    if ((int)chunkPairs.size() < threads) chunkPairs.resize(threads);
+    for (std::vector<std::pair<int, int>>& chunk : chunkPairs)
+    {
+        chunk.clear();
+    }
+
+    const int leafBase = leafCount - 1;
+    pool.ParallelFor(leafCount, [&](int chunk, int begin, int end)
+    {
+        std::vector<std::pair<int, int>>& out = chunkPairs[chunk];
+        int stack[128];
+
+        for (int i = begin; i < end; ++i)
+        {
+            const AABB& box = nodes[leafBase + i].box;
+            int count = 0;
+            stack[count++] = 0;
+
+            while (count > 0)
+            {
+                const Node& node = nodes[stack[--count]];
+
+                // Pairs are only reported from the earlier leaf, so skip anything at or before i
+                if (node.last <= i || !node.box.Overlaps(box)) continue;
+
+                if (node.left == -1)
+                {
+                    int a = order[i];
+                    int b = order[node.last];
+                    out.emplace_back(std::min(a, b), std::max(a, b));
+                    continue;
+                }
+
+                stack[count++] = node.left;
+                stack[count++] = node.right;
+            }
+        }
+    });
+
+    for (int t = 0; t < threads; ++t)
+    {
+        pairs.insert(pairs.end(), chunkPairs[t].begin(), chunkPairs[t].end());
+    }
+}
@@ -0,0 +1,65 @@
+﻿#pragma once
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <utility>
+#include <vector>
+#include "AABB.h"
+
+class PhysicsWorld;
+class ThreadPool;
+
+/// \brief Linear BVH rebuilt from scratch every step, for scenes where everything moves.
+/// Bodies are sorted by Morton code, then every internal node finds its own key range and split
+/// independently (Karras 2012), so the whole hierarchy is built in parallel with no dependencies
+/// between nodes. Boxes are filled bottom up, the second child to arrive at a node computes it.
+class LinearBVH
+{
+public:
+
+    LinearBVH();
+
+    /// \brief Builds the hierarchy over the sphere boxes of every body in world
+    void Build(const PhysicsWorld& world, ThreadPool& pool);
+
+    /// \brief Every pair of bodies whose boxes overlap, (lower handle, higher handle).
+    /// Each thread walks the tree for its slice of leaves, slices are joined in order so the list is
+    /// the same for any thread count.
+    void FindPairs(ThreadPool& pool, std::vector<std::pair<int, int>>& pairs);
+
+    int GetLeafCount() const { return leafCount; }
+
+    /// Leaves cover everywhere their body can get in this much time, see PhysicsWorld::GetSweptAABB
+    float sweepTime = 0.0f;
+
+private:
+
+    // Internal nodes are [0, leafCount - 1), leaves come after them
+    struct Node
+    {
+        AABB box;
+        int left = -1;
+        int right = -1;
+        int parent = -1;
+        // Last leaf under this node, traversal skips subtrees that are entirely before the query leaf
+        int last = 0;
+    };
+
+    bool IsLeaf(int node) const { return node >= leafCount - 1; }
+
+    /// Length of the common prefix of the keys at sorted positions i and j, -1 if j is out of range
+    int Delta(int i, int j) const;
+
+    void BuildInternal(int i);
+
+    std::vector<uint32_t> codes;
+    std::vector<int> order;
+    std::vector<Node> nodes;
+    int leafCount = 0;
+
+    // Visits per internal node while boxes are filled bottom up
+    std::unique_ptr<std::atomic<int>[]> visits;
+    int visitsSize = 0;
+
+    std::vector<std::vector<std::pair<int, int>>> chunkPairs;
+};
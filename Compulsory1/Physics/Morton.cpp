@@ -0,0 +1,139 @@
+﻿#include "Morton.h"
+
+#include <algorithm>
+
+#include "ThreadPool.h"
+
+namespace
+{
+    /// Spreads the low 10 bits of v out so there are two zero bits between each
+    uint32_t ExpandBits(uint32_t v)
+    {
+        v = (v * 0x00010001u) & 0xFF0000FFu;
+        v = (v * 0x00000101u) & 0x0F00F00Fu;
+        v = (v * 0x00000011u) & 0xC30C30C3u;
+        v = (v * 0x00000005u) & 0x49249249u;
+        return v;
+    }
+
+    uint32_t Quantize(float value, float min, float extent)
+    {
+        float t = extent > 0.0f ? (value - min) / extent : 0.0f;
+        if (t < 0.0f) t = 0.0f;
+        if (t > 1.0f) t = 1.0f;
+        return (uint32_t)(t * 1023.0f);
+    }
+}
+
+uint32_t Morton::Encode(const glm::vec3& point, const AABB& bounds)
+{
+    // Same scale on every axis. Stretching a flat axis to 10 bits would make every third split in
+    // a Morton ordered tree cut through the thin side and cull nothing
+    glm::vec3 size = bounds.max - bounds.min;
+    float extent = glm::max(size.x, glm::max(size.y, size.z));
+
+    uint32_t x = Quantize(point.x, bounds.min.x, extent);
+    uint32_t y = Quantize(point.y, bounds.min.y, extent);
+    uint32_t z = Quantize(point.z, bounds.min.z, extent);
+    return (ExpandBits(x) << 2) | (ExpandBits(y) << 1) | ExpandBits(z);
+}
+
+void Morton::Sort(std::vector<uint32_t>& codes, std::vector<int>& order, ThreadPool& pool)
+{
+    const int count = (int)codes.size();
+    const int radix = 1 << 10;
+    const int threads = pool.GetThreadCount();
+
+    order.resize(count);
+    pool.ParallelFor(count, [&](int, int begin, int end)
+    {
+        for (int i = begin; i < end; ++i) order[i] = i;
+    });
+
+    std::vector<uint32_t> codesOut(count);
+    std::vector<int> orderOut(count);
+
+    // One histogram per slice. Slices are scattered in order, so the sort stays stable
+    std::vector<int> offsets((size_t)radix * threads);
+
+    for (int shift = 0; shift < 30; shift += 10)
+    {
+        // Zeroed here rather than in the job, ParallelFor skips slices that would be empty
+        std::fill(offsets.begin(), offsets.end(), 0);
+        pool.ParallelFor(count, [&](int chunk, int begin, int end)
+        {
+            int* histogram = &offsets[(size_t)chunk * radix];
+            for (int i = begin; i < end; ++i) histogram[(codes[i] >> shift) & (radix - 1)]++;
+        });
+
+        // Digit major, slice minor, so slice 0 of a digit lands before slice 1 of it
+        int sum = 0;
+        for (int d = 0; d < radix; ++d)
+        {
+            for (int t = 0; t < threads; ++t)
+            {
+                int& slot = offsets[(size_t)t * radix + d];
+                int digitCount = slot;
+                slot = sum;
+                sum += digitCount;
+            }
+        }
+
+        pool.ParallelFor(count, [&](int chunk, int begin, int end)
+        {
+            int* cursor = &offsets[(size_t)chunk * radix];
+            for (int i = begin; i < end; ++i)
+            {
+                int slot = cursor[(codes[i] >> shift) & (radix - 1)]++;
+                codesOut[slot] = codes[i];
+                orderOut[slot] = order[i];
+            }
+        });
+
+        codes.swap(codesOut);
+        order.swap(orderOut);
+    }
+}
+
+void Morton::Sort(std::vector<uint32_t>& codes, std::vector<int>& order)
+{
+    const int count = (int)codes.size();
+    const int radix = 1 << 10;
+
+    order.resize(count);
+    for (int i = 0; i < count; ++i)
+    {
+        order[i] = i;
+    }
+
+    std::vector<uint32_t> codesOut(count);
+    std::vector<int> orderOut(count);
+    std::vector<int> offsets(radix);
+
+    for (int shift = 0; shift < 30; shift += 10)
+    {
+        offsets.assign(radix, 0);
+        for (int i = 0; i < count; ++i)
+        {
+            offsets[(codes[i] >> shift) & (radix - 1)]++;
+        }
+
+        int sum = 0;
+        for (int d = 0; d < radix; ++d)
+        {
+            int digitCount = offsets[d];
+            offsets[d] = sum;
+            sum += digitCount;
+        }
+
+        for (int i = 0; i < count; ++i)
+        {
+            int slot = offsets[(codes[i] >> shift) & (radix - 1)]++;
+            codesOut[slot] = codes[i];
+            orderOut[slot] = order[i];
+        }
+
+        codes.swap(codesOut);
+        order.swap(orderOut);
+    }
+}
@@ -0,0 +1,23 @@
+﻿#pragma once
+#include <cstdint>
+#include <vector>
+#include "AABB.h"
+
+class ThreadPool;
+
+/// \brief Z-order curve helpers. Points close in space get close codes, so sorting by code puts
+/// neighbours next to each other in memory.
+namespace Morton
+{
+    /// \brief 30 bit code, 10 bits per axis
+    /// \param point position inside bounds, clamped to it otherwise. Every axis is scaled by the longest side
+    uint32_t Encode(const glm::vec3& point, const AABB& bounds);
+
+    /// \brief Stable LSD radix sort of 30 bit codes, three 10 bit passes
+    /// \param codes sorted in place
+    /// \param order filled with the original index of each sorted code
+    void Sort(std::vector<uint32_t>& codes, std::vector<int>& order);
+
+    /// \brief Same result as Sort, each pass counts and scatters one slice per thread of pool
+    void Sort(std::vector<uint32_t>& codes, std::vector<int>& order, ThreadPool& pool);
+}
@@ -0,0 +1,68 @@
+﻿#include "NeighbourList.h"
+
+#include "PhysicsWorld.h"
+
+NeighbourList::NeighbourList()
+{
+
+}
+
+bool NeighbourList::NeedsRebuild(const PhysicsWorld& world) const
+{
+    if ((int)buildX.size() != world.GetBodyCount()) return true;
+
+    // Two bodies each moving half the skin towards each other is the most the list can absorb.
+    // Sleeping bodies haven't moved since they were last awake, so only awake ones are checked
+    for (int body : world.activeBodies)
+    {
+        float limit = skin * 0.5f - world.GetReach(body, sweepTime);
+        if (limit < 0.0f) return true;
+
+        float dx = world.posX[body] - buildX[body];
+        float dy = world.posY[body] - buildY[body];
+        float dz = world.posZ[body] - buildZ[body];
+        if (dx * dx + dy * dy + dz * dz > limit * limit) return true;
+    }
+    return false;
+}
+
+bool NeighbourList::Update(const PhysicsWorld& world)
+{
+    if (!NeedsRebuild(world)) return false;
+
+    Build(world);
+    return true;
+}
+
+void NeighbourList::Build(const PhysicsWorld& world)
+{
+    rebuilds++;
+
+    // Cells wide enough that two spheres within skin of touching are never more than one cell apart
+    grid.margin = skin;
+    grid.Build(world);
+
+    buildX = world.posX;
+    buildY = world.posY;
+    buildZ = world.posZ;
+
+    pairs.clear();
+    const int count = world.GetBodyCount();
+    for (int i = 0; i < count; ++i)
+    {
+        grid.Neighbours(i, i, neighbours);
+
+        for (int j : neighbours)
+        {
+            float dx = world.posX[i] - world.posX[j];
+            float dy = world.posY[i] - world.posY[j];
+            float dz = world.posZ[i] - world.posZ[j];
+            float reach = world.radius[i] + world.radius[j] + skin;
+
+            if (dx * dx + dy * dy + dz * dz < reach * reach)
+            {
+                pairs.emplace_back(i, j);
+            }
+        }
+    }
+}
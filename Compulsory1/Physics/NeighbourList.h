@@ -0,0 +1,48 @@
+﻿#pragma once
+#include <utility>
+#include <vector>
+#include "SpatialGrid.h"
+
+class PhysicsWorld;
+
+/// \brief Verlet neighbour list broadphase.
+/// Every pair closer than the sum of their radii plus skin is stored, and the list is kept until some
+/// body has moved more than half the skin since it was built. Until then no two spheres that are
+/// missing from the list can have come into contact, so most frames skip the broadphase entirely.
+class NeighbourList
+{
+public:
+
+    NeighbourList();
+
+    /// \brief Rebuilds the list if any awake body has moved too far
+    /// \return true if it was rebuilt
+    bool Update(const PhysicsWorld& world);
+
+    void Build(const PhysicsWorld& world);
+
+    /// Every pair within skin of touching when the list was built, (lower handle, higher handle)
+    const std::vector<std::pair<int, int>>& GetPairs() const { return pairs; }
+
+    /// Extra distance around each sphere. Bigger means fewer rebuilds but more pairs to test
+    float skin = 0.1f;
+
+    /// The list is also rebuilt when a body could leave it within this much time, for solvers that
+    /// move the bodies after the pairs are read
+    float sweepTime = 0.0f;
+
+    // Times the list has been rebuilt since the start
+    int rebuilds = 0;
+
+private:
+
+    bool NeedsRebuild(const PhysicsWorld& world) const;
+
+    SpatialGrid grid;
+    std::vector<int> neighbours;
+
+    std::vector<std::pair<int, int>> pairs;
+
+    // Positions when the list was last built
+    std::vector<float> buildX, buildY, buildZ;
+};
@@ -0,0 +1,54 @@
+﻿#pragma once
+#include "glm/vec3.hpp"
+#include "glm/geometric.hpp"
+#include "AABB.h"
+
+/// \brief Box rotated into world space, see Mesh::CalculateOrientedBox
+struct OBB
+{
+    OBB() : center(0.0f), halfExtents(0.0f)
+    {
+        axes[0] = glm::vec3(1.0f, 0.0f, 0.0f);
+        axes[1] = glm::vec3(0.0f, 1.0f, 0.0f);
+        axes[2] = glm::vec3(0.0f, 0.0f, 1.0f);
+    }
+
+    explicit OBB(const AABB& box) : OBB()
+    {
+        center = (box.min + box.max) * 0.5f;
+        halfExtents = (box.max - box.min) * 0.5f;
+    }
+
+    glm::vec3 center;
+    // Unit length and perpendicular to each other
+    glm::vec3 axes[3];
+    glm::vec3 halfExtents;
+
+    /// \brief Point in the box's own frame, x along axes[0] and so on, origin at center
+    glm::vec3 ToLocal(const glm::vec3& point) const
+    {
+        glm::vec3 offset = point - center;
+        return glm::vec3(glm::dot(offset, axes[0]), glm::dot(offset, axes[1]), glm::dot(offset, axes[2]));
+    }
+
+    glm::vec3 ToWorld(const glm::vec3& local) const
+    {
+        return center + axes[0] * local.x + axes[1] * local.y + axes[2] * local.z;
+    }
+
+    /// \brief Direction in the box's own frame back to world space
+    glm::vec3 ToWorldDirection(const glm::vec3& local) const
+    {
+        return axes[0] * local.x + axes[1] * local.y + axes[2] * local.z;
+    }
+
+    /// \brief Smallest world AABB around the box
+    AABB GetAABB() const
+    {
+        glm::vec3 extent =
+            glm::abs(axes[0]) * halfExtents.x +
+            glm::abs(axes[1]) * halfExtents.y +
+            glm::abs(axes[2]) * halfExtents.z;
+        return AABB(center - extent, center + extent);
+    }
+};
@@ -0,0 +1,496 @@
+﻿#include "PhysicsWorld.h"
+
+#include <cmath>
+#include <immintrin.h>
+
+#include "glm/geometric.hpp"
+#include "glm/matrix.hpp"
+#include "JobSystem.h"
+#include "Morton.h"
+
+namespace
+{
+    /// values[i] = old values[order[i]]
+    template <typename T>
+    void Permute(std::vector<T>& values, const std::vector<int>& order, std::vector<T>& scratch)
+    {
+        scratch.resize(values.size());
+        for (size_t i = 0; i < order.size(); ++i)
+        {
+            scratch[i] = values[order[i]];
+        }
+        values.swap(scratch);
+    }
+
+    // Bodies per job when integrating in parallel, below this a job costs more to hand out than it saves
+    const int IntegrateGrainSize = 4096;
+
+    inline __m128 Load4(const float* values, const int* bodies, int first)
+    {
+        if (!bodies) return _mm_loadu_ps(values + first);
+        return _mm_set_ps(values[bodies[first + 3]], values[bodies[first + 2]], values[bodies[first + 1]], values[bodies[first]]);
+    }
+
+    inline void Store4(float* values, const int* bodies, int first, __m128 value)
+    {
+        if (!bodies)
+        {
+            _mm_storeu_ps(values + first, value);
+            return;
+        }
+
+        alignas(16) float lanes[4];
+        _mm_store_ps(lanes, value);
+        for (int l = 0; l < 4; ++l) values[bodies[first + l]] = lanes[l];
+    }
+
+    /// \brief q += 0.5 * (0, w) * q * deltaTime, then normalized, for bodies [begin, end).
+    /// \param bodies handles to turn, or null for the bodies numbered begin to end
+    void IntegrateOrientations(PhysicsWorld& world, const int* bodies, int begin, int end, float deltaTime)
+    {
+        float* qx = world.rotX.data();
+        float* qy = world.rotY.data();
+        float* qz = world.rotZ.data();
+        float* qw = world.rotW.data();
+        const float* wx = world.angVelX.data();
+        const float* wy = world.angVelY.data();
+        const float* wz = world.angVelZ.data();
+
+        const __m128 half = _mm_set1_ps(0.5f * deltaTime);
+        const __m128 one = _mm_set1_ps(1.0f);
+
+        int i = begin;
+        for (; i + 4 <= end; i += 4)
+        {
+            __m128 ax = Load4(wx, bodies, i);
+            __m128 ay = Load4(wy, bodies, i);
+            __m128 az = Load4(wz, bodies, i);
+
+            // Most bodies don't spin, skip groups where none of them do
+            __m128 zero = _mm_setzero_ps();
+            __m128 still = _mm_and_ps(_mm_and_ps(_mm_cmpeq_ps(ax, zero), _mm_cmpeq_ps(ay, zero)), _mm_cmpeq_ps(az, zero));
+            if (_mm_movemask_ps(still) == 0xF) continue;
+
+            __m128 x = Load4(qx, bodies, i);
+            __m128 y = Load4(qy, bodies, i);
+            __m128 z = Load4(qz, bodies, i);
+            __m128 w = Load4(qw, bodies, i);
+
+            // (0, a) * (v, w) = (w a + a x v, -a . v)
+            __m128 dx = _mm_add_ps(_mm_mul_ps(w, ax), _mm_sub_ps(_mm_mul_ps(ay, z), _mm_mul_ps(az, y)));
+            __m128 dy = _mm_add_ps(_mm_mul_ps(w, ay), _mm_sub_ps(_mm_mul_ps(az, x), _mm_mul_ps(ax, z)));
+            __m128 dz = _mm_add_ps(_mm_mul_ps(w, az), _mm_sub_ps(_mm_mul_ps(ax, y), _mm_mul_ps(ay, x)));
+            __m128 dw = _mm_add_ps(_mm_add_ps(_mm_mul_ps(ax, x), _mm_mul_ps(ay, y)), _mm_mul_ps(az, z));
+
+            x = _mm_add_ps(x, _mm_mul_ps(dx, half));
+            y = _mm_add_ps(y, _mm_mul_ps(dy, half));
+            z = _mm_add_ps(z, _mm_mul_ps(dz, half));
+            w = _mm_sub_ps(w, _mm_mul_ps(dw, half));
+
+            __m128 lengthSq = _mm_add_ps(_mm_add_ps(_mm_mul_ps(x, x), _mm_mul_ps(y, y)), _mm_add_ps(_mm_mul_ps(z, z), _mm_mul_ps(w, w)));
+            __m128 invLength = _mm_div_ps(one, _mm_sqrt_ps(lengthSq));
+
+            Store4(qx, bodies, i, _mm_mul_ps(x, invLength));
+            Store4(qy, bodies, i, _mm_mul_ps(y, invLength));
+            Store4(qz, bodies, i, _mm_mul_ps(z, invLength));
+            Store4(qw, bodies, i, _mm_mul_ps(w, invLength));
+        }
+
+        // Same operations in the same order as above, so where the groups of 4 start doesn't change the result
+        const float halfStep = 0.5f * deltaTime;
+        for (; i < end; ++i)
+        {
+            int body = bodies ? bodies[i] : i;
+            float ax = wx[body], ay = wy[body], az = wz[body];
+            if (ax == 0.0f && ay == 0.0f && az == 0.0f) continue;
+
+            float x = qx[body], y = qy[body], z = qz[body], w = qw[body];
+            float dx = w * ax + (ay * z - az * y);
+            float dy = w * ay + (az * x - ax * z);
+            float dz = w * az + (ax * y - ay * x);
+            float dw = (ax * x + ay * y) + az * z;
+
+            x += dx * halfStep;
+            y += dy * halfStep;
+            z += dz * halfStep;
+            w -= dw * halfStep;
+
+            float invLength = 1.0f / std::sqrt((x * x + y * y) + (z * z + w * w));
+            qx[body] = x * invLength;
+            qy[body] = y * invLength;
+            qz[body] = z * invLength;
+            qw[body] = w * invLength;
+        }
+    }
+}
+
+PhysicsWorld::PhysicsWorld()
+{
+
+}
+
+int PhysicsWorld::AddBody(const glm::vec3& position, const glm::vec3& velocity, float bodyRadius, float mass)
+{
+    posX.push_back(position.x);
+    posY.push_back(position.y);
+    posZ.push_back(position.z);
+
+    prevX.push_back(position.x);
+    prevY.push_back(position.y);
+    prevZ.push_back(position.z);
+
+    velX.push_back(velocity.x);
+    velY.push_back(velocity.y);
+    velZ.push_back(velocity.z);
+
+    radius.push_back(bodyRadius);
+    // Zero mass means the body is immovable
+    invMass.push_back(mass > 0.0f ? 1.0f / mass : 0.0f);
+
+    rotX.push_back(0.0f);
+    rotY.push_back(0.0f);
+    rotZ.push_back(0.0f);
+    rotW.push_back(1.0f);
+    angVelX.push_back(0.0f);
+    angVelY.push_back(0.0f);
+    angVelZ.push_back(0.0f);
+
+    // Solid sphere, 2/5 m r^2 about every axis
+    float invInertia = mass > 0.0f && bodyRadius > 0.0f ? 1.0f / (0.4f * mass * bodyRadius * bodyRadius) : 0.0f;
+    invInertiaX.push_back(invInertia);
+    invInertiaY.push_back(invInertia);
+    invInertiaZ.push_back(invInertia);
+
+    // New bodies start awake and settle on their own
+    int body = (int)radius.size() - 1;
+    awake.push_back(1);
+    slowSteps.push_back(0);
+    activeBodies.push_back(body);
+
+    return body;
+}
+
+void PhysicsWorld::Integrate(float deltaTime)
+{
+    const int count = GetBodyCount();
+    const int activeCount = GetActiveCount();
+
+    float* px = posX.data();
+    float* py = posY.data();
+    float* pz = posZ.data();
+    float* vx = velX.data();
+    float* vy = velY.data();
+    float* vz = velZ.data();
+    const float* im = invMass.data();
+    const glm::vec3 fall = gravity * deltaTime;
+
+    if (activeCount == count)
+    {
+        // One straight pass per axis, the compiler vectorizes these. Bodies with no mass don't fall,
+        // picked with a select rather than a branch so the loops stay vectorized
+        for (int i = 0; i < count; ++i) vx[i] += im[i] > 0.0f ? fall.x : 0.0f;
+        for (int i = 0; i < count; ++i) vy[i] += im[i] > 0.0f ? fall.y : 0.0f;
+        for (int i = 0; i < count; ++i) vz[i] += im[i] > 0.0f ? fall.z : 0.0f;
+        for (int i = 0; i < count; ++i) px[i] += vx[i] * deltaTime;
+        for (int i = 0; i < count; ++i) py[i] += vy[i] * deltaTime;
+        for (int i = 0; i < count; ++i) pz[i] += vz[i] * deltaTime;
+        IntegrateOrientations(*this, nullptr, 0, count, deltaTime);
+        return;
+    }
+
+    for (int body : activeBodies)
+    {
+        if (im[body] > 0.0f)
+        {
+            vx[body] += fall.x;
+            vy[body] += fall.y;
+            vz[body] += fall.z;
+        }
+        px[body] += vx[body] * deltaTime;
+        py[body] += vy[body] * deltaTime;
+        pz[body] += vz[body] * deltaTime;
+    }
+    IntegrateOrientations(*this, activeBodies.data(), 0, activeCount, deltaTime);
+}
+
+void PhysicsWorld::Integrate(float deltaTime, JobSystem& jobs)
+{
+    const int count = GetBodyCount();
+    const int activeCount = GetActiveCount();
+
+    float* px = posX.data();
+    float* py = posY.data();
+    float* pz = posZ.data();
+    float* vx = velX.data();
+    float* vy = velY.data();
+    float* vz = velZ.data();
+    const float* im = invMass.data();
+    const glm::vec3 fall = gravity * deltaTime;
+    PhysicsWorld* world = this;
+
+    if (activeCount == count)
+    {
+        jobs.ParallelFor(count, IntegrateGrainSize, [=](int begin, int end)
+        {
+            for (int i = begin; i < end; ++i) vx[i] += im[i] > 0.0f ? fall.x : 0.0f;
+            for (int i = begin; i < end; ++i) vy[i] += im[i] > 0.0f ? fall.y : 0.0f;
+            for (int i = begin; i < end; ++i) vz[i] += im[i] > 0.0f ? fall.z : 0.0f;
+            for (int i = begin; i < end; ++i) px[i] += vx[i] * deltaTime;
+            for (int i = begin; i < end; ++i) py[i] += vy[i] * deltaTime;
+            for (int i = begin; i < end; ++i) pz[i] += vz[i] * deltaTime;
+            IntegrateOrientations(*world, nullptr, begin, end, deltaTime);
+        });
+        return;
+    }
+
+    const int* active = activeBodies.data();
+    jobs.ParallelFor(activeCount, IntegrateGrainSize, [=](int begin, int end)
+    {
+        for (int a = begin; a < end; ++a)
+        {
+            int body = active[a];
+            if (im[body] > 0.0f)
+            {
+                vx[body] += fall.x;
+                vy[body] += fall.y;
+                vz[body] += fall.z;
+            }
+            px[body] += vx[body] * deltaTime;
+            py[body] += vy[body] * deltaTime;
+            pz[body] += vz[body] * deltaTime;
+        }
+        IntegrateOrientations(*world, active, begin, end, deltaTime);
+    });
+}
+
+void PhysicsWorld::UpdateSleeping()
+{
+    const float sleepVelocitySq = sleepVelocity * sleepVelocity;
+
+    // Compact in place so the remaining bodies keep their order
+    int kept = 0;
+    for (int body : activeBodies)
+    {
+        float speedSq = velX[body] * velX[body] + velY[body] * velY[body] + velZ[body] * velZ[body];
+        // Surface speed of the spin, so a ball turning in place stays awake too
+        float spinSq = (angVelX[body] * angVelX[body] + angVelY[body] * angVelY[body] + angVelZ[body] * angVelZ[body]) * radius[body] * radius[body];
+        slowSteps[body] = speedSq < sleepVelocitySq && spinSq < sleepVelocitySq ? slowSteps[body] + 1 : 0;
+
+        if (slowSteps[body] >= sleepSteps)
+        {
+            awake[body] = 0;
+            velX[body] = 0.0f;
+            velY[body] = 0.0f;
+            velZ[body] = 0.0f;
+            angVelX[body] = 0.0f;
+            angVelY[body] = 0.0f;
+            angVelZ[body] = 0.0f;
+
+            // Nothing refreshes prev while it sleeps, so it has to stop where it is
+            prevX[body] = posX[body];
+            prevY[body] = posY[body];
+            prevZ[body] = posZ[body];
+            continue;
+        }
+        activeBodies[kept++] = body;
+    }
+    activeBodies.resize(kept);
+}
+
+void PhysicsWorld::WakeBody(int body)
+{
+    if (awake[body]) return;
+
+    awake[body] = 1;
+    slowSteps[body] = 0;
+    activeBodies.push_back(body);
+}
+
+void PhysicsWorld::SavePreviousPositions()
+{
+    for (int body : activeBodies)
+    {
+        prevX[body] = posX[body];
+        prevY[body] = posY[body];
+        prevZ[body] = posZ[body];
+    }
+}
+
+void PhysicsWorld::SavePreviousPositions(JobSystem& jobs)
+{
+    jobs.ParallelFor(GetActiveCount(), IntegrateGrainSize, [this](int begin, int end)
+    {
+        for (int a = begin; a < end; ++a)
+        {
+            int body = activeBodies[a];
+            prevX[body] = posX[body];
+            prevY[body] = posY[body];
+            prevZ[body] = posZ[body];
+        }
+    });
+}
+
+glm::vec3 PhysicsWorld::GetInterpolatedPosition(int body, float alpha) const
+{
+    return glm::vec3(
+        prevX[body] + (posX[body] - prevX[body]) * alpha,
+        prevY[body] + (posY[body] - prevY[body]) * alpha,
+        prevZ[body] + (posZ[body] - prevZ[body]) * alpha);
+}
+
+void PhysicsWorld::SetPosition(int body, const glm::vec3& position)
+{
+    posX[body] = position.x;
+    posY[body] = position.y;
+    posZ[body] = position.z;
+}
+
+void PhysicsWorld::SetVelocity(int body, const glm::vec3& velocity)
+{
+    if (velocity != glm::vec3(0.0f))
+    {
+        WakeBody(body);
+    }
+
+    velX[body] = velocity.x;
+    velY[body] = velocity.y;
+    velZ[body] = velocity.z;
+}
+
+void PhysicsWorld::SetOrientation(int body, const glm::quat& orientation)
+{
+    glm::quat normalized = glm::normalize(orientation);
+    rotX[body] = normalized.x;
+    rotY[body] = normalized.y;
+    rotZ[body] = normalized.z;
+    rotW[body] = normalized.w;
+}
+
+void PhysicsWorld::SetAngularVelocity(int body, const glm::vec3& angularVelocity)
+{
+    if (angularVelocity != glm::vec3(0.0f))
+    {
+        WakeBody(body);
+    }
+
+    angVelX[body] = angularVelocity.x;
+    angVelY[body] = angularVelocity.y;
+    angVelZ[body] = angularVelocity.z;
+}
+
+void PhysicsWorld::SetInertia(int body, const glm::vec3& principalMoments)
+{
+    invInertiaX[body] = principalMoments.x > 0.0f && invMass[body] > 0.0f ? 1.0f / principalMoments.x : 0.0f;
+    invInertiaY[body] = principalMoments.y > 0.0f && invMass[body] > 0.0f ? 1.0f / principalMoments.y : 0.0f;
+    invInertiaZ[body] = principalMoments.z > 0.0f && invMass[body] > 0.0f ? 1.0f / principalMoments.z : 0.0f;
+}
+
+glm::mat3 PhysicsWorld::GetInverseInertiaWorld(int body) const
+{
+    // R * diagonal * R^T, the columns of R are the body axes
+    glm::mat3 rotation = glm::mat3_cast(GetOrientation(body));
+    glm::mat3 scaled = rotation;
+    scaled[0] *= invInertiaX[body];
+    scaled[1] *= invInertiaY[body];
+    scaled[2] *= invInertiaZ[body];
+    return scaled * glm::transpose(rotation);
+}
+
+void PhysicsWorld::ApplyImpulse(int body, const glm::vec3& impulse, const glm::vec3& point)
+{
+    glm::vec3 arm = point - GetPosition(body);
+    SetVelocity(body, GetVelocity(body) + impulse * invMass[body]);
+    SetAngularVelocity(body, GetAngularVelocity(body) + GetInverseInertiaWorld(body) * glm::cross(arm, impulse));
+}
+
+AABB PhysicsWorld::GetAABB(int body) const
+{
+    glm::vec3 extent(radius[body]);
+    glm::vec3 position = GetPosition(body);
+    return AABB(position - extent, position + extent);
+}
+
+float PhysicsWorld::GetReach(int body, float deltaTime) const
+{
+    float fall = invMass[body] > 0.0f ? 0.5f * glm::length(gravity) * deltaTime * deltaTime : 0.0f;
+    return glm::length(GetVelocity(body)) * deltaTime + fall;
+}
+
+AABB PhysicsWorld::GetSweptAABB(int body, float deltaTime) const
+{
+    glm::vec3 extent(radius[body] + GetReach(body, deltaTime));
+    glm::vec3 position = GetPosition(body);
+    return AABB(position - extent, position + extent);
+}
+
+AABB PhysicsWorld::GetBounds() const
+{
+    const int count = GetBodyCount();
+    if (count == 0) return AABB();
+
+    AABB bounds(GetPosition(0), GetPosition(0));
+    for (int i = 1; i < count; ++i)
+    {
+        bounds.min = glm::min(bounds.min, GetPosition(i));
+        bounds.max = glm::max(bounds.max, GetPosition(i));
+    }
+    return bounds;
+}
+
+std::vector<int> PhysicsWorld::SortByMorton()
+{
+    const int count = GetBodyCount();
+    const AABB bounds = GetBounds();
+
+    std::vector<uint32_t> codes(count);
+    for (int i = 0; i < count; ++i)
+    {
+        codes[i] = Morton::Encode(GetPosition(i), bounds);
+    }
+
+    std::vector<int> order;
+    Morton::Sort(codes, order);
+
+    std::vector<float> scratch;
+    Permute(posX, order, scratch);
+    Permute(posY, order, scratch);
+    Permute(posZ, order, scratch);
+    Permute(prevX, order, scratch);
+    Permute(prevY, order, scratch);
+    Permute(prevZ, order, scratch);
+    Permute(velX, order, scratch);
+    Permute(velY, order, scratch);
+    Permute(velZ, order, scratch);
+    Permute(radius, order, scratch);
+    Permute(invMass, order, scratch);
+    Permute(rotX, order, scratch);
+    Permute(rotY, order, scratch);
+    Permute(rotZ, order, scratch);
+    Permute(rotW, order, scratch);
+    Permute(angVelX, order, scratch);
+    Permute(angVelY, order, scratch);
+    Permute(angVelZ, order, scratch);
+    Permute(invInertiaX, order, scratch);
+    Permute(invInertiaY, order, scratch);
+    Permute(invInertiaZ, order, scratch);
+
+    std::vector<uint8_t> awakeScratch;
+    Permute(awake, order, awakeScratch);
+    std::vector<int> intScratch;
+    Permute(slowSteps, order, intScratch);
+
+    std::vector<int> oldToNew(count);
+    for (int i = 0; i < count; ++i)
+    {
+        oldToNew[order[i]] = i;
+    }
+
+    // Walk the awake bodies in memory order from now on too
+    activeBodies.clear();
+    for (int i = 0; i < count; ++i)
+    {
+        if (awake[i]) activeBodies.push_back(i);
+    }
+
+    return oldToNew;
+}
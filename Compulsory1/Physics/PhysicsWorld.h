@@ -0,0 +1,126 @@
+﻿#pragma once
+#include <cstdint>
+#include <vector>
+#include "glm/vec3.hpp"
+#include "glm/mat3x3.hpp"
+#include "glm/gtc/quaternion.hpp"
+#include "AABB.h"
+
+class JobSystem;
+
+/// \brief Sphere bodies stored as structure of arrays.
+/// Position, velocity, radius and inverse mass each live in their own contiguous array so
+/// integration and collision stream through memory instead of hopping between Mesh objects.
+/// Meshes only keep Mesh::physicsHandle, the renderer copies positions back before drawing.
+/// Bodies that stay slower than sleepVelocity for sleepSteps steps go to sleep. Sleeping bodies
+/// are left out of activeBodies, so integration and the broadphases never visit them.
+/// The positions at the start of the last step are kept so the renderer can blend between steps.
+/// Every body also has an orientation and an angular velocity, turned 4 bodies at a time with SSE.
+/// Only ContactSolver changes the spin in a contact. Collision and PositionSolver are frictionless, and a
+/// push along the normal of two spheres goes through both centres, so they leave it as it was.
+class PhysicsWorld
+{
+public:
+
+    PhysicsWorld();
+
+    /// \return handle of the new body, bodies are never removed so handles stay valid
+    int AddBody(const glm::vec3& position, const glm::vec3& velocity, float radius, float mass);
+
+    int GetBodyCount() const { return (int)radius.size(); }
+
+    /// \brief Speeds up every awake body with mass by gravity, then moves and turns it.
+    /// Angular velocity is held constant between impulses, which is exact for spheres and cubes and
+    /// leaves out the small gyroscopic wobble of shapes with three different moments of inertia.
+    void Integrate(float deltaTime);
+
+    /// \brief Same as Integrate, with the bodies split across the threads of jobs.
+    /// Bodies don't touch each other here, so the result is the same for any thread count.
+    void Integrate(float deltaTime, JobSystem& jobs);
+
+    /// \brief Counts steps each awake body has been slow and puts it to sleep after sleepSteps.
+    /// Call once per step after collision response.
+    void UpdateSleeping();
+
+    /// \brief Copies the current position of every awake body into prevX/Y/Z, call at the start of a step
+    void SavePreviousPositions();
+    void SavePreviousPositions(JobSystem& jobs);
+
+    /// \param alpha 0 gives the position before the last step, 1 the position after it
+    glm::vec3 GetInterpolatedPosition(int body, float alpha) const;
+
+    /// \brief Puts a sleeping body back in activeBodies, does nothing if it is already awake
+    void WakeBody(int body);
+
+    bool IsAwake(int body) const { return awake[body] != 0; }
+
+    int GetActiveCount() const { return (int)activeBodies.size(); }
+
+    glm::vec3 GetPosition(int body) const { return glm::vec3(posX[body], posY[body], posZ[body]); }
+    glm::vec3 GetVelocity(int body) const { return glm::vec3(velX[body], velY[body], velZ[body]); }
+
+    void SetPosition(int body, const glm::vec3& position);
+
+    /// \brief Also wakes the body unless the new velocity is zero
+    void SetVelocity(int body, const glm::vec3& velocity);
+
+    glm::quat GetOrientation(int body) const { return glm::quat(rotW[body], rotX[body], rotY[body], rotZ[body]); }
+    glm::vec3 GetAngularVelocity(int body) const { return glm::vec3(angVelX[body], angVelY[body], angVelZ[body]); }
+
+    void SetOrientation(int body, const glm::quat& orientation);
+
+    /// \brief In world space and radians per second, also wakes the body unless it is zero
+    void SetAngularVelocity(int body, const glm::vec3& angularVelocity);
+
+    /// \brief Replaces the solid sphere inertia AddBody gives every body, see Mesh::CalculateInertia
+    /// \param principalMoments moments of inertia about the body's own x, y and z axes
+    void SetInertia(int body, const glm::vec3& principalMoments);
+
+    /// \brief Inverse inertia tensor turned into world space by the current orientation
+    glm::mat3 GetInverseInertiaWorld(int body) const;
+
+    /// \brief Pushes the body at point, so an impulse off the centre also changes its spin. Wakes the body.
+    /// \param point in world space
+    void ApplyImpulse(int body, const glm::vec3& impulse, const glm::vec3& point);
+
+    AABB GetAABB(int body) const;
+
+    /// \brief How far body can get in deltaTime at its current velocity, plus the fall under gravity
+    float GetReach(int body, float deltaTime) const;
+
+    /// \brief GetAABB grown by GetReach on every side, for solvers that move the bodies after the pairs are found
+    AABB GetSweptAABB(int body, float deltaTime) const;
+
+    /// \brief Box around every body centre
+    AABB GetBounds() const;
+
+    /// \brief Renumbers the bodies along a Morton curve so bodies close in space sit close in memory.
+    /// Handles change, everything holding one has to be remapped with the result.
+    /// \return oldToNew, the new handle of every old handle
+    std::vector<int> SortByMorton();
+
+    std::vector<float> posX, posY, posZ;
+    std::vector<float> prevX, prevY, prevZ;
+    std::vector<float> velX, velY, velZ;
+    std::vector<float> radius;
+    std::vector<float> invMass;
+
+    // Unit quaternion, angular velocity in world space, and one over the principal moments of inertia
+    // in the body's own frame. Zero inverse inertia means the body never turns
+    std::vector<float> rotX, rotY, rotZ, rotW;
+    std::vector<float> angVelX, angVelY, angVelZ;
+    std::vector<float> invInertiaX, invInertiaY, invInertiaZ;
+
+    // 1 if awake, and how many steps in a row the body has been below sleepVelocity
+    std::vector<uint8_t> awake;
+    std::vector<int> slowSteps;
+
+    /// Handles of every awake body, in the order they were woken
+    std::vector<int> activeBodies;
+
+    /// Acceleration given to every body with mass, off by default like the rest of the scene
+    glm::vec3 gravity = glm::vec3(0.0f);
+
+    float sleepVelocity = 0.05f;
+    int sleepSteps = 60;
+};
@@ -0,0 +1,547 @@
+﻿#include "PositionSolver.h"
+
+#include <algorithm>
+#include <cmath>
+#include <functional>
+
+#include "glm/geometric.hpp"
+#include "../Collision.h"
+#include "CollisionEvents.h"
+#include "JobSystem.h"
+#include "PhysicsWorld.h"
+
+namespace
+{
+    // Bodies per job, the work per body is a handful of constraints
+    const int SolveGrainSize = 1024;
+
+    // Contacts further apart than this times their rest length after the position pass have come apart
+    const float ContactTolerance = 1.001f;
+
+    /// \brief How much of the slide since the start of the substep friction takes back.
+    /// All of it if the slide is shorter than friction times the overlap just pushed out, else that much of it
+    glm::vec3 FrictionCorrection(const glm::vec3& moved, const glm::vec3& normal, float depth, float friction)
+    {
+        glm::vec3 tangent = moved - normal * glm::dot(moved, normal);
+        float slide = glm::length(tangent);
+        float limit = friction * depth;
+        if (slide <= limit) return tangent;
+        return tangent * (limit / slide);
+    }
+}
+
+PositionSolver::PositionSolver()
+{
+
+}
+
+int PositionSolver::AddDistanceConstraint(int body1, int body2, float restLength, float compliance)
+{
+    distanceConstraints.push_back({ body1, body2, restLength, compliance, false });
+    return (int)distanceConstraints.size() - 1;
+}
+
+void PositionSolver::RemapBodies(const std::vector<int>& oldToNew)
+{
+    for (Constraint& constraint : distanceConstraints)
+    {
+        constraint.body1 = oldToNew[constraint.body1];
+        constraint.body2 = oldToNew[constraint.body2];
+    }
+}
+
+int PositionSolver::Step(PhysicsWorld& world, float deltaTime, const std::vector<std::pair<int, int>>& pairs,
+    const std::vector<std::pair<int, int>>& wallPairs, const std::vector<OBB>& walls)
+{
+    return Run(world, deltaTime, pairs, wallPairs, walls, nullptr);
+}
+
+int PositionSolver::Step(PhysicsWorld& world, float deltaTime, const std::vector<std::pair<int, int>>& pairs,
+    const std::vector<std::pair<int, int>>& wallPairs, const std::vector<OBB>& walls, JobSystem& jobs)
+{
+    return Run(world, deltaTime, pairs, wallPairs, walls, &jobs);
+}
+
+int PositionSolver::Run(PhysicsWorld& world, float deltaTime, const std::vector<std::pair<int, int>>& pairs,
+    const std::vector<std::pair<int, int>>& wallPairs, const std::vector<OBB>& walls, JobSystem* jobs)
+{
+    int touching = Prepare(world, deltaTime, pairs, wallPairs, walls);
+
+    const int count = (int)bodies.size();
+    const float substepTime = deltaTime / std::max(substeps, 1);
+    // XPBD scales compliance by the substep, so a soft link is as soft for any substep count
+    const float complianceScale = 1.0f / (substepTime * substepTime);
+
+    auto forBodies = [count, jobs](const std::function<void(int, int)>& work)
+    {
+        if (jobs) jobs->ParallelFor(count, SolveGrainSize, work);
+        else work(0, count);
+    };
+
+    for (int substep = 0; substep < std::max(substeps, 1); ++substep)
+    {
+        forBodies([&](int begin, int end) { Predict(world, begin, end, substepTime); });
+
+        for (int iteration = 0; iteration < iterations; ++iteration)
+        {
+            if (!jobs)
+            {
+                SolveGaussSeidel(world, complianceScale);
+                for (int body : bodies) ProjectBoundary(world, body, walls);
+                continue;
+            }
+
+            // Every body reads the positions of the last pass and writes only its own result
+            forBodies([&](int begin, int end) { SolveJacobi(world, begin, end, complianceScale); });
+            forBodies([&](int begin, int end)
+            {
+                for (int a = begin; a < end; ++a)
+                {
+                    int body = bodies[a];
+                    world.posX[body] = nextX[body];
+                    world.posY[body] = nextY[body];
+                    world.posZ[body] = nextZ[body];
+                    ProjectBoundary(world, body, walls);
+                }
+            });
+        }
+
+        forBodies([&](int begin, int end) { UpdateVelocities(world, begin, end, substepTime); });
+
+        // Contacts leave with the speed the bounce gives them, not with whatever pushing out old overlap
+        // would add, which is what keeps a squeezed pile from gaining energy
+        if (!jobs)
+        {
+            SolveVelocitiesGaussSeidel(world);
+            for (int body : bodies) world.SetVelocity(body, glm::vec3(velocityX[body], velocityY[body], velocityZ[body]));
+            continue;
+        }
+
+        forBodies([&](int begin, int end) { SolveVelocitiesJacobi(world, begin, end); });
+        forBodies([&](int begin, int end)
+        {
+            for (int a = begin; a < end; ++a)
+            {
+                int body = bodies[a];
+                world.velX[body] = nextX[body];
+                world.velY[body] = nextY[body];
+                world.velZ[body] = nextZ[body];
+            }
+        });
+    }
+
+    if (events) PushEvents(world, deltaTime);
+    return touching;
+}
+
+int PositionSolver::Prepare(PhysicsWorld& world, float deltaTime, const std::vector<std::pair<int, int>>& pairs,
+    const std::vector<std::pair<int, int>>& wallPairs, const std::vector<OBB>& walls)
+{
+    const int bodyCount = world.GetBodyCount();
+    int touching = 0;
+    touchingContacts.clear();
+
+    // A link can't pull on a body that stays asleep, so anything linked to a moving body moves too. A body
+    // that is only settling leaves its sleeping partner alone and hangs off it, otherwise the links of a chain
+    // would take turns falling asleep and waking each other forever
+    for (const Constraint& constraint : distanceConstraints)
+    {
+        if (world.IsAwake(constraint.body1) == world.IsAwake(constraint.body2)) continue;
+
+        int mover = world.IsAwake(constraint.body1) ? constraint.body1 : constraint.body2;
+        if (world.slowSteps[mover] == 0) world.WakeBody(mover == constraint.body1 ? constraint.body2 : constraint.body1);
+    }
+
+    // Like ContactSolver, a sleeping sphere is only woken by something that reaches it this step faster
+    // than sleepVelocity. Anything slower rests on it as if it were part of the floor
+    for (const std::pair<int, int>& pair : pairs)
+    {
+        int body1 = pair.first;
+        int body2 = pair.second;
+        if (!world.IsAwake(body1) && !world.IsAwake(body2)) continue;
+
+        glm::vec3 offset = world.GetPosition(body1) - world.GetPosition(body2);
+        float distance = glm::length(offset);
+        float gap = distance - world.radius[body1] - world.radius[body2];
+        glm::vec3 normal = distance > 0.0f ? offset / distance : glm::vec3(0.0f, 1.0f, 0.0f);
+        glm::vec3 velocity = world.GetVelocity(body1) - world.GetVelocity(body2);
+        float approach = -glm::dot(velocity, normal);
+        if (gap < 0.0f) touching++;
+        if (gap < 0.0f || gap < approach * deltaTime)
+        {
+            touchingContacts.push_back({ body1, body2, normal, std::max(0.0f, -gap), gap < 0.0f, velocity });
+        }
+        if (world.IsAwake(body1) && world.IsAwake(body2)) continue;
+
+        if (approach > world.sleepVelocity && gap < approach * deltaTime)
+        {
+            world.WakeBody(body1);
+            world.WakeBody(body2);
+        }
+    }
+
+    bodies = world.activeBodies;
+    weight.resize(bodyCount);
+    for (int body = 0; body < bodyCount; ++body)
+    {
+        weight[body] = world.IsAwake(body) ? world.invMass[body] : 0.0f;
+    }
+
+    constraints = distanceConstraints;
+    for (const std::pair<int, int>& pair : pairs)
+    {
+        if (!world.IsAwake(pair.first) && !world.IsAwake(pair.second)) continue;
+        constraints.push_back({ pair.first, pair.second, world.radius[pair.first] + world.radius[pair.second], contactCompliance, true });
+    }
+
+    // Constraints and walls of each moving body, counted first and then filled in
+    constraintStart.assign(bodyCount + 1, 0);
+    for (const Constraint& constraint : constraints)
+    {
+        if (world.IsAwake(constraint.body1)) constraintStart[constraint.body1 + 1]++;
+        if (world.IsAwake(constraint.body2)) constraintStart[constraint.body2 + 1]++;
+    }
+    for (int body = 0; body < bodyCount; ++body) constraintStart[body + 1] += constraintStart[body];
+
+    bodyConstraints.resize(constraintStart[bodyCount]);
+    std::vector<int> fill(constraintStart.begin(), constraintStart.end() - 1);
+    for (int c = 0; c < (int)constraints.size(); ++c)
+    {
+        if (world.IsAwake(constraints[c].body1)) bodyConstraints[fill[constraints[c].body1]++] = c;
+        if (world.IsAwake(constraints[c].body2)) bodyConstraints[fill[constraints[c].body2]++] = c;
+    }
+
+    wallStart.assign(bodyCount + 1, 0);
+    for (const std::pair<int, int>& pair : wallPairs)
+    {
+        if (world.IsAwake(pair.first)) wallStart[pair.first + 1]++;
+    }
+    for (int body = 0; body < bodyCount; ++body) wallStart[body + 1] += wallStart[body];
+
+    bodyWalls.resize(wallStart[bodyCount]);
+    fill.assign(wallStart.begin(), wallStart.end() - 1);
+    for (const std::pair<int, int>& pair : wallPairs)
+    {
+        if (!world.IsAwake(pair.first)) continue;
+        bodyWalls[fill[pair.first]++] = pair.second;
+
+        // Grown by how far the body can get this step, so walls it only reaches during the step are kept too
+        glm::vec3 velocity = world.GetVelocity(pair.first);
+        float reach = (glm::length(velocity) + glm::length(world.gravity) * deltaTime) * deltaTime;
+        glm::vec3 normal;
+        float depth;
+        if (Collision::SphereOBBContact(world.GetPosition(pair.first), world.radius[pair.first] + reach, walls[pair.second], normal, depth))
+        {
+            depth -= reach;
+            if (depth > 0.0f) touching++;
+            touchingContacts.push_back({ pair.first, -1, normal, std::max(0.0f, depth), depth > 0.0f, velocity });
+        }
+    }
+
+    // Sleeping bodies never get to Predict, their start is where they lie for the whole step
+    startX = world.posX;
+    startY = world.posY;
+    startZ = world.posZ;
+    nextX.resize(bodyCount); nextY.resize(bodyCount); nextZ.resize(bodyCount);
+    velocityX.resize(bodyCount); velocityY.resize(bodyCount); velocityZ.resize(bodyCount);
+    boundaryX.resize(bodyCount); boundaryY.resize(bodyCount); boundaryZ.resize(bodyCount);
+
+    return touching;
+}
+
+void PositionSolver::Predict(PhysicsWorld& world, int begin, int end, float substepTime)
+{
+    const glm::vec3 fall = world.gravity * substepTime;
+
+    for (int a = begin; a < end; ++a)
+    {
+        int body = bodies[a];
+        startX[body] = world.posX[body];
+        startY[body] = world.posY[body];
+        startZ[body] = world.posZ[body];
+        boundaryX[body] = boundaryY[body] = boundaryZ[body] = 0.0f;
+
+        // Same rule as PhysicsWorld::Integrate, bodies with no mass don't fall
+        if (world.invMass[body] > 0.0f)
+        {
+            world.velX[body] += fall.x;
+            world.velY[body] += fall.y;
+            world.velZ[body] += fall.z;
+        }
+        world.posX[body] += world.velX[body] * substepTime;
+        world.posY[body] += world.velY[body] * substepTime;
+        world.posZ[body] += world.velZ[body] * substepTime;
+    }
+}
+
+bool PositionSolver::Project(const PhysicsWorld& world, const Constraint& constraint, int body, float complianceScale, glm::vec3& delta) const
+{
+    int other = constraint.body1 == body ? constraint.body2 : constraint.body1;
+
+    glm::vec3 position = world.GetPosition(body);
+    glm::vec3 otherPosition = world.GetPosition(other);
+    glm::vec3 offset = position - otherPosition;
+    float distance = glm::length(offset);
+    if (constraint.contact && distance >= constraint.restLength) return false;
+    if (!constraint.contact && distance == 0.0f) return false;
+
+    float weightSum = weight[body] + weight[other];
+    float denominator = weightSum + constraint.compliance * complianceScale;
+    if (denominator <= 0.0f) return false;
+
+    // One projection per substep, so the multiplier starts from zero every time and isn't accumulated
+    glm::vec3 normal = distance > 0.0f ? offset / distance : glm::vec3(0.0f, body < other ? 1.0f : -1.0f, 0.0f);
+    float error = distance - constraint.restLength;
+    float lambda = -error / denominator;
+    delta = normal * (lambda * weight[body]);
+
+    if (constraint.contact && weightSum > 0.0f)
+    {
+        glm::vec3 moved = (position - glm::vec3(startX[body], startY[body], startZ[body]))
+            - (otherPosition - glm::vec3(startX[other], startY[other], startZ[other]));
+        delta -= FrictionCorrection(moved, normal, -error, friction) * (weight[body] / weightSum);
+    }
+    return true;
+}
+
+void PositionSolver::SolveGaussSeidel(PhysicsWorld& world, float complianceScale)
+{
+    for (const Constraint& constraint : constraints)
+    {
+        // Both sides from the same positions, then both moved
+        glm::vec3 delta1(0.0f), delta2(0.0f);
+        if (!Project(world, constraint, constraint.body1, complianceScale, delta1)) continue;
+        Project(world, constraint, constraint.body2, complianceScale, delta2);
+
+        world.posX[constraint.body1] += delta1.x;
+        world.posY[constraint.body1] += delta1.y;
+        world.posZ[constraint.body1] += delta1.z;
+        world.posX[constraint.body2] += delta2.x;
+        world.posY[constraint.body2] += delta2.y;
+        world.posZ[constraint.body2] += delta2.z;
+    }
+}
+
+void PositionSolver::SolveJacobi(PhysicsWorld& world, int begin, int end, float complianceScale)
+{
+    for (int a = begin; a < end; ++a)
+    {
+        int body = bodies[a];
+        glm::vec3 sum(0.0f);
+        int active = 0;
+
+        for (int c = constraintStart[body]; c < constraintStart[body + 1]; ++c)
+        {
+            glm::vec3 delta;
+            if (!Project(world, constraints[bodyConstraints[c]], body, complianceScale, delta)) continue;
+            sum += delta;
+            active++;
+        }
+
+        // Averaged so a body squeezed from many sides doesn't overshoot, over-relaxed to win back some speed,
+        // but never more than the full correction
+        glm::vec3 position = world.GetPosition(body);
+        if (active > 0) position += sum * std::min(1.0f, relaxation / active);
+        nextX[body] = position.x;
+        nextY[body] = position.y;
+        nextZ[body] = position.z;
+    }
+}
+
+void PositionSolver::ProjectBoundary(PhysicsWorld& world, int body, const std::vector<OBB>& walls)
+{
+    if (weight[body] <= 0.0f) return;
+
+    const float radius = world.radius[body];
+    const glm::vec3 start(startX[body], startY[body], startZ[body]);
+    glm::vec3 position = world.GetPosition(body);
+    glm::vec3 deepestNormal(0.0f);
+    float deepest = 0.0f;
+
+    // Walls and bounds don't move, so the body takes the whole correction
+    for (int w = wallStart[body]; w < wallStart[body + 1]; ++w)
+    {
+        glm::vec3 normal;
+        float depth;
+        if (!Collision::SphereOBBContact(position, radius, walls[bodyWalls[w]], normal, depth)) continue;
+
+        position += normal * depth;
+        position -= FrictionCorrection(position - start, normal, depth, friction);
+        if (depth > deepest)
+        {
+            deepest = depth;
+            deepestNormal = normal;
+        }
+    }
+
+    if (terrain)
+    {
+        glm::vec3 normal;
+        float depth;
+        if (Collision::SphereSurfaceContact(position, radius, *terrain, normal, depth))
+        {
+            position += normal * depth;
+            position -= FrictionCorrection(position - start, normal, depth, friction);
+            if (depth > deepest)
+            {
+                deepest = depth;
+                deepestNormal = normal;
+            }
+        }
+    }
+
+    if (useBounds)
+    {
+        for (int axis = 0; axis < 3; ++axis)
+        {
+            glm::vec3 normal(0.0f);
+            float depth = 0.0f;
+            if (position[axis] < bounds.min[axis] + radius)
+            {
+                depth = bounds.min[axis] + radius - position[axis];
+                normal[axis] = 1.0f;
+            }
+            else if (position[axis] > bounds.max[axis] - radius)
+            {
+                depth = position[axis] - (bounds.max[axis] - radius);
+                normal[axis] = -1.0f;
+            }
+            if (depth <= 0.0f) continue;
+
+            position += normal * depth;
+            position -= FrictionCorrection(position - start, normal, depth, friction);
+            if (depth > deepest)
+            {
+                deepest = depth;
+                deepestNormal = normal;
+            }
+        }
+    }
+
+    world.posX[body] = position.x;
+    world.posY[body] = position.y;
+    world.posZ[body] = position.z;
+    if (deepest > 0.0f)
+    {
+        boundaryX[body] = deepestNormal.x;
+        boundaryY[body] = deepestNormal.y;
+        boundaryZ[body] = deepestNormal.z;
+    }
+}
+
+void PositionSolver::UpdateVelocities(PhysicsWorld& world, int begin, int end, float substepTime)
+{
+    const float invSubstepTime = 1.0f / substepTime;
+
+    for (int a = begin; a < end; ++a)
+    {
+        int body = bodies[a];
+        glm::vec3 start(startX[body], startY[body], startZ[body]);
+        glm::vec3 velocity = (world.GetPosition(body) - start) * invSubstepTime;
+
+        // The velocity from before the substep, still in the world, says how hard the body hit the boundary
+        glm::vec3 normal(boundaryX[body], boundaryY[body], boundaryZ[body]);
+        if (normal != glm::vec3(0.0f))
+        {
+            float incoming = glm::dot(world.GetVelocity(body), normal);
+            velocity += normal * (BounceVelocity(incoming) - glm::dot(velocity, normal));
+        }
+
+        velocityX[body] = velocity.x;
+        velocityY[body] = velocity.y;
+        velocityZ[body] = velocity.z;
+    }
+}
+
+float PositionSolver::BounceVelocity(float incoming) const
+{
+    return incoming < -restitutionThreshold ? -restitution * incoming : 0.0f;
+}
+
+bool PositionSolver::ContactVelocityChange(const PhysicsWorld& world, const Constraint& constraint, int body, glm::vec3& delta) const
+{
+    if (!constraint.contact) return false;
+
+    int other = constraint.body1 == body ? constraint.body2 : constraint.body1;
+    float weightSum = weight[body] + weight[other];
+    if (weightSum <= 0.0f) return false;
+
+    // Only pairs the position pass left touching, give or take rounding
+    glm::vec3 offset = world.GetPosition(body) - world.GetPosition(other);
+    float distanceSq = glm::dot(offset, offset);
+    float touching = constraint.restLength * ContactTolerance;
+    if (distanceSq > touching * touching || distanceSq == 0.0f) return false;
+
+    glm::vec3 normal = offset / std::sqrt(distanceSq);
+    glm::vec3 velocity = glm::vec3(velocityX[body], velocityY[body], velocityZ[body])
+        - glm::vec3(velocityX[other], velocityY[other], velocityZ[other]);
+    float incoming = glm::dot(world.GetVelocity(body) - world.GetVelocity(other), normal);
+
+    delta = normal * ((BounceVelocity(incoming) - glm::dot(velocity, normal)) * weight[body] / weightSum);
+    return true;
+}
+
+void PositionSolver::SolveVelocitiesGaussSeidel(PhysicsWorld& world)
+{
+    for (const Constraint& constraint : constraints)
+    {
+        glm::vec3 delta1(0.0f), delta2(0.0f);
+        if (!ContactVelocityChange(world, constraint, constraint.body1, delta1)) continue;
+        ContactVelocityChange(world, constraint, constraint.body2, delta2);
+
+        velocityX[constraint.body1] += delta1.x;
+        velocityY[constraint.body1] += delta1.y;
+        velocityZ[constraint.body1] += delta1.z;
+        velocityX[constraint.body2] += delta2.x;
+        velocityY[constraint.body2] += delta2.y;
+        velocityZ[constraint.body2] += delta2.z;
+    }
+}
+
+void PositionSolver::SolveVelocitiesJacobi(PhysicsWorld& world, int begin, int end)
+{
+    for (int a = begin; a < end; ++a)
+    {
+        int body = bodies[a];
+        glm::vec3 sum(0.0f);
+        int active = 0;
+
+        for (int c = constraintStart[body]; c < constraintStart[body + 1]; ++c)
+        {
+            glm::vec3 delta;
+            if (!ContactVelocityChange(world, constraints[bodyConstraints[c]], body, delta)) continue;
+            sum += delta;
+            active++;
+        }
+
+        glm::vec3 velocity(velocityX[body], velocityY[body], velocityZ[body]);
+        if (active > 0) velocity += sum * std::min(1.0f, relaxation / active);
+        nextX[body] = velocity.x;
+        nextY[body] = velocity.y;
+        nextZ[body] = velocity.z;
+    }
+}
+
+void PositionSolver::PushEvents(const PhysicsWorld& world, float deltaTime)
+{
+    for (const TouchingContact& contact : touchingContacts)
+    {
+        // Gravity changed the velocity of every moving body with mass too, only the rest is the contact's doing
+        glm::vec3 change = world.GetVelocity(contact.body1) - contact.velocity;
+        float weightSum = weight[contact.body1];
+        if (weight[contact.body1] > 0.0f) change -= world.gravity * deltaTime;
+        if (contact.body2 >= 0)
+        {
+            change -= world.GetVelocity(contact.body2);
+            weightSum += weight[contact.body2];
+            if (weight[contact.body2] > 0.0f) change += world.gravity * deltaTime;
+        }
+
+        // A pair that only came close counts if the step pushed it apart faster than a sleeper could drift
+        float pushed = glm::dot(change, contact.normal);
+        if (!contact.touching && pushed <= world.sleepVelocity) continue;
+
+        float impulse = weightSum > 0.0f ? std::max(0.0f, pushed / weightSum) : 0.0f;
+        events->Push({ contact.body1, contact.body2, contact.normal, contact.depth, impulse });
+    }
+}
@@ -0,0 +1,157 @@
+﻿#pragma once
+#include <cstdint>
+#include <utility>
+#include <vector>
+#include "AABB.h"
+#include "OBB.h"
+
+class CollisionEventRing;
+class JobSystem;
+class PhysicsWorld;
+class Surface;
+
+/// \brief Extended position based dynamics (XPBD) for spheres, stepped in substeps.
+/// Each substep moves the bodies by their velocity, projects the positions back onto the constraints
+/// and takes the new velocity from how far each body really moved. Small substeps with one projection
+/// each converge far better than many iterations of one big step, and a pile can't gain energy from
+/// overlap, so large piles stay still at a cost of substeps times constraints per frame.
+/// Constraints are sphere contacts, distance links with a compliance (0 is rigid), and the boundary:
+/// static boxes and an optional box the bodies are kept inside. Spheres are moved as points, their spin is left alone.
+/// The serial Step projects constraints one after another (Gauss-Seidel). The threaded Step is Jacobi:
+/// every body adds up what all of its constraints want from the positions of the last pass, so bodies can
+/// be solved in any order on any thread and the result doesn't depend on the thread count.
+class PositionSolver
+{
+public:
+
+    PositionSolver();
+
+    /// \brief Keeps two bodies restLength apart
+    /// \param compliance inverse stiffness in metres per newton, 0 for a rigid rod
+    /// \return index of the constraint
+    int AddDistanceConstraint(int body1, int body2, float restLength, float compliance = 0.0f);
+    void ClearDistanceConstraints() { distanceConstraints.clear(); }
+    int GetDistanceConstraintCount() const { return (int)distanceConstraints.size(); }
+
+    /// \brief Moves every awake body deltaTime forward, gravity and the constraints included.
+    /// Replaces PhysicsWorld::Integrate for the step, candidate pairs are taken once at the start of it
+    /// \param pairs candidate sphere pairs from the broadphase, in any order
+    /// \param wallPairs candidate (body, index into walls) pairs
+    /// \return number of sphere and wall pairs touching at the start of the step
+    int Step(PhysicsWorld& world, float deltaTime, const std::vector<std::pair<int, int>>& pairs,
+        const std::vector<std::pair<int, int>>& wallPairs, const std::vector<OBB>& walls);
+
+    /// \brief Same, solved Jacobi style with the bodies split across the threads of jobs
+    int Step(PhysicsWorld& world, float deltaTime, const std::vector<std::pair<int, int>>& pairs,
+        const std::vector<std::pair<int, int>>& wallPairs, const std::vector<OBB>& walls, JobSystem& jobs);
+
+    /// \brief Renames the bodies of the distance constraints after PhysicsWorld::SortByMorton
+    void RemapBodies(const std::vector<int>& oldToNew);
+
+    /// Steps per deltaTime, and projections of every constraint per substep
+    int substeps = 8;
+    int iterations = 1;
+
+    /// Softness of sphere contacts, 0 keeps them from overlapping at all
+    float contactCompliance = 0.0f;
+
+    /// Sliding smaller than friction times the overlap pushed out is stopped, longer slides are shortened by that much
+    float friction = 0.4f;
+
+    /// Bounce off the boundary and each other, only for impacts faster than restitutionThreshold
+    float restitution = 0.5f;
+    float restitutionThreshold = 0.2f;
+
+    /// Over-relaxation of the Jacobi average, between 1 and 2
+    float relaxation = 1.5f;
+
+    /// Bodies are kept inside bounds when this is set
+    bool useBounds = false;
+    AABB bounds;
+
+    /// Heightfield the bodies can't sink into, part of the boundary, none if null
+    const Surface* terrain = nullptr;
+
+    /// Every sphere and wall contact of a step goes here at the end of it, if set. That is the pairs touching
+    /// at the start, and the pairs that only meet during the step and got pushed apart by it
+    CollisionEventRing* events = nullptr;
+
+private:
+
+    struct Constraint
+    {
+        int body1;
+        int body2;
+        float restLength;
+        float compliance;
+        // Contacts only push apart, distance constraints also pull together
+        bool contact;
+    };
+
+    /// \brief A pair Prepare found touching or closing in, reported once the step knows what it did to their velocity
+    struct TouchingContact
+    {
+        int body1;
+        // -1 for a wall
+        int body2;
+        glm::vec3 normal;
+        // Overlap at the start of the step, 0 for a pair that only meets during it
+        float depth;
+        bool touching;
+        // Velocity of body1 relative to body2 before the step
+        glm::vec3 velocity;
+    };
+
+    int Run(PhysicsWorld& world, float deltaTime, const std::vector<std::pair<int, int>>& pairs,
+        const std::vector<std::pair<int, int>>& wallPairs, const std::vector<OBB>& walls, JobSystem* jobs);
+
+    /// \brief Wakes what the step has to move and gathers this step's constraints
+    /// \return number of pairs touching now
+    int Prepare(PhysicsWorld& world, float deltaTime, const std::vector<std::pair<int, int>>& pairs,
+        const std::vector<std::pair<int, int>>& wallPairs, const std::vector<OBB>& walls);
+
+    /// \brief Position change constraint wants for body, also shortens the slide it made this substep
+    /// \return false if the constraint is inactive
+    bool Project(const PhysicsWorld& world, const Constraint& constraint, int body, float complianceScale, glm::vec3& delta) const;
+
+    /// \brief Pushes body out of its walls and into bounds, and keeps the normal it was pushed along
+    void ProjectBoundary(PhysicsWorld& world, int body, const std::vector<OBB>& walls);
+
+    void Predict(PhysicsWorld& world, int begin, int end, float substepTime);
+    void SolveGaussSeidel(PhysicsWorld& world, float complianceScale);
+    void SolveJacobi(PhysicsWorld& world, int begin, int end, float complianceScale);
+    void UpdateVelocities(PhysicsWorld& world, int begin, int end, float substepTime);
+
+    /// \brief Normal speed a contact should leave with after coming in at incoming, negative towards each other
+    float BounceVelocity(float incoming) const;
+
+    /// \brief Velocity change a touching contact wants for body, so the pair separates at BounceVelocity
+    /// \return false if the constraint isn't a contact or no longer touches
+    bool ContactVelocityChange(const PhysicsWorld& world, const Constraint& constraint, int body, glm::vec3& delta) const;
+
+    void SolveVelocitiesGaussSeidel(PhysicsWorld& world);
+    void SolveVelocitiesJacobi(PhysicsWorld& world, int begin, int end);
+
+    /// \brief Pushes an event for touchingContacts, with the impulse the step gave each along its normal
+    void PushEvents(const PhysicsWorld& world, float deltaTime);
+
+    std::vector<Constraint> distanceConstraints;
+    std::vector<Constraint> constraints;
+    std::vector<TouchingContact> touchingContacts;
+
+    // Bodies moved this step, and each body's constraints and walls: bodyConstraints[constraintStart[b], constraintStart[b + 1])
+    std::vector<int> bodies;
+    std::vector<int> constraintStart;
+    std::vector<int> bodyConstraints;
+    std::vector<int> wallStart;
+    std::vector<int> bodyWalls;
+
+    // Per body: inverse mass, 0 for bodies left asleep, position at the start of the substep,
+    // the Jacobi result (positions, then velocities), velocity from the position pass,
+    // and the normal of the deepest boundary contact this substep
+    std::vector<float> weight;
+    std::vector<float> startX, startY, startZ;
+    std::vector<float> nextX, nextY, nextZ;
+    std::vector<float> velocityX, velocityY, velocityZ;
+    std::vector<float> boundaryX, boundaryY, boundaryZ;
+};
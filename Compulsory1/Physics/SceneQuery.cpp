@@ -0,0 +1,442 @@
+﻿#include "SceneQuery.h"
+
+#include <algorithm>
+#include <cmath>
+#include <immintrin.h>
+
+#include "glm/geometric.hpp"
+#include "../Mesh/Mesh.h"
+#include "ThreadPool.h"
+
+SceneQuery::SceneQuery()
+{
+
+}
+
+void SceneQuery::Clear()
+{
+    shapes.clear();
+    order.clear();
+    nodes.clear();
+}
+
+int SceneQuery::AddBox(const AABB& box, int userData)
+{
+    shapes.push_back({ box, (box.min + box.max) * 0.5f, 0.0f, false, userData });
+    return (int)shapes.size() - 1;
+}
+
+int SceneQuery::AddSphere(const glm::vec3& center, float radius, int userData)
+{
+    glm::vec3 extent(radius);
+    shapes.push_back({ AABB(center - extent, center + extent), center, radius, true, userData });
+    return (int)shapes.size() - 1;
+}
+
+int SceneQuery::AddMesh(Mesh* mesh, int userData)
+{
+    if (mesh->mType == Sphere) return AddSphere(mesh->globalPosition, mesh->Radius, userData);
+    return AddBox(AABB(mesh->minVert, mesh->maxVert), userData);
+}
+
+void SceneQuery::Build()
+{
+    order.resize(shapes.size());
+    for (int i = 0; i < (int)order.size(); ++i)
+    {
+        order[i] = i;
+    }
+
+    nodes.clear();
+    if (shapes.empty()) return;
+
+    // A binary tree with leaves of at least LeafSize / 2 shapes never needs more nodes than this
+    nodes.reserve(2 * shapes.size());
+    nodes.emplace_back();
+    BuildNode(0, 0, (int)shapes.size());
+}
+
+void SceneQuery::BuildNode(int node, int first, int count)
+{
+    AABB box = shapes[order[first]].box;
+    glm::vec3 centerMin = shapes[order[first]].center;
+    glm::vec3 centerMax = centerMin;
+    for (int i = first + 1; i < first + count; ++i)
+    {
+        const Shape& shape = shapes[order[i]];
+        box = AABB::Union(box, shape.box);
+        centerMin = glm::min(centerMin, shape.center);
+        centerMax = glm::max(centerMax, shape.center);
+    }
+    nodes[node].box = box;
+
+    if (count <= LeafSize)
+    {
+        nodes[node].first = first;
+        nodes[node].count = count;
+        return;
+    }
+
+    // Median of the centres along the axis they are most spread on
+    glm::vec3 spread = centerMax - centerMin;
+    int axis = spread.x > spread.y ? (spread.x > spread.z ? 0 : 2) : (spread.y > spread.z ? 1 : 2);
+    int half = count / 2;
+    std::nth_element(order.begin() + first, order.begin() + first + half, order.begin() + first + count,
+        [this, axis](int a, int b) { return shapes[a].center[axis] < shapes[b].center[axis]; });
+
+    int left = (int)nodes.size();
+    nodes[node].left = left;
+    nodes[node].axis = axis;
+    nodes.emplace_back();
+    nodes.emplace_back();
+
+    BuildNode(left, first, half);
+    BuildNode(left + 1, first + half, count - half);
+}
+
+bool SceneQuery::IntersectShape(int index, const glm::vec3& origin, const glm::vec3& direction, RayHit& hit) const
+{
+    const Shape& shape = shapes[index];
+    float distance;
+    glm::vec3 normal;
+
+    if (shape.isSphere)
+    {
+        glm::vec3 offset = origin - shape.center;
+        float b = glm::dot(offset, direction);
+        float c = glm::dot(offset, offset) - shape.radius * shape.radius;
+        if (c > 0.0f && b > 0.0f) return false;
+
+        float discriminant = b * b - c;
+        if (discriminant < 0.0f) return false;
+
+        distance = -b - std::sqrt(discriminant);
+        if (distance < 0.0f)
+        {
+            // Starts inside
+            distance = 0.0f;
+            normal = -direction;
+        }
+        else
+        {
+            normal = (origin + direction * distance - shape.center) / shape.radius;
+        }
+    }
+    else
+    {
+        float enter = 0.0f;
+        float exit = hit.distance;
+        int enterAxis = -1;
+        for (int axis = 0; axis < 3; ++axis)
+        {
+            if (direction[axis] == 0.0f)
+            {
+                if (origin[axis] < shape.box.min[axis] || origin[axis] > shape.box.max[axis]) return false;
+                continue;
+            }
+
+            float t1 = (shape.box.min[axis] - origin[axis]) / direction[axis];
+            float t2 = (shape.box.max[axis] - origin[axis]) / direction[axis];
+            if (t1 > t2) std::swap(t1, t2);
+            if (t1 > enter)
+            {
+                enter = t1;
+                enterAxis = axis;
+            }
+            exit = std::min(exit, t2);
+            if (enter > exit) return false;
+        }
+
+        distance = enter;
+        normal = -direction;
+        if (enterAxis != -1)
+        {
+            normal = glm::vec3(0.0f);
+            normal[enterAxis] = direction[enterAxis] > 0.0f ? -1.0f : 1.0f;
+        }
+    }
+
+    if (distance >= hit.distance) return false;
+
+    hit.shape = index;
+    hit.distance = distance;
+    hit.point = origin + direction * distance;
+    hit.normal = normal;
+    return true;
+}
+
+bool SceneQuery::Raycast(const Ray& ray, RayHit& hit) const
+{
+    hit = RayHit();
+    hit.distance = ray.maxDistance;
+    if (nodes.empty()) return false;
+
+    glm::vec3 inverse = 1.0f / ray.direction;
+
+    int stack[64];
+    int count = 0;
+    stack[count++] = 0;
+
+    while (count > 0)
+    {
+        const Node& node = nodes[stack[--count]];
+
+        glm::vec3 t1 = (node.box.min - ray.origin) * inverse;
+        glm::vec3 t2 = (node.box.max - ray.origin) * inverse;
+        glm::vec3 near = glm::min(t1, t2);
+        glm::vec3 far = glm::max(t1, t2);
+        float enter = std::max(std::max(near.x, near.y), std::max(near.z, 0.0f));
+        float exit = std::min(std::min(far.x, far.y), std::min(far.z, hit.distance));
+        if (enter > exit) continue;
+
+        if (node.IsLeaf())
+        {
+            for (int i = node.first; i < node.first + node.count; ++i)
+            {
+                IntersectShape(order[i], ray.origin, ray.direction, hit);
+            }
+            continue;
+        }
+
+        // Nearer child on top, so its hits can cull the other one
+        bool leftFirst = ray.direction[node.axis] >= 0.0f;
+        stack[count++] = leftFirst ? node.left + 1 : node.left;
+        stack[count++] = leftFirst ? node.left : node.left + 1;
+    }
+
+    return hit.shape != -1;
+}
+
+void SceneQuery::RaycastPacket(const Ray* rays, int count, RayHit* hits) const
+{
+    // Lanes past count stay inactive, a negative best distance fails every box test
+    alignas(16) float originX[PacketSize], originY[PacketSize], originZ[PacketSize];
+    alignas(16) float inverseX[PacketSize], inverseY[PacketSize], inverseZ[PacketSize];
+    alignas(16) float best[PacketSize];
+    float directionSum[3] = { 0.0f, 0.0f, 0.0f };
+
+    for (int l = 0; l < PacketSize; ++l)
+    {
+        const Ray& ray = rays[l < count ? l : 0];
+        originX[l] = ray.origin.x;
+        originY[l] = ray.origin.y;
+        originZ[l] = ray.origin.z;
+        inverseX[l] = 1.0f / ray.direction.x;
+        inverseY[l] = 1.0f / ray.direction.y;
+        inverseZ[l] = 1.0f / ray.direction.z;
+        best[l] = l < count ? ray.maxDistance : -1.0f;
+
+        if (l < count)
+        {
+            hits[l] = RayHit();
+            hits[l].distance = ray.maxDistance;
+            directionSum[0] += ray.direction.x;
+            directionSum[1] += ray.direction.y;
+            directionSum[2] += ray.direction.z;
+        }
+    }
+
+    if (nodes.empty()) return;
+
+    int stack[64];
+    int stackCount = 0;
+    stack[stackCount++] = 0;
+
+    while (stackCount > 0)
+    {
+        const Node& node = nodes[stack[--stackCount]];
+
+        // Same slab test as Raycast, 4 lanes per SSE register. SSE2 is always there on x64
+        const __m128 minX = _mm_set1_ps(node.box.min.x), maxX = _mm_set1_ps(node.box.max.x);
+        const __m128 minY = _mm_set1_ps(node.box.min.y), maxY = _mm_set1_ps(node.box.max.y);
+        const __m128 minZ = _mm_set1_ps(node.box.min.z), maxZ = _mm_set1_ps(node.box.max.z);
+        int laneMask = 0;
+        for (int l = 0; l < PacketSize; l += 4)
+        {
+            __m128 ox = _mm_load_ps(originX + l), oy = _mm_load_ps(originY + l), oz = _mm_load_ps(originZ + l);
+            __m128 ix = _mm_load_ps(inverseX + l), iy = _mm_load_ps(inverseY + l), iz = _mm_load_ps(inverseZ + l);
+            __m128 tx1 = _mm_mul_ps(_mm_sub_ps(minX, ox), ix), tx2 = _mm_mul_ps(_mm_sub_ps(maxX, ox), ix);
+            __m128 ty1 = _mm_mul_ps(_mm_sub_ps(minY, oy), iy), ty2 = _mm_mul_ps(_mm_sub_ps(maxY, oy), iy);
+            __m128 tz1 = _mm_mul_ps(_mm_sub_ps(minZ, oz), iz), tz2 = _mm_mul_ps(_mm_sub_ps(maxZ, oz), iz);
+
+            __m128 enter = _mm_max_ps(_mm_max_ps(_mm_min_ps(tx1, tx2), _mm_min_ps(ty1, ty2)),
+                _mm_max_ps(_mm_min_ps(tz1, tz2), _mm_setzero_ps()));
+            __m128 exit = _mm_min_ps(_mm_min_ps(_mm_max_ps(tx1, tx2), _mm_max_ps(ty1, ty2)),
+                _mm_min_ps(_mm_max_ps(tz1, tz2), _mm_load_ps(best + l)));
+            laneMask |= _mm_movemask_ps(_mm_cmple_ps(enter, exit)) << l;
+        }
+        if (laneMask == 0) continue;
+
+        if (node.IsLeaf())
+        {
+            for (int l = 0; l < count; ++l)
+            {
+                if (!(laneMask & (1 << l))) continue;
+                for (int i = node.first; i < node.first + node.count; ++i)
+                {
+                    IntersectShape(order[i], rays[l].origin, rays[l].direction, hits[l]);
+                }
+                best[l] = hits[l].distance;
+            }
+            continue;
+        }
+
+        // One order for the whole packet, from where most of its rays point
+        bool leftFirst = directionSum[node.axis] >= 0.0f;
+        stack[stackCount++] = leftFirst ? node.left + 1 : node.left;
+        stack[stackCount++] = leftFirst ? node.left : node.left + 1;
+    }
+}
+
+void SceneQuery::RaycastBatch(const std::vector<Ray>& rays, std::vector<RayHit>& hits) const
+{
+    hits.resize(rays.size());
+    for (int first = 0; first < (int)rays.size(); first += PacketSize)
+    {
+        int count = std::min(PacketSize, (int)rays.size() - first);
+        RaycastPacket(rays.data() + first, count, hits.data() + first);
+    }
+}
+
+void SceneQuery::RaycastParallel(const std::vector<Ray>& rays, std::vector<RayHit>& hits, ThreadPool& pool) const
+{
+    hits.resize(rays.size());
+    int packets = ((int)rays.size() + PacketSize - 1) / PacketSize;
+    pool.ParallelFor(packets, [&](int, int begin, int end)
+    {
+        for (int packet = begin; packet < end; ++packet)
+        {
+            int first = packet * PacketSize;
+            int count = std::min(PacketSize, (int)rays.size() - first);
+            RaycastPacket(rays.data() + first, count, hits.data() + first);
+        }
+    });
+}
+
+template <typename T>
+void SceneQuery::QueryBox(const AABB& box, T&& visit) const
+{
+    if (nodes.empty()) return;
+
+    int stack[64];
+    int count = 0;
+    stack[count++] = 0;
+
+    while (count > 0)
+    {
+        const Node& node = nodes[stack[--count]];
+        if (!node.box.Overlaps(box)) continue;
+
+        if (node.IsLeaf())
+        {
+            for (int i = node.first; i < node.first + node.count; ++i)
+            {
+                if (shapes[order[i]].box.Overlaps(box)) visit(order[i]);
+            }
+            continue;
+        }
+
+        stack[count++] = node.left + 1;
+        stack[count++] = node.left;
+    }
+}
+
+bool SceneQuery::OverlapsShape(int index, const SphereQuery& query) const
+{
+    const Shape& shape = shapes[index];
+    if (shape.isSphere)
+    {
+        glm::vec3 offset = shape.center - query.center;
+        float sumRadius = shape.radius + query.radius;
+        return glm::dot(offset, offset) <= sumRadius * sumRadius;
+    }
+
+    glm::vec3 closestPoint = glm::clamp(query.center, shape.box.min, shape.box.max);
+    glm::vec3 offset = closestPoint - query.center;
+    return glm::dot(offset, offset) <= query.radius * query.radius;
+}
+
+void SceneQuery::OverlapSphere(const SphereQuery& query, std::vector<int>& results) const
+{
+    glm::vec3 extent(query.radius);
+    QueryBox(AABB(query.center - extent, query.center + extent), [&](int shape)
+    {
+        if (OverlapsShape(shape, query)) results.push_back(shape);
+    });
+}
+
+void SceneQuery::OverlapAABB(const AABB& query, std::vector<int>& results) const
+{
+    QueryBox(query, [&](int shape)
+    {
+        // Boxes are done once their boxes overlap, spheres still need the corners checked
+        if (!shapes[shape].isSphere)
+        {
+            results.push_back(shape);
+            return;
+        }
+
+        glm::vec3 closestPoint = glm::clamp(shapes[shape].center, query.min, query.max);
+        glm::vec3 offset = closestPoint - shapes[shape].center;
+        if (glm::dot(offset, offset) <= shapes[shape].radius * shapes[shape].radius) results.push_back(shape);
+    });
+}
+
+template <typename T, typename Query>
+void SceneQuery::OverlapBatch(const std::vector<Query>& queries, QueryResults& results, ThreadPool* pool, T&& overlap) const
+{
+    results.offsets.assign(1, 0);
+    results.shapes.clear();
+
+    if (!pool)
+    {
+        for (const Query& query : queries)
+        {
+            overlap(query, results.shapes);
+            results.offsets.push_back((int)results.shapes.size());
+        }
+        return;
+    }
+
+    // Each thread fills its own list for its slice of queries, the slices are joined in order after
+    std::vector<QueryResults> chunkResults(pool->GetThreadCount());
+    pool->ParallelFor((int)queries.size(), [&](int chunk, int begin, int end)
+    {
+        QueryResults& chunkResult = chunkResults[chunk];
+        for (int q = begin; q < end; ++q)
+        {
+            overlap(queries[q], chunkResult.shapes);
+            chunkResult.offsets.push_back((int)chunkResult.shapes.size());
+        }
+    });
+
+    for (const QueryResults& chunkResult : chunkResults)
+    {
+        int base = (int)results.shapes.size();
+        results.shapes.insert(results.shapes.end(), chunkResult.shapes.begin(), chunkResult.shapes.end());
+        for (int offset : chunkResult.offsets)
+        {
+            results.offsets.push_back(base + offset);
+        }
+    }
+}
+
+void SceneQuery::OverlapSphereBatch(const std::vector<SphereQuery>& queries, QueryResults& results) const
+{
+    OverlapBatch(queries, results, nullptr, [this](const SphereQuery& query, std::vector<int>& out) { OverlapSphere(query, out); });
+}
+
+void SceneQuery::OverlapAABBBatch(const std::vector<AABB>& queries, QueryResults& results) const
+{
+    OverlapBatch(queries, results, nullptr, [this](const AABB& query, std::vector<int>& out) { OverlapAABB(query, out); });
+}
+
+void SceneQuery::OverlapSphereParallel(const std::vector<SphereQuery>& queries, QueryResults& results, ThreadPool& pool) const
+{
+    OverlapBatch(queries, results, &pool, [this](const SphereQuery& query, std::vector<int>& out) { OverlapSphere(query, out); });
+}
+
+void SceneQuery::OverlapAABBParallel(const std::vector<AABB>& queries, QueryResults& results, ThreadPool& pool) const
+{
+    OverlapBatch(queries, results, &pool, [this](const AABB& query, std::vector<int>& out) { OverlapAABB(query, out); });
+}
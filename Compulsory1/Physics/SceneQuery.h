@@ -0,0 +1,136 @@
+﻿#pragma once
+#include <vector>
+#include "AABB.h"
+#include "glm/vec3.hpp"
+
+class Mesh;
+class ThreadPool;
+
+struct Ray
+{
+    glm::vec3 origin;
+    // Has to be normalized, distances in RayHit are along it
+    glm::vec3 direction;
+    float maxDistance;
+};
+
+struct RayHit
+{
+    // Shape hit first, -1 if the ray hit nothing
+    int shape = -1;
+    float distance = 0.0f;
+    glm::vec3 point = glm::vec3(0.0f);
+    glm::vec3 normal = glm::vec3(0.0f);
+};
+
+struct SphereQuery
+{
+    glm::vec3 center;
+    float radius;
+};
+
+/// \brief Results of a batch of overlap queries, query q found shapes[offsets[q]] up to shapes[offsets[q + 1]]
+struct QueryResults
+{
+    std::vector<int> offsets;
+    std::vector<int> shapes;
+};
+
+/// \brief Ray and overlap queries against a static set of boxes and spheres.
+/// Shapes go into a binary BVH split at the median of the longest axis, with a few shapes per leaf.
+/// Ray batches are walked 8 rays at a time: a node is opened once for the whole packet if any ray in
+/// it can still hit the node, which is much cheaper than walking the tree per ray when the rays start
+/// close together and point roughly the same way, like picking or line of sight from one eye.
+class SceneQuery
+{
+public:
+
+    SceneQuery();
+
+    /// \brief Removes every shape, call Build again after adding new ones
+    void Clear();
+
+    /// \param userData returned by GetUserData, usually an index into a mesh list
+    /// \return shape index used in query results
+    int AddBox(const AABB& box, int userData);
+    int AddSphere(const glm::vec3& center, float radius, int userData);
+
+    /// \brief Adds a sphere from globalPosition and Radius if the mesh is a Sphere, else its minVert/maxVert box
+    int AddMesh(Mesh* mesh, int userData);
+
+    /// \brief Builds the tree over every shape added so far
+    void Build();
+
+    int GetShapeCount() const { return (int)shapes.size(); }
+    int GetUserData(int shape) const { return shapes[shape].userData; }
+    bool IsSphere(int shape) const { return shapes[shape].isSphere; }
+
+    /// \brief Closest hit along ray
+    /// \return false if nothing was hit within ray.maxDistance
+    bool Raycast(const Ray& ray, RayHit& hit) const;
+
+    /// \brief Same as calling Raycast for every ray, as packet traversal
+    void RaycastBatch(const std::vector<Ray>& rays, std::vector<RayHit>& hits) const;
+
+    /// \brief RaycastBatch with the packets split across the threads of pool
+    void RaycastParallel(const std::vector<Ray>& rays, std::vector<RayHit>& hits, ThreadPool& pool) const;
+
+    /// \brief Appends every shape touching the sphere or box to results
+    void OverlapSphere(const SphereQuery& query, std::vector<int>& results) const;
+    void OverlapAABB(const AABB& query, std::vector<int>& results) const;
+
+    void OverlapSphereBatch(const std::vector<SphereQuery>& queries, QueryResults& results) const;
+    void OverlapAABBBatch(const std::vector<AABB>& queries, QueryResults& results) const;
+
+    /// \brief Batch forms split across the threads of pool, results are in the same order as the batch forms
+    void OverlapSphereParallel(const std::vector<SphereQuery>& queries, QueryResults& results, ThreadPool& pool) const;
+    void OverlapAABBParallel(const std::vector<AABB>& queries, QueryResults& results, ThreadPool& pool) const;
+
+    /// Rays walked together by RaycastBatch
+    static const int PacketSize = 8;
+
+    /// Most shapes a leaf is allowed to hold
+    static const int LeafSize = 4;
+
+private:
+
+    struct Shape
+    {
+        AABB box;
+        glm::vec3 center;
+        float radius;
+        bool isSphere;
+        int userData;
+    };
+
+    struct Node
+    {
+        AABB box;
+        // Internal nodes: children are left and left + 1. Leaves: shapes order[first, first + count)
+        int left = -1;
+        int first = 0;
+        int count = 0;
+        int axis = 0;
+
+        bool IsLeaf() const { return count > 0; }
+    };
+
+    void BuildNode(int node, int first, int count);
+
+    /// \brief Exact ray test against one shape, updates hit if it is closer than hit.distance
+    bool IntersectShape(int shape, const glm::vec3& origin, const glm::vec3& direction, RayHit& hit) const;
+    bool OverlapsShape(int shape, const SphereQuery& query) const;
+
+    void RaycastPacket(const Ray* rays, int count, RayHit* hits) const;
+
+    /// \brief Walks the tree for a box, calling visit(shape) on every shape in the leaves it touches
+    template <typename T>
+    void QueryBox(const AABB& box, T&& visit) const;
+
+    template <typename T, typename Query>
+    void OverlapBatch(const std::vector<Query>& queries, QueryResults& results, ThreadPool* pool, T&& overlap) const;
+
+    std::vector<Shape> shapes;
+    std::vector<int> order;
+    std::vector<Node> nodes;
+};
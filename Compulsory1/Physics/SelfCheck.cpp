@@ -0,0 +1,317 @@
+﻿#include "SelfCheck.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "glm/geometric.hpp"
+#include "../Collision.h"
+#include "../Mesh/Mesh.h"
+#include "AABBTree.h"
+#include "CollisionEvents.h"
+#include "ContactSolver.h"
+#include "OBB.h"
+#include "PhysicsWorld.h"
+#include "PositionSolver.h"
+#include "SpatialGrid.h"
+
+namespace
+{
+    bool Report(const std::string& name, bool passed, const std::string& measured)
+    {
+        std::cout << (passed ? "PASS " : "FAIL ") << name << ": " << measured << std::endl;
+        return passed;
+    }
+
+    /// \brief One step of ContactSolver against a floor, with every pair that has an awake body in it
+    void StepWithSolver(PhysicsWorld& world, ContactSolver& solver, const std::vector<OBB>& walls, float deltaTime)
+    {
+        world.Integrate(deltaTime);
+
+        std::vector<std::pair<int, int>> pairs;
+        for (int i = 0; i < world.GetBodyCount(); ++i)
+        {
+            for (int j = i + 1; j < world.GetBodyCount(); ++j)
+            {
+                if (world.IsAwake(i) || world.IsAwake(j)) pairs.emplace_back(i, j);
+            }
+        }
+
+        std::vector<std::pair<int, int>> wallPairs;
+        for (int body : world.activeBodies)
+        {
+            for (int wall = 0; wall < (int)walls.size(); ++wall) wallPairs.emplace_back(body, wall);
+        }
+
+        solver.Solve(world, pairs, wallPairs, walls);
+        world.UpdateSleeping();
+    }
+
+    /// A sphere asleep on top of another must fall when the bottom one is knocked away
+    bool CheckStackFallsWhenHit()
+    {
+        const float radius = 0.1f;
+        const float deltaTime = 1.0f / 120.0f;
+
+        PhysicsWorld world;
+        world.gravity = glm::vec3(0.0f, -9.81f, 0.0f);
+        ContactSolver solver;
+
+        std::vector<OBB> walls = { OBB(AABB(glm::vec3(-5.0f, -1.0f, -5.0f), glm::vec3(5.0f, 0.0f, 5.0f))) };
+
+        int bottom = world.AddBody(glm::vec3(0.0f, radius, 0.0f), glm::vec3(0.0f), radius, 1.0f);
+        int top = world.AddBody(glm::vec3(0.0f, 3.0f * radius, 0.0f), glm::vec3(0.0f), radius, 1.0f);
+
+        for (int step = 0; step < 600 && world.GetActiveCount() > 0; ++step)
+        {
+            StepWithSolver(world, solver, walls, deltaTime);
+        }
+        if (world.IsAwake(bottom) || world.IsAwake(top))
+        {
+            return Report("stack falls when hit", false, "the stack never fell asleep");
+        }
+        float restingHeight = world.posY[top];
+
+        // Rolled in low along the floor, so it only touches the bottom sphere
+        world.AddBody(glm::vec3(-1.0f, radius, 0.0f), glm::vec3(4.0f, 0.0f, 0.0f), radius, 1.0f);
+        for (int step = 0; step < 240; ++step)
+        {
+            StepWithSolver(world, solver, walls, deltaTime);
+        }
+
+        float drop = restingHeight - world.posY[top];
+        return Report("stack falls when hit", drop > radius, "top sphere dropped " + std::to_string(drop)
+            + " after the bottom one was hit, " + std::to_string(world.GetActiveCount()) + " bodies awake");
+    }
+
+    /// A ball hanging off a fixed anchor by a distance constraint swings down without stretching the link
+    bool CheckPendulumKeepsLength()
+    {
+        const float length = 0.5f;
+        const float deltaTime = 1.0f / 120.0f;
+
+        PhysicsWorld world;
+        world.gravity = glm::vec3(0.0f, -9.81f, 0.0f);
+        PositionSolver solver;
+
+        // No mass, so the anchor never moves
+        int anchor = world.AddBody(glm::vec3(0.0f, 1.0f, 0.0f), glm::vec3(0.0f), 0.05f, 0.0f);
+        int bob = world.AddBody(glm::vec3(length, 1.0f, 0.0f), glm::vec3(0.0f), 0.05f, 1.0f);
+        solver.AddDistanceConstraint(anchor, bob, length);
+
+        const std::vector<std::pair<int, int>> noPairs;
+        const std::vector<OBB> noWalls;
+        float worstStretch = 0.0f;
+        float lowest = world.posY[bob];
+        for (int step = 0; step < 240; ++step)
+        {
+            solver.Step(world, deltaTime, noPairs, noPairs, noWalls);
+            worstStretch = std::max(worstStretch, std::abs(glm::length(world.GetPosition(bob) - world.GetPosition(anchor)) - length));
+            lowest = std::min(lowest, world.posY[bob]);
+        }
+
+        bool passed = worstStretch < 0.001f && lowest < 1.0f - 0.9f * length;
+        return Report("pendulum keeps its length", passed, "link stretched at most " + std::to_string(worstStretch)
+            + ", lowest point " + std::to_string(1.0f - lowest) + " below the anchor");
+    }
+
+    /// The XPBD solver reports its contacts: a sphere landing on the floor and one rolled into a resting sphere
+    /// give events with the right bodies and an impulse close to what the hits took out of the velocity
+    bool CheckPositionSolverReportsContacts()
+    {
+        const float radius = 0.1f;
+        const float deltaTime = 1.0f / 120.0f;
+
+        PhysicsWorld world;
+        world.gravity = glm::vec3(0.0f, -9.81f, 0.0f);
+        PositionSolver solver;
+        CollisionEventRing events;
+        solver.events = &events;
+
+        std::vector<OBB> walls = { OBB(AABB(glm::vec3(-5.0f, -1.0f, -5.0f), glm::vec3(5.0f, 0.0f, 5.0f))) };
+        int dropped = world.AddBody(glm::vec3(2.0f, radius + 0.01f, 0.0f), glm::vec3(0.0f, -2.0f, 0.0f), radius, 1.0f);
+        int rolled = world.AddBody(glm::vec3(-1.0f, radius, 0.0f), glm::vec3(3.0f, 0.0f, 0.0f), radius, 1.0f);
+        int resting = world.AddBody(glm::vec3(0.0f, radius, 0.0f), glm::vec3(0.0f), radius, 1.0f);
+
+        float floorImpulse = 0.0f;
+        float sphereImpulse = 0.0f;
+        for (int step = 0; step < 120; ++step)
+        {
+            std::vector<std::pair<int, int>> pairs = { { rolled, resting } };
+            std::vector<std::pair<int, int>> wallPairs;
+            for (int body = 0; body < world.GetBodyCount(); ++body) wallPairs.emplace_back(body, 0);
+            solver.Step(world, deltaTime, pairs, wallPairs, walls);
+
+            CollisionEvent event;
+            while (events.Pop(event))
+            {
+                if (event.body1 == dropped && event.body2 == -1) floorImpulse = std::max(floorImpulse, event.impulse);
+                if (event.body1 == rolled && event.body2 == resting) sphereImpulse = std::max(sphereImpulse, event.impulse);
+            }
+        }
+
+        // The drop lands at 2 m/s and leaves at restitution times that, the roll passes most of its 3 m/s on
+        bool passed = floorImpulse > 2.0f && floorImpulse < 4.0f && sphereImpulse > 1.0f && sphereImpulse < 4.0f;
+        return Report("position solver reports contacts", passed, "floor impulse " + std::to_string(floorImpulse)
+            + ", sphere impulse " + std::to_string(sphereImpulse));
+    }
+
+    /// Spheres moving half a metre per step bounce off a wall thinner than they are and off a resting sphere,
+    /// and the sphere that gets hit starts its drawn path where it was hit
+    bool CheckFastSpheresBounce()
+    {
+        const float radius = 0.05f;
+        const float deltaTime = 1.0f / 120.0f;
+
+        PhysicsWorld world;
+        Collision collision;
+        std::vector<OBB> walls = { OBB(AABB(glm::vec3(0.0f, -1.0f, -1.0f), glm::vec3(0.02f, 1.0f, 1.0f))) };
+        AABBTree wallTree;
+        wallTree.margin = 0.0f;
+        wallTree.CreateProxy(walls[0].GetAABB(), 0);
+
+        int thrown = world.AddBody(glm::vec3(-0.3f, 0.0f, 0.0f), glm::vec3(60.0f, 0.0f, 0.0f), radius, 1.0f);
+        int striker = world.AddBody(glm::vec3(-0.6f, 3.0f, 0.0f), glm::vec3(60.0f, 0.0f, 0.0f), radius, 1.0f);
+        int target = world.AddBody(glm::vec3(-0.2f, 3.0f, 0.0f), glm::vec3(0.0f), radius, 1.0f);
+
+        world.SavePreviousPositions();
+        world.Integrate(deltaTime);
+        collision.SweepFastBodies(world, deltaTime, walls, wallTree);
+
+        bool wallHeld = world.posX[thrown] < -radius && world.velX[thrown] < 0.0f;
+        bool targetHit = world.velX[target] > 0.0f && world.velX[striker] < world.velX[target];
+        bool pathFromHit = world.prevX[target] > -0.2f - 0.01f;
+
+        return Report("fast spheres bounce", wallHeld && targetHit && pathFromHit, "thrown sphere ended at x "
+            + std::to_string(world.posX[thrown]) + ", hit sphere moves from x " + std::to_string(world.prevX[target])
+            + " to " + std::to_string(world.posX[target]));
+    }
+
+    /// Touching pairs found through the grid are exactly the ones the O(n^2) loop finds, also after some
+    /// spheres moved and were re-binned with Update
+    bool CheckGridMatchesBruteForce()
+    {
+        srand(4321);
+        PhysicsWorld world;
+        for (int i = 0; i < 500; ++i)
+        {
+            glm::vec3 position((rand() % 2000) / 1000.0f, (rand() % 2000) / 1000.0f, (rand() % 2000) / 1000.0f);
+            world.AddBody(position, glm::vec3(0.0f), 0.02f + (rand() % 60) / 1000.0f, 1.0f);
+        }
+
+        SpatialGrid grid;
+        grid.Build(world);
+
+        auto touching = [&world](int i, int j)
+        {
+            glm::vec3 offset = world.GetPosition(i) - world.GetPosition(j);
+            float sumRadius = world.radius[i] + world.radius[j];
+            return glm::dot(offset, offset) < sumRadius * sumRadius;
+        };
+
+        int mismatches = 0;
+        int pairCount = 0;
+        std::vector<int> neighbours;
+        for (int round = 0; round < 2; ++round)
+        {
+            std::vector<std::pair<int, int>> bruteForce;
+            std::vector<std::pair<int, int>> fromGrid;
+            for (int i = 0; i < world.GetBodyCount(); ++i)
+            {
+                for (int j = i + 1; j < world.GetBodyCount(); ++j)
+                {
+                    if (touching(i, j)) bruteForce.emplace_back(i, j);
+                }
+
+                grid.Neighbours(i, i, neighbours);
+                for (int j : neighbours)
+                {
+                    if (touching(i, j)) fromGrid.emplace_back(i, j);
+                }
+            }
+
+            std::sort(fromGrid.begin(), fromGrid.end());
+            if (fromGrid != bruteForce) mismatches++;
+            pairCount += (int)bruteForce.size();
+
+            // Shuffle a third of the spheres to new places and only re-bin those
+            for (int i = 0; i < world.GetBodyCount(); i += 3)
+            {
+                world.SetPosition(i, glm::vec3((rand() % 2000) / 1000.0f, (rand() % 2000) / 1000.0f, (rand() % 2000) / 1000.0f));
+                grid.Update(i);
+            }
+        }
+
+        return Report("grid matches brute force", mismatches == 0, std::to_string(pairCount) + " touching pairs over 2 rounds, "
+            + std::to_string(mismatches) + " rounds differ");
+    }
+
+    /// The inertia a sphere mesh works out for itself is the solid sphere AddBody assumes, and a cube gets m s^2 / 6
+    bool CheckMeshInertia()
+    {
+        Mesh::headless = true;
+
+        Mesh sphere(Sphere, 1.0f, 4, glm::vec3(1.0f));
+        sphere.globalScale = glm::vec3(0.1f);
+        sphere.CalculateBoundingBox();
+
+        PhysicsWorld world;
+        int body = world.AddBody(glm::vec3(0.0f), glm::vec3(0.0f), sphere.Radius, sphere.mass);
+        float solidSphere = 1.0f / world.invInertiaX[body];
+        world.SetInertia(body, sphere.CalculateInertia());
+        float fromMesh = 1.0f / world.invInertiaX[body];
+
+        Mesh cube(Cube, 0.5f, glm::vec3(1.0f));
+        float cubeMoment = cube.CalculateInertia().x;
+
+        bool passed = std::abs(fromMesh / solidSphere - 1.0f) < 0.02f && std::abs(cubeMoment - cube.mass / 6.0f) < 1e-5f;
+        return Report("mesh inertia", passed, "sphere mesh " + std::to_string(fromMesh) + " against solid sphere "
+            + std::to_string(solidSphere) + ", unit cube " + std::to_string(cubeMoment));
+    }
+
+    /// \brief The hull of a cube is its 8 corners and 12 triangles, the hull of a sphere mesh holds every
+    /// vertex, and both bounding spheres are as tight as they can be
+    bool CheckHullAndBoundingSphere()
+    {
+        Mesh::headless = true;
+
+        Mesh cube(Cube, 0.5f, glm::vec3(1.0f));
+        const ConvexHull& cubeHull = cube.GetConvexHull();
+        float cubeRadius = cube.GetLocalBoundingSphere().radius;
+
+        Mesh sphere(Sphere, 1.0f, 4, glm::vec3(1.0f));
+        const ConvexHull& sphereHull = sphere.GetConvexHull();
+        int outside = 0;
+        for (const Vertex& vertex : sphere.vertices)
+        {
+            if (!sphereHull.Contains(vertex.Position) || !sphere.GetLocalBoundingSphere().Contains(vertex.Position)) outside++;
+        }
+        float sphereRadius = sphere.GetLocalBoundingSphere().radius;
+
+        bool passed = cubeHull.vertices.size() == 8 && cubeHull.indices.size() == 36
+            && std::abs(cubeRadius - 0.5f * std::sqrt(3.0f)) < 1e-4f
+            && outside == 0 && std::abs(sphereRadius - 1.0f) < 1e-3f;
+        return Report("hull and bounding sphere", passed, "cube hull " + std::to_string(cubeHull.vertices.size())
+            + " corners " + std::to_string(cubeHull.indices.size() / 3) + " triangles radius " + std::to_string(cubeRadius)
+            + ", sphere mesh " + std::to_string(outside) + " vertices outside, radius " + std::to_string(sphereRadius));
+    }
+}
+
+int RunSelfChecks()
+{
+    int failed = 0;
+    if (!CheckStackFallsWhenHit()) failed++;
+    if (!CheckPendulumKeepsLength()) failed++;
+    if (!CheckPositionSolverReportsContacts()) failed++;
+    if (!CheckFastSpheresBounce()) failed++;
+    if (!CheckGridMatchesBruteForce()) failed++;
+    if (!CheckMeshInertia()) failed++;
+    if (!CheckHullAndBoundingSphere()) failed++;
+
+    std::cout << (failed == 0 ? "All self checks passed" : std::to_string(failed) + " self checks failed") << std::endl;
+    return failed;
+}
@@ -0,0 +1,6 @@
+﻿#pragma once
+
+/// \brief Small scenes with a known outcome, for machines where nobody watches the window.
+/// Prints one PASS or FAIL line per check with what it measured.
+/// \return number of checks that failed, 0 if everything passed
+int RunSelfChecks();
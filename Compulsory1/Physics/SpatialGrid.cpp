@@ -0,0 +1,99 @@
+﻿#include "SpatialGrid.h"
+
+#include <algorithm>
+#include <cmath>
+
+#include "PhysicsWorld.h"
+
+SpatialGrid::SpatialGrid()
+{
+
+}
+
+glm::ivec3 SpatialGrid::CellOf(const glm::vec3& position) const
+{
+    float invCellSize = 1.0f / cellSize;
+    return glm::ivec3(
+        (int)std::floor(position.x * invCellSize),
+        (int)std::floor(position.y * invCellSize),
+        (int)std::floor(position.z * invCellSize));
+}
+
+int64_t SpatialGrid::CellKey(const glm::ivec3& cell)
+{
+    // 21 bits per axis, offset so negative cells pack too
+    const int64_t offset = 1 << 20;
+    const int64_t mask = (1 << 21) - 1;
+    return ((cell.x + offset) & mask) | (((cell.y + offset) & mask) << 21) | (((cell.z + offset) & mask) << 42);
+}
+
+void SpatialGrid::Build(const PhysicsWorld& world)
+{
+    bodies = &world;
+    const int count = world.GetBodyCount();
+
+    float maxRadius = 0.0f;
+    for (int i = 0; i < count; ++i)
+    {
+        maxRadius = std::max(maxRadius, world.radius[i]);
+    }
+    cellSize = std::max(maxRadius * 2.0f + margin, 0.0001f);
+
+    // Keep the bucket vectors around between frames so rebuilding doesn't allocate,
+    // unless the spheres have wandered through a lot more cells than there are spheres
+    if (buckets.size() > (size_t)count * 4 + 64)
+    {
+        buckets.clear();
+    }
+    for (auto& bucket : buckets)
+    {
+        bucket.second.clear();
+    }
+
+    cells.resize(count);
+    for (int i = 0; i < count; ++i)
+    {
+        cells[i] = CellOf(world.GetPosition(i));
+        buckets[CellKey(cells[i])].push_back(i);
+    }
+}
+
+void SpatialGrid::Update(int index)
+{
+    glm::ivec3 cell = CellOf(bodies->GetPosition(index));
+    if (cell == cells[index]) return;
+
+    std::vector<int>& oldBucket = buckets[CellKey(cells[index])];
+    oldBucket.erase(std::find(oldBucket.begin(), oldBucket.end(), index));
+
+    cells[index] = cell;
+    buckets[CellKey(cell)].push_back(index);
+}
+
+void SpatialGrid::Neighbours(int index, int after, std::vector<int>& out) const
+{
+    out.clear();
+    const glm::ivec3& cell = cells[index];
+
+    for (int dz = -1; dz <= 1; ++dz)
+    {
+        for (int dy = -1; dy <= 1; ++dy)
+        {
+            for (int dx = -1; dx <= 1; ++dx)
+            {
+                auto it = buckets.find(CellKey(cell + glm::ivec3(dx, dy, dz)));
+                if (it == buckets.end()) continue;
+
+                for (int other : it->second)
+                {
+                    if (other > after && other != index)
+                    {
+                        out.push_back(other);
+                    }
+                }
+            }
+        }
+    }
+
+    std::sort(out.begin(), out.end());
+}
@@ -0,0 +1,48 @@
+﻿#pragma once
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+#include "glm/vec3.hpp"
+
+class PhysicsWorld;
+
+/// \brief Uniform grid broadphase for spheres.
+/// Built once, after that only the spheres that moved are re-binned with Update, sleeping ones keep their cell.
+/// Each sphere is binned by its centre into a cell that is one diameter (of the largest sphere) wide,
+/// so two touching spheres are never more than one cell apart.
+class SpatialGrid
+{
+public:
+
+    SpatialGrid();
+
+    void Build(const PhysicsWorld& world);
+
+    /// Bodies binned by the last Build, Update doesn't change this
+    int GetBodyCount() const { return (int)cells.size(); }
+
+    /// \brief Re-bins a sphere after collision response moved it
+    /// \param index body handle in the world passed to Build
+    void Update(int index);
+
+    /// \brief Spheres in the 27 cells around a sphere
+    /// \param index sphere to look around
+    /// \param after only indices greater than this are returned
+    /// \param out sorted ascending, same order as the brute force loop
+    void Neighbours(int index, int after, std::vector<int>& out) const;
+
+    float cellSize = 1.0f;
+
+    /// Added to the cell size picked by Build, for callers that look further than touching distance
+    float margin = 0.0f;
+
+private:
+
+    glm::ivec3 CellOf(const glm::vec3& position) const;
+    static int64_t CellKey(const glm::ivec3& cell);
+
+    const PhysicsWorld* bodies = nullptr;
+
+    std::vector<glm::ivec3> cells;
+    std::unordered_map<int64_t, std::vector<int>> buckets;
+};
@@ -0,0 +1,236 @@
+﻿#include "SweepAndPrune.h"
+
+#include <algorithm>
+#include <iterator>
+
+SweepAndPrune::SweepAndPrune()
+{
+
+}
+
+bool SweepAndPrune::Less(const Endpoint& a, const Endpoint& b)
+{
+    // On ties min goes first, so touching boxes count as overlapping like in AABB::Overlaps
+    return a.value < b.value || (a.value == b.value && !a.isMax && b.isMax);
+}
+
+uint64_t SweepAndPrune::PairKey(int a, int b)
+{
+    return ((uint64_t)(uint32_t)a << 32) | (uint32_t)b;
+}
+
+int SweepAndPrune::AddBody(const AABB& box, int group)
+{
+    int handle = (int)boxes.size();
+    boxes.push_back(box);
+    groups.push_back(group);
+
+    for (int axis = 0; axis < 3; ++axis)
+    {
+        axes[axis].push_back({ box.min[axis], handle, false });
+        axes[axis].push_back({ box.max[axis], handle, true });
+    }
+
+    // New endpoints are appended unsorted, sort everything once on the next update
+    needsRebuild = true;
+    return handle;
+}
+
+void SweepAndPrune::Update()
+{
+    addedPairs.clear();
+    removedPairs.clear();
+
+    if (needsRebuild)
+    {
+        Rebuild();
+        return;
+    }
+
+    for (int axis = 0; axis < 3; ++axis)
+    {
+        for (Endpoint& endpoint : axes[axis])
+        {
+            const AABB& box = boxes[endpoint.body];
+            endpoint.value = endpoint.isMax ? box.max[axis] : box.min[axis];
+        }
+        SortAxis(axis);
+    }
+    CancelDeltas();
+}
+
+void SweepAndPrune::RemapBodies(const std::vector<int>& oldToNew)
+{
+    std::vector<AABB> remapped(boxes.size());
+    std::vector<int> remappedGroups(groups.size());
+    for (size_t old = 0; old < boxes.size(); ++old)
+    {
+        remapped[oldToNew[old]] = boxes[old];
+        remappedGroups[oldToNew[old]] = groups[old];
+    }
+    boxes.swap(remapped);
+    groups.swap(remappedGroups);
+
+    for (int axis = 0; axis < 3; ++axis)
+    {
+        for (Endpoint& endpoint : axes[axis])
+        {
+            endpoint.body = oldToNew[endpoint.body];
+        }
+    }
+
+    pairIndex.clear();
+    for (int p = 0; p < (int)pairs.size(); ++p)
+    {
+        int a = oldToNew[pairs[p].first];
+        int b = oldToNew[pairs[p].second];
+        pairs[p] = std::make_pair(std::min(a, b), std::max(a, b));
+        pairIndex[PairKey(pairs[p].first, pairs[p].second)] = p;
+    }
+
+    // The deltas are about the old names, nobody should read them across a remap
+    addedPairs.clear();
+    removedPairs.clear();
+}
+
+void SweepAndPrune::SortAxis(int axis)
+{
+    std::vector<Endpoint>& endpoints = axes[axis];
+
+    for (int i = 1; i < (int)endpoints.size(); ++i)
+    {
+        Endpoint moving = endpoints[i];
+        int j = i - 1;
+
+        while (j >= 0 && Less(moving, endpoints[j]))
+        {
+            const Endpoint& passed = endpoints[j];
+            const bool canPair = CanPair(moving.body, passed.body);
+
+            if (canPair && !moving.isMax && passed.isMax)
+            {
+                // A min moved below another body's max, they may overlap now
+                if (boxes[moving.body].Overlaps(boxes[passed.body]))
+                {
+                    AddPair(moving.body, passed.body);
+                }
+            }
+            else if (canPair && moving.isMax && !passed.isMax)
+            {
+                // A max moved below another body's min, they are separated on this axis
+                RemovePair(moving.body, passed.body);
+            }
+
+            endpoints[j + 1] = endpoints[j];
+            --j;
+        }
+        endpoints[j + 1] = moving;
+    }
+}
+
+void SweepAndPrune::CancelDeltas()
+{
+    if (addedPairs.empty() || removedPairs.empty()) return;
+
+    // A pair added on one axis and removed on another in the same Update, or the other way round,
+    // ends where it started. Sorted so matching entries cancel one for one
+    std::sort(addedPairs.begin(), addedPairs.end());
+    std::sort(removedPairs.begin(), removedPairs.end());
+
+    std::vector<std::pair<int, int>> added;
+    std::vector<std::pair<int, int>> removed;
+    std::set_difference(addedPairs.begin(), addedPairs.end(), removedPairs.begin(), removedPairs.end(), std::back_inserter(added));
+    std::set_difference(removedPairs.begin(), removedPairs.end(), addedPairs.begin(), addedPairs.end(), std::back_inserter(removed));
+    addedPairs.swap(added);
+    removedPairs.swap(removed);
+}
+
+void SweepAndPrune::Rebuild()
+{
+    needsRebuild = false;
+
+    for (int axis = 0; axis < 3; ++axis)
+    {
+        for (Endpoint& endpoint : axes[axis])
+        {
+            const AABB& box = boxes[endpoint.body];
+            endpoint.value = endpoint.isMax ? box.max[axis] : box.min[axis];
+        }
+        std::sort(axes[axis].begin(), axes[axis].end(), Less);
+    }
+
+    // Full sweep along x to find the overlapping pairs from scratch
+    std::vector<std::pair<int, int>> oldPairs;
+    oldPairs.swap(pairs);
+    std::unordered_map<uint64_t, int> oldIndex;
+    oldIndex.swap(pairIndex);
+
+    std::vector<int> open;
+    for (const Endpoint& endpoint : axes[0])
+    {
+        if (endpoint.isMax)
+        {
+            open.erase(std::find(open.begin(), open.end(), endpoint.body));
+            continue;
+        }
+
+        for (int other : open)
+        {
+            if (CanPair(endpoint.body, other) && boxes[endpoint.body].Overlaps(boxes[other]))
+            {
+                int a = std::min(endpoint.body, other);
+                int b = std::max(endpoint.body, other);
+                pairIndex[PairKey(a, b)] = (int)pairs.size();
+                pairs.emplace_back(a, b);
+
+                if (oldIndex.find(PairKey(a, b)) == oldIndex.end())
+                {
+                    addedPairs.emplace_back(a, b);
+                }
+            }
+        }
+        open.push_back(endpoint.body);
+    }
+
+    for (const std::pair<int, int>& pair : oldPairs)
+    {
+        if (pairIndex.find(PairKey(pair.first, pair.second)) == pairIndex.end())
+        {
+            removedPairs.push_back(pair);
+        }
+    }
+}
+
+void SweepAndPrune::AddPair(int a, int b)
+{
+    if (a > b) std::swap(a, b);
+
+    uint64_t key = PairKey(a, b);
+    if (pairIndex.find(key) != pairIndex.end()) return;
+
+    pairIndex[key] = (int)pairs.size();
+    pairs.emplace_back(a, b);
+    addedPairs.emplace_back(a, b);
+}
+
+void SweepAndPrune::RemovePair(int a, int b)
+{
+    if (a > b) std::swap(a, b);
+
+    auto it = pairIndex.find(PairKey(a, b));
+    if (it == pairIndex.end()) return;
+
+    // Swap with the last pair so removing stays O(1)
+    int index = it->second;
+    pairIndex.erase(it);
+
+    const std::pair<int, int> last = pairs.back();
+    pairs.pop_back();
+    if (index < (int)pairs.size())
+    {
+        pairs[index] = last;
+        pairIndex[PairKey(last.first, last.second)] = index;
+    }
+
+    removedPairs.emplace_back(a, b);
+}
@@ -0,0 +1,80 @@
+﻿#pragma once
+#include <cstdint>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include "AABB.h"
+
+/// \brief Incremental sweep and prune broadphase.
+/// Keeps the min/max endpoints of every body sorted on x, y and z between frames and re-sorts them
+/// with insertion sort, which is close to linear when bodies only move a little each frame.
+/// Overlapping pairs are only touched when two endpoints swap places.
+class SweepAndPrune
+{
+public:
+
+    SweepAndPrune();
+
+    /// \brief Registers a body with its world AABB
+    /// \param group see sameGroupPairs
+    /// \return handle used in the reported pairs, handles are given out in order from 0
+    int AddBody(const AABB& box, int group = 0);
+
+    /// \brief New box for a body, takes effect on the next Update
+    void SetBox(int handle, const AABB& box) { boxes[handle] = box; }
+
+    /// \brief Re-sorts the endpoints from the current boxes and updates the pair list
+    void Update();
+
+    /// \brief Renames every handle after the bodies were renumbered, keeps the sorted order and pairs
+    /// \param oldToNew new handle of each old handle
+    void RemapBodies(const std::vector<int>& oldToNew);
+
+    /// Every pair overlapping right now, (lower handle, higher handle)
+    const std::vector<std::pair<int, int>>& GetPairs() const { return pairs; }
+
+    /// Pairs that started overlapping during the last Update. A pair that started and stopped in the
+    /// same Update is in neither list
+    const std::vector<std::pair<int, int>>& GetAddedPairs() const { return addedPairs; }
+
+    /// Pairs that stopped overlapping during the last Update
+    const std::vector<std::pair<int, int>>& GetRemovedPairs() const { return removedPairs; }
+
+    /// Off means two boxes of the same group never pair, set it before the first Update.
+    /// TriggerSystem puts triggers and bodies in different groups, so bodies are never paired with each other
+    bool sameGroupPairs = true;
+
+private:
+
+    struct Endpoint
+    {
+        float value;
+        int body;
+        bool isMax;
+    };
+
+    static bool Less(const Endpoint& a, const Endpoint& b);
+    static uint64_t PairKey(int a, int b);
+
+    bool CanPair(int a, int b) const { return sameGroupPairs || groups[a] != groups[b]; }
+
+    void Rebuild();
+    void SortAxis(int axis);
+
+    /// \brief Drops the added and removed entries that undo each other
+    void CancelDeltas();
+
+    void AddPair(int a, int b);
+    void RemovePair(int a, int b);
+
+    std::vector<AABB> boxes;
+    std::vector<int> groups;
+    std::vector<Endpoint> axes[3];
+    bool needsRebuild = false;
+
+    std::vector<std::pair<int, int>> pairs;
+    std::unordered_map<uint64_t, int> pairIndex;
+
+    std::vector<std::pair<int, int>> addedPairs;
+    std::vector<std::pair<int, int>> removedPairs;
+};
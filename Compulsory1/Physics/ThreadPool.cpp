@@ -0,0 +1,46 @@
+﻿#include "ThreadPool.h"
+
+#include <vector>
+
+ThreadPool::ThreadPool(int threadCount) : jobs(threadCount)
+{
+
+}
+
+ThreadPool::~ThreadPool()
+{
+
+}
+
+void ThreadPool::ParallelFor(int count, const std::function<void(int, int, int)>& function)
+{
+    if (count <= 0) return;
+
+    const int threads = GetThreadCount();
+    if (threads == 1)
+    {
+        function(0, 0, count);
+        return;
+    }
+
+    auto runChunk = [&function, count, threads](int chunk)
+    {
+        int begin = (int)((long long)count * chunk / threads);
+        int end = (int)((long long)count * (chunk + 1) / threads);
+        if (begin < end) function(chunk, begin, end);
+    };
+
+    std::vector<JobSystem::JobHandle> chunks;
+    chunks.reserve(threads - 1);
+    for (int chunk = 1; chunk < threads; ++chunk)
+    {
+        chunks.push_back(jobs.Schedule([&runChunk, chunk] { runChunk(chunk); }));
+    }
+
+    runChunk(0);
+
+    for (const JobSystem::JobHandle& chunk : chunks)
+    {
+        jobs.Wait(chunk);
+    }
+}
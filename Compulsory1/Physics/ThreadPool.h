@@ -0,0 +1,32 @@
+﻿#pragma once
+#include <functional>
+#include "JobSystem.h"
+
+/// \brief One loop split across every thread of a JobSystem.
+/// ParallelFor always cuts the range into the same chunks for a given thread count and the calling
+/// thread works on chunk 0, so a pool of 1 runs everything inline. The other chunks are jobs that any
+/// idle thread can pick up, so they share the threads with anything else scheduled on the system.
+class ThreadPool
+{
+public:
+
+    /// \param threadCount total threads including the caller, 0 uses every hardware thread
+    explicit ThreadPool(int threadCount = 0);
+    ~ThreadPool();
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    int GetThreadCount() const { return jobs.GetThreadCount(); }
+
+    /// \brief Calls job(chunk, begin, end) once per thread over [0, count) and waits for all of them
+    /// \param job chunk is in [0, GetThreadCount()), ranges are contiguous and in chunk order
+    void ParallelFor(int count, const std::function<void(int, int, int)>& job);
+
+    /// \brief The threads behind the pool, for work that isn't one flat loop
+    JobSystem& GetJobSystem() { return jobs; }
+
+private:
+
+    JobSystem jobs;
+};
@@ -0,0 +1,128 @@
+﻿#include "TriggerSystem.h"
+
+#include "PhysicsWorld.h"
+
+TriggerSystem::TriggerSystem()
+{
+    sweep.sameGroupPairs = false;
+}
+
+uint64_t TriggerSystem::OverlapKey(int trigger, int body)
+{
+    return ((uint64_t)(uint32_t)trigger << 32) | (uint32_t)body;
+}
+
+int TriggerSystem::AddTrigger(const AABB& box)
+{
+    int handle = sweep.AddBody(box, TriggerGroup);
+    handleTrigger.push_back((int)triggerHandles.size());
+    handleBody.push_back(-1);
+    triggerHandles.push_back(handle);
+    triggerBoxes.push_back(box);
+    return (int)triggerHandles.size() - 1;
+}
+
+void TriggerSystem::SetTriggerBox(int trigger, const AABB& box)
+{
+    sweep.SetBox(triggerHandles[trigger], box);
+    triggerBoxes[trigger] = box;
+}
+
+bool TriggerSystem::ToOverlap(const std::pair<int, int>& pair, int& trigger, int& body) const
+{
+    int firstTrigger = handleTrigger[pair.first];
+    int secondTrigger = handleTrigger[pair.second];
+    if ((firstTrigger == -1) == (secondTrigger == -1)) return false;
+
+    trigger = firstTrigger != -1 ? firstTrigger : secondTrigger;
+    body = firstTrigger != -1 ? handleBody[pair.second] : handleBody[pair.first];
+    return true;
+}
+
+void TriggerSystem::Update(const PhysicsWorld& world)
+{
+    for (int body = (int)bodyHandles.size(); body < world.GetBodyCount(); ++body)
+    {
+        int handle = sweep.AddBody(world.GetAABB(body), BodyGroup);
+        handleTrigger.push_back(-1);
+        handleBody.push_back(body);
+        bodyHandles.push_back(handle);
+    }
+
+    // Sleeping bodies haven't moved, their boxes are still right
+    for (int body : world.activeBodies)
+    {
+        sweep.SetBox(bodyHandles[body], world.GetAABB(body));
+    }
+    sweep.Update();
+
+    events.clear();
+
+    // A pair can be both added and removed in one Update when endpoints swap back and forth,
+    // so the boxes decide which way it ended up
+    int trigger, body;
+    for (const std::pair<int, int>& pair : sweep.GetRemovedPairs())
+    {
+        if (!ToOverlap(pair, trigger, body)) continue;
+        if (triggerBoxes[trigger].Overlaps(world.GetAABB(body))) continue;
+        if (RemoveOverlap(trigger, body)) events.push_back({ trigger, body, TriggerExit });
+    }
+
+    for (const std::pair<int, int>& pair : sweep.GetAddedPairs())
+    {
+        if (!ToOverlap(pair, trigger, body)) continue;
+        if (!triggerBoxes[trigger].Overlaps(world.GetAABB(body))) continue;
+        if (AddOverlap(trigger, body)) events.push_back({ trigger, body, TriggerEnter });
+    }
+}
+
+void TriggerSystem::RemapBodies(const std::vector<int>& oldToNew)
+{
+    // Broadphase handles stay the same, only which body owns them changes
+    std::vector<int> remapped(bodyHandles.size());
+    for (int old = 0; old < (int)bodyHandles.size(); ++old)
+    {
+        remapped[oldToNew[old]] = bodyHandles[old];
+        handleBody[bodyHandles[old]] = oldToNew[old];
+    }
+    bodyHandles.swap(remapped);
+
+    overlapIndex.clear();
+    for (int o = 0; o < (int)overlaps.size(); ++o)
+    {
+        overlaps[o].second = oldToNew[overlaps[o].second];
+        overlapIndex[OverlapKey(overlaps[o].first, overlaps[o].second)] = o;
+    }
+
+    // Events are about the old names
+    events.clear();
+}
+
+bool TriggerSystem::AddOverlap(int trigger, int body)
+{
+    uint64_t key = OverlapKey(trigger, body);
+    if (overlapIndex.find(key) != overlapIndex.end()) return false;
+
+    overlapIndex[key] = (int)overlaps.size();
+    overlaps.emplace_back(trigger, body);
+    return true;
+}
+
+bool TriggerSystem::RemoveOverlap(int trigger, int body)
+{
+    auto it = overlapIndex.find(OverlapKey(trigger, body));
+    if (it == overlapIndex.end()) return false;
+
+    // Swap with the last overlap so removing stays O(1)
+    int index = it->second;
+    overlapIndex.erase(it);
+
+    const std::pair<int, int> last = overlaps.back();
+    overlaps.pop_back();
+    if (index < (int)overlaps.size())
+    {
+        overlaps[index] = last;
+        overlapIndex[OverlapKey(last.first, last.second)] = index;
+    }
+    return true;
+}
@@ -0,0 +1,81 @@
+﻿#pragma once
+#include <cstdint>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include "AABB.h"
+#include "SweepAndPrune.h"
+
+class PhysicsWorld;
+
+enum TriggerEventType {TriggerEnter, TriggerExit};
+
+struct TriggerEvent
+{
+    int trigger;
+    int body;
+    TriggerEventType type;
+};
+
+/// \brief Boxes that report which bodies are inside them without pushing anything around.
+/// Triggers and bodies share one SweepAndPrune, and enter and exit events come straight from its added
+/// and removed pairs, so a frame where nothing crosses a trigger edge costs about as much as re-sorting
+/// the endpoints of the bodies that moved. Triggers and bodies sit in different groups of it, so two
+/// bodies passing each other never make a pair. Overlap is box against box, a sphere counts as inside
+/// once its AABB touches the trigger.
+class TriggerSystem
+{
+public:
+
+    TriggerSystem();
+
+    /// \return trigger index used in the events, given out in order from 0
+    int AddTrigger(const AABB& box);
+
+    /// \brief Moves a trigger, takes effect on the next Update
+    void SetTriggerBox(int trigger, const AABB& box);
+
+    /// \brief Picks up new bodies and the moves of awake ones, then rebuilds the event list
+    void Update(const PhysicsWorld& world);
+
+    /// \brief Renames bodies after PhysicsWorld::SortByMorton, overlaps are kept
+    void RemapBodies(const std::vector<int>& oldToNew);
+
+    /// Enter and exit events from the last Update. Who is still inside is in GetOverlaps
+    const std::vector<TriggerEvent>& GetEvents() const { return events; }
+
+    /// Every (trigger, body) inside each other right now
+    const std::vector<std::pair<int, int>>& GetOverlaps() const { return overlaps; }
+
+    int GetTriggerCount() const { return (int)triggerHandles.size(); }
+
+private:
+
+    static uint64_t OverlapKey(int trigger, int body);
+
+    // SweepAndPrune groups, only pairs across them are reported
+    static const int BodyGroup = 0;
+    static const int TriggerGroup = 1;
+
+    /// \brief Splits a broadphase pair into trigger and body
+    /// \return false for body against body or trigger against trigger
+    bool ToOverlap(const std::pair<int, int>& pair, int& trigger, int& body) const;
+
+    /// \return false if it was already there, or already gone
+    bool AddOverlap(int trigger, int body);
+    bool RemoveOverlap(int trigger, int body);
+
+    SweepAndPrune sweep;
+
+    // Broadphase handle of each trigger and body, and what each handle belongs to
+    std::vector<int> triggerHandles;
+    std::vector<AABB> triggerBoxes;
+    std::vector<int> bodyHandles;
+    std::vector<int> handleTrigger;
+    std::vector<int> handleBody;
+
+    std::vector<std::pair<int, int>> overlaps;
+    std::unordered_map<uint64_t, int> overlapIndex;
+
+    std::vector<TriggerEvent> events;
+};